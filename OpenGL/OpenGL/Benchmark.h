@@ -0,0 +1,198 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <chrono>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "obj_loader.h"
+#include "Display.h"
+#include "Renderer.h"
+
+// Grids the OBJ benchmarks write, from 10k to 10M face corners
+const GLuint BENCHMARK_OBJ_CORNERS[] = { 10000, 100000, 1000000, 10000000 };
+const GLuint BENCHMARK_OBJ_SIZES = sizeof(BENCHMARK_OBJ_CORNERS) / sizeof(BENCHMARK_OBJ_CORNERS[0]);
+const char* const BENCHMARK_OBJ_PATH = "./benchmark_grid.obj";
+
+// Streaming import of --import-obj: the grid it generates when no file is given, and where batches go
+const GLuint BENCHMARK_IMPORT_CORNERS = 10000000;
+const GLuint BENCHMARK_IMPORT_BUDGET_MB = 16;
+const char* const BENCHMARK_IMPORT_PATH = "./benchmark_import.bin";
+const char* const BENCHMARK_IMPORT_SCRATCH = "./benchmark_import";
+
+// Objects per frame of the draw benchmark; every count is timed over a few frames after a warm-up
+const GLuint BENCHMARK_DRAW_COUNTS[] = { 1000, 10000, 100000 };
+const GLuint BENCHMARK_DRAW_SIZES	 = sizeof(BENCHMARK_DRAW_COUNTS) / sizeof(BENCHMARK_DRAW_COUNTS[0]);
+const GLuint BENCHMARK_DRAW_FRAMES	 = 8;
+
+// Command-line modes that time a stage on synthetic input instead of showing the scene:
+// --bench-obj and --import-obj run before the window opens, --bench-mdi once the renderer exists
+class Benchmark
+{
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	static double Seconds(const Clock::time_point& start) { return std::chrono::duration<double>(Clock::now() - start).count(); }
+
+	// Triangulated grid of cells by cells quads with positions, uvs and optionally one shared normal;
+	// returns the file's size in bytes
+	static size_t WriteGridOBJ(const std::string& path, GLuint cells, bool normals = true)
+	{
+		std::FILE* file = std::fopen(path.c_str(), "wb");
+		if (!file)
+		{
+			std::cout << "ERROR::BENCHMARK:: Cannot write " << path << std::endl;
+			return 0;
+		}
+
+		GLuint side = cells + 1;
+		for (GLuint y = 0; y < side; ++y)
+			for (GLuint x = 0; x < side; ++x)
+				std::fprintf(file, "v %f %f %f\n", (GLfloat)x / cells, 0.05f * std::sin(0.1f * x) * std::cos(0.1f * y), (GLfloat)y / cells);
+		for (GLuint y = 0; y < side; ++y)
+			for (GLuint x = 0; x < side; ++x)
+				std::fprintf(file, "vt %f %f\n", (GLfloat)x / cells, (GLfloat)y / cells);
+		if (normals)
+			std::fprintf(file, "vn 0.000000 1.000000 0.000000\n");
+		const char* const face = normals ? "f %u/%u/1 %u/%u/1 %u/%u/1\n" : "f %u/%u %u/%u %u/%u\n";
+		for (GLuint y = 0; y < cells; ++y)
+		{
+			for (GLuint x = 0; x < cells; ++x)
+			{
+				GLuint a = y * side + x + 1, b = a + 1, c = a + side, d = c + 1;
+				std::fprintf(file, face, a, a, c, c, b, b);
+				std::fprintf(file, face, b, b, c, c, d, d);
+			}
+		}
+		size_t size = std::ftell(file);
+		std::fclose(file);
+		return size;
+	}
+
+public:
+	// Parses and welds grids of growing size. Parsing is timed on one thread and on all
+	// of them; welding at a constant time per corner scales linearly.
+	static void RunOBJ()
+	{
+		for (GLuint i = 0; i < BENCHMARK_OBJ_SIZES; ++i)
+		{
+			GLuint cells = (GLuint)std::ceil(std::sqrt(BENCHMARK_OBJ_CORNERS[i] / 6.0));
+			size_t bytes = WriteGridOBJ(BENCHMARK_OBJ_PATH, cells);
+			if (!bytes)
+				return;
+
+			Clock::time_point start = Clock::now();
+			OBJModel serial(BENCHMARK_OBJ_PATH, 1);
+			double serialSeconds = Seconds(start);
+			start = Clock::now();
+			OBJModel model(BENCHMARK_OBJ_PATH);
+			double parallelSeconds = Seconds(start);
+			std::cout << "OBJ parse: " << bytes / 1e6 << " MB, " << bytes / 1e6 / serialSeconds << " MB/s on 1 thread, "
+				<< bytes / 1e6 / parallelSeconds << " MB/s on all" << std::endl;
+
+			start = Clock::now();
+			IndexedModel indexed = model.ToIndexedModel();
+			double seconds = Seconds(start);
+
+			std::cout << "OBJ weld:  " << model.OBJIndices.size() << " corners -> " << indexed.positions.size() << " vertices, "
+				<< seconds * 1000.0 << " ms, " << seconds * 1e9 / model.OBJIndices.size() << " ns/corner" << std::endl;
+		}
+		std::remove(BENCHMARK_OBJ_PATH);
+	}
+
+	// Streams an OBJ through OBJStreamImporter within budgetMB, appending every batch to
+	// BENCHMARK_IMPORT_PATH as its counts followed by positions, uvs, normals and indices.
+	// Without a path a normal-less grid is generated so the smoothing pass runs too.
+	static bool RunImport(const std::string& path, GLuint budgetMB)
+	{
+		std::string objPath = path;
+		if (objPath.empty())
+		{
+			objPath = BENCHMARK_OBJ_PATH;
+			if (!WriteGridOBJ(objPath, (GLuint)std::ceil(std::sqrt(BENCHMARK_IMPORT_CORNERS / 6.0)), false))
+				return false;
+		}
+
+		std::FILE* out = std::fopen(BENCHMARK_IMPORT_PATH, "wb");
+		if (!out)
+		{
+			std::cout << "ERROR::BENCHMARK:: Cannot write " << BENCHMARK_IMPORT_PATH << std::endl;
+			return false;
+		}
+
+		size_t budget = (size_t)budgetMB << 20;
+		GLuint batches = 0, vertices = 0, indices = 0;
+		OBJStreamImporter importer(budget);
+
+		Clock::time_point start = Clock::now();
+		bool imported = importer.Import(objPath, BENCHMARK_IMPORT_SCRATCH, [&](const IndexedModel& batch)
+		{
+			GLuint counts[2] = { (GLuint)batch.positions.size(), (GLuint)batch.indices.size() };
+			std::fwrite(counts, sizeof(counts), 1, out);
+			std::fwrite(&batch.positions[0], sizeof(glm::vec3), counts[0], out);
+			std::fwrite(&batch.texCoords[0], sizeof(glm::vec2), counts[0], out);
+			std::fwrite(&batch.normals[0], sizeof(glm::vec3), counts[0], out);
+			std::fwrite(&batch.indices[0], sizeof(GLuint), counts[1], out);
+
+			++batches;
+			vertices += counts[0];
+			indices += counts[1];
+		});
+		double seconds = Seconds(start);
+		std::fclose(out);
+
+		if (path.empty())
+			std::remove(objPath.c_str());
+		if (!imported)
+			return false;
+
+		std::cout << "OBJ import: " << batches << " batches of up to " << importer.GetMaxBatchVertices() << " vertices, " << vertices << " vertices, "
+			<< indices / 3 << " triangles, " << importer.GetDroppedTriangles() << " dropped, " << seconds * 1000.0 << " ms" << std::endl;
+		std::cout << "OBJ import: peak " << importer.GetPeakMemory() / 1e6 << " MB of a " << budget / 1e6 << " MB budget, batches in "
+			<< BENCHMARK_IMPORT_PATH << std::endl;
+		return true;
+	}
+
+	// Frame time of N objects drawn one glDrawElements each and through the multi-draw
+	// backend's Flush, CPU submission and GPU execution together
+	static void RunMDI(Display& display, Renderer& renderer, const glm::mat4& projection, const glm::mat4& view)
+	{
+		const RenderDraw DRAWS[] = { RENDER_DRAW_ELEMENTS, RENDER_DRAW_MULTI };
+		const char* const NAMES[] = { "per object", "multi-draw" };
+
+		renderer.SetProjectionMatrix(projection);
+		renderer.SetViewMatrix(view);
+		for (GLuint i = 0; i < BENCHMARK_DRAW_SIZES; ++i)
+		{
+			for (GLuint d = 0; d < 2; ++d)
+			{
+				double seconds = 0.0;
+				for (GLuint frame = 0; frame <= BENCHMARK_DRAW_FRAMES; ++frame)
+				{
+					renderer.BeginFrame();
+					display.Clear(0.2f, 0.2f, 0.2f, 1.0f);
+					glFinish();
+
+					Clock::time_point start = Clock::now();
+					renderer.RenderDrawBenchmark(BENCHMARK_DRAW_COUNTS[i], DRAWS[d]);
+					glFinish();
+					if (frame > 0)
+						seconds += Seconds(start);
+
+					renderer.EndFrame();
+					display.SwapBuffers();
+				}
+				seconds /= BENCHMARK_DRAW_FRAMES;
+
+				std::cout << "Draw " << NAMES[d] << ": " << BENCHMARK_DRAW_COUNTS[i] << " objects, " << renderer.GetRenderStatistics().drawCalls << " calls, "
+					<< seconds * 1000.0 << " ms, " << seconds * 1e9 / BENCHMARK_DRAW_COUNTS[i] << " ns/object" << std::endl;
+			}
+		}
+	}
+};
+
+#endif
@@ -5,6 +5,9 @@
 #include <GL/glew.h>
 #include <SOIL/SOIL.h>
 
+#include "GLState.h"
+#include "TextureUnit.h"
+
 class CubemapTexture
 {
 private:
@@ -23,7 +26,7 @@ public:
 	{
 		std::string sides[] = { "right", "left", "top", "bottom", "back", "front" };
 		glGenTextures(1, &texture);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		GLState::Get().BindTexture(GL_TEXTURE_CUBE_MAP, texture);
 
 		int textureWidth, textureHeight;
 		unsigned char* image;
@@ -48,13 +51,12 @@ public:
 
 	void Use()
 	{		
-		glActiveTexture(GL_TEXTURE10);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		GLState::Get().BindTexture(TEXTURE_UNIT::SKYBOX_UNIT, GL_TEXTURE_CUBE_MAP, texture);
 	}
 
+	// The cubemap stays bound until the skybox unit is given another one
 	void Unuse()
 	{
-		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 	}
 
 	~CubemapTexture()
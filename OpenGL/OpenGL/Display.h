@@ -1,9 +1,15 @@
 #ifndef DISPLAY_H
 #define DISPLAY_H
 
+#include <cstdlib>
+#include <iostream>
+
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
 #include "Shader.h"
+#include "GLState.h"
+
+const UniformId SCREEN_TEXTURE = UniformTable::Intern("screenTexture");
 
 class Display
 {
@@ -35,14 +41,22 @@ public:
 		
 		glewInit();
 
+		// GeometryArena describes every vertex layout with separate formats and bindings (core in 4.3)
+		if (!GLEW_ARB_vertex_attrib_binding)
+		{
+			std::cout << "ERROR::DISPLAY:: ARB_vertex_attrib_binding is not supported" << std::endl;
+			SDL_GL_DeleteContext(glContext);
+			SDL_DestroyWindow(window);
+			SDL_Quit();
+			std::exit(EXIT_FAILURE);
+		}
+
 		glViewport(0, 0, width, height);
 		glEnable(GL_DEPTH_TEST);
-		/*glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK);*/
 		glEnable(GL_FRAMEBUFFER_SRGB);
 
 		InitOffscreenRenderTarget();
-		InitDepthMapRenderTarget();
+		InitScreenQuad();
 	}
 
 	void Clear(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
@@ -72,83 +86,57 @@ public:
 	void InitOffscreenRenderTarget()
 	{		
 		glGenFramebuffers(1, &framebuffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 					
 		glGenTextures(1, &framebufferColorTex);
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, framebufferColorTex);
+		GLState::Get().BindTexture(GL_TEXTURE_2D_MULTISAMPLE, framebufferColorTex);
 		glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_SRGB, width, height, GL_TRUE);		
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, framebufferColorTex, 0);
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+		GLState::Get().BindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
 
 		glGenTextures(1, &framebufferDepthTex);
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, framebufferDepthTex);
+		GLState::Get().BindTexture(GL_TEXTURE_2D_MULTISAMPLE, framebufferDepthTex);
 		glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_DEPTH_COMPONENT24, width, height, GL_TRUE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, framebufferDepthTex, 0);
-		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+		GLState::Get().BindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
 
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		{
 			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
 		}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);				
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);				
 	}
 
 	void RenderSceneToFrameBuffer()
 	{	
-		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);	
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);	
 		Clear(0.0f, 0.0f, 0.0f, 1.0f);
 	}	
 
 	void DisplayFrameBufferContent()
 	{
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		GLState::Get().BindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		GLState::Get().BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 	}
 
 private:
-		GLuint depthMapFramebuffer;
-		GLuint depthMapFramebufferDepthTex;
 		GLuint VAO;
 		Shader offscreenShader;
 
 public:
-	const GLuint& GetShadowMapTexure() { return depthMapFramebufferDepthTex; }
-
-	void InitDepthMapRenderTarget()
+	// The shadow maps are the renderer's; the quad is left to show textures for debugging
+	void InitScreenQuad()
 	{
-		glGenFramebuffers(1, &depthMapFramebuffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFramebuffer);
-		
-		glGenTextures(1, &depthMapFramebufferDepthTex);
-		glBindTexture(GL_TEXTURE_2D, depthMapFramebufferDepthTex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapFramebufferDepthTex, 0);		
-		glBindTexture(GL_TEXTURE_2D, 0);
-				
-		glDrawBuffer(GL_NONE);
-		glReadBuffer(GL_NONE);
-
-		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		{
-			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-		}
-
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
 		offscreenShader = Shader("./res/shaders/offscreen.vs", "./res/shaders/offscreen.fs", "offscreen");
 
 		GLfloat quad[] = {
@@ -162,11 +150,11 @@ public:
 		};
 
 		glGenVertexArrays(1, &VAO);
-		glBindVertexArray(VAO);
+		GLState::Get().BindVertexArray(VAO);
 
 		GLuint VBO;
 		glGenBuffers(1, &VBO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		GLState::Get().BindBuffer(GL_ARRAY_BUFFER, VBO);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(quad), &quad[0], GL_STATIC_DRAW);		
 
 		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const GLvoid*)0);
@@ -174,33 +162,25 @@ public:
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const GLvoid*)(2 * sizeof(GLfloat)));
 		glEnableVertexAttribArray(1);
 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		GLState::Get().BindBuffer(GL_ARRAY_BUFFER, 0);
 
-		glBindVertexArray(0);
+		GLState::Get().BindVertexArray(0);
 	}
 	
-	void RenderSceneToDepthMap()
-	{
-		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFramebuffer);
-		Clear(0.0f, 0.0f, 0.0f, 1.0f);
-	}
-
-	void DisplayDepthMapContent()
+	// Draws a 2D texture over the bound framebuffer
+	void DisplayTexture(GLuint texture)
 	{
 		offscreenShader.Use();
-			glUniform1i(glGetUniformLocation(offscreenShader.GetProgram(), "screenTexture"), 0);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, depthMapFramebufferDepthTex);
-			glBindVertexArray(VAO);				
+			glUniform1i(offscreenShader.GetUniformLocation(SCREEN_TEXTURE), 0);
+			GLState::Get().BindTexture(0, GL_TEXTURE_2D, texture);
+			GLState::Get().BindVertexArray(VAO);				
 			glDrawArrays(GL_TRIANGLES, 0, 6);
-			glBindVertexArray(0);
-			glBindTexture(GL_TEXTURE_2D, 0);
 		offscreenShader.Unuse();
 	}
 
 	void RenderSceneOnscreen()
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 };
 
@@ -0,0 +1,341 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <map>
+#include <utility>
+
+#include <GL/glew.h>
+
+#include "PipelineState.h"
+
+// Cached value of a binding the tracker has not seen being set
+const GLuint GL_STATE_UNKNOWN = 0xFFFFFFFF;
+
+// Range bound to an indexed buffer binding point
+typedef struct BufferRange
+{
+	GLuint buffer;
+	GLintptr offset;
+	GLsizeiptr size;
+
+	bool operator==(const BufferRange& range) const { return buffer == range.buffer && offset == range.offset && size == range.size; }
+} BufferRange;
+
+// Vertex buffer bound to a binding of a vertex array
+typedef struct VertexBufferBinding
+{
+	GLuint buffer;
+	GLintptr offset;
+	GLsizei stride;
+
+	bool operator==(const VertexBufferBinding& binding) const { return buffer == binding.buffer && offset == binding.offset && stride == binding.stride; }
+} VertexBufferBinding;
+
+typedef struct ScissorBox
+{
+	GLint x;
+	GLint y;
+	GLsizei width;
+	GLsizei height;
+
+	bool operator==(const ScissorBox& box) const { return x == box.x && y == box.y && width == box.width && height == box.height; }
+} ScissorBox;
+
+// Shadow copy of the context's bindings and fixed function state. Every bind
+// goes through here and is dropped when the object is already bound; unbinding
+// is lazy, the next bind of the same kind replaces the object. Code that binds
+// or sets state behind the tracker's back must call Invalidate afterwards.
+class GLState
+{
+private:
+	GLuint program;
+	GLuint vertexArray;
+	GLuint activeUnit;
+	GLuint drawFramebuffer;
+	GLuint readFramebuffer;
+
+	std::map<std::pair<GLuint, GLenum>, GLuint> textures;	// (unit, target) -> texture
+	std::map<GLenum, GLuint> buffers;						// generic binding of each target
+	std::map<GLuint, GLuint> elementBuffers;				// vertex array -> element array buffer
+	std::map<std::pair<GLenum, GLuint>, BufferRange> bufferRanges;
+	std::map<std::pair<GLuint, GLuint>, VertexBufferBinding> vertexBuffers;	// (vertex array, binding)
+
+	const PipelineState* pipeline;	// NULL until one is applied
+	PipelineStateDesc pipelineDesc;
+	GLenum cullMode;				// kept while culling is off
+
+	GLuint scissorTest;
+	ScissorBox scissorBox;			// kept while the test is off
+
+	GLuint issued;
+	GLuint elided;
+
+	GLState() { Invalidate(); ResetStatistics(); }
+	GLState(const GLState&);
+	GLState& operator=(const GLState&);
+
+	// Records value into cached, returns whether the call has to reach GL
+	template <typename T>
+	bool Changes(T& cached, const T& value)
+	{
+		if (cached == value)
+		{
+			elided++;
+			return false;
+		}
+		cached = value;
+		issued++;
+		return true;
+	}
+
+	template <typename K, typename T>
+	bool Changes(std::map<K, T>& cache, const K& key, const T& value)
+	{
+		typename std::map<K, T>::iterator it = cache.find(key);
+		if (it == cache.end())
+		{
+			cache.insert(std::make_pair(key, value));
+			issued++;
+			return true;
+		}
+		return Changes(it->second, value);
+	}
+
+	// Counts one call of a pipeline state change; everything is issued until a state is known
+	bool StateChanges(bool changed)
+	{
+		if (!changed && pipeline)
+		{
+			elided++;
+			return false;
+		}
+		issued++;
+		return true;
+	}
+
+	static void Capability(GLenum capability, bool enable)
+	{
+		if (enable)
+			glEnable(capability);
+		else
+			glDisable(capability);
+	}
+
+public:
+	// One tracker for the one context
+	static GLState& Get()
+	{
+		static GLState state;
+		return state;
+	}
+
+	// Forgets every binding, so the next bind of each kind is issued
+	void Invalidate()
+	{
+		program = vertexArray = activeUnit = drawFramebuffer = readFramebuffer = GL_STATE_UNKNOWN;
+		textures.clear();
+		buffers.clear();
+		elementBuffers.clear();
+		bufferRanges.clear();
+		vertexBuffers.clear();
+		pipeline = NULL;
+		cullMode = GL_STATE_UNKNOWN;
+		scissorTest = GL_STATE_UNKNOWN;
+		ScissorBox unknown = { -1, -1, -1, -1 };
+		scissorBox = unknown;
+	}
+
+	void UseProgram(GLuint program)
+	{
+		if (Changes(this->program, program))
+			glUseProgram(program);
+	}
+
+	void BindVertexArray(GLuint vertexArray)
+	{
+		if (Changes(this->vertexArray, vertexArray))
+			glBindVertexArray(vertexArray);
+	}
+
+	void ActiveTexture(GLuint unit)
+	{
+		if (Changes(activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	// Binds to the given unit, selecting it only when the binding changes
+	void BindTexture(GLuint unit, GLenum target, GLuint texture)
+	{
+		std::pair<GLuint, GLenum> key(unit, target);
+		std::map<std::pair<GLuint, GLenum>, GLuint>::iterator it = textures.find(key);
+		if (it != textures.end() && it->second == texture)
+		{
+			elided++;
+			return;
+		}
+		ActiveTexture(unit);
+		textures[key] = texture;
+		glBindTexture(target, texture);
+		issued++;
+	}
+
+	// Binds to the active unit, for creating and editing textures
+	void BindTexture(GLenum target, GLuint texture)
+	{
+		if (activeUnit == GL_STATE_UNKNOWN)
+			ActiveTexture(0);
+		BindTexture(activeUnit, target, texture);
+	}
+
+	// Element array bindings belong to the bound vertex array
+	void BindBuffer(GLenum target, GLuint buffer)
+	{
+		if (target != GL_ELEMENT_ARRAY_BUFFER)
+		{
+			if (!Changes(buffers, target, buffer))
+				return;
+		}
+		else if (vertexArray == GL_STATE_UNKNOWN)
+			issued++;
+		else if (!Changes(elementBuffers, vertexArray, buffer))
+			return;
+		glBindBuffer(target, buffer);
+	}
+
+	// Also sets the generic binding of target, as GL does
+	void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+	{
+		BufferRange range = { buffer, offset, size };
+		if (Changes(bufferRanges, std::make_pair(target, index), range))
+		{
+			glBindBufferRange(target, index, buffer, offset, size);
+			buffers[target] = buffer;
+		}
+	}
+
+	// Vertex buffer bindings belong to the bound vertex array
+	void BindVertexBuffer(GLuint binding, GLuint buffer, GLintptr offset, GLsizei stride)
+	{
+		VertexBufferBinding vertexBuffer = { buffer, offset, stride };
+		if (vertexArray == GL_STATE_UNKNOWN)
+			issued++;
+		else if (!Changes(vertexBuffers, std::make_pair(vertexArray, binding), vertexBuffer))
+			return;
+		glBindVertexBuffer(binding, buffer, offset, stride);
+	}
+
+	// GL_FRAMEBUFFER binds both targets, narrowed to the one that differs
+	void BindFramebuffer(GLenum target, GLuint framebuffer)
+	{
+		bool draw = target != GL_READ_FRAMEBUFFER && drawFramebuffer != framebuffer;
+		bool read = target != GL_DRAW_FRAMEBUFFER && readFramebuffer != framebuffer;
+		if (!draw && !read)
+		{
+			elided++;
+			return;
+		}
+		if (draw)
+			drawFramebuffer = framebuffer;
+		if (read)
+			readFramebuffer = framebuffer;
+		glBindFramebuffer(draw && read ? GL_FRAMEBUFFER : draw ? GL_DRAW_FRAMEBUFFER : GL_READ_FRAMEBUFFER, framebuffer);
+		issued++;
+	}
+
+	// Emits only the calls whose state differs from the pipeline state applied last
+	void ApplyPipelineState(const PipelineState& state)
+	{
+		if (pipeline == &state)
+		{
+			elided++;
+			return;
+		}
+
+		const PipelineStateDesc& desc = state.GetDesc();
+		const PipelineStateDesc& last = pipelineDesc;
+
+		if (StateChanges(desc.blend != last.blend))
+			Capability(GL_BLEND, desc.blend);
+		if (StateChanges(desc.blendSrc != last.blendSrc || desc.blendDst != last.blendDst))
+			glBlendFunc(desc.blendSrc, desc.blendDst);
+
+		if (StateChanges(desc.depthTest != last.depthTest))
+			Capability(GL_DEPTH_TEST, desc.depthTest);
+		if (StateChanges(desc.depthWrite != last.depthWrite))
+			glDepthMask(desc.depthWrite);
+		if (StateChanges(desc.depthFunc != last.depthFunc))
+			glDepthFunc(desc.depthFunc);
+
+		if (StateChanges(desc.stencilTest != last.stencilTest))
+			Capability(GL_STENCIL_TEST, desc.stencilTest);
+		if (StateChanges(desc.stencilFunc != last.stencilFunc || desc.stencilRef != last.stencilRef || desc.stencilReadMask != last.stencilReadMask))
+			glStencilFunc(desc.stencilFunc, desc.stencilRef, desc.stencilReadMask);
+		if (StateChanges(desc.stencilWriteMask != last.stencilWriteMask))
+			glStencilMask(desc.stencilWriteMask);
+		if (StateChanges(desc.stencilFail != last.stencilFail || desc.stencilDepthFail != last.stencilDepthFail || desc.stencilPass != last.stencilPass))
+			glStencilOp(desc.stencilFail, desc.stencilDepthFail, desc.stencilPass);
+
+		if (StateChanges((desc.cullFace != GL_NONE) != (last.cullFace != GL_NONE)))
+			Capability(GL_CULL_FACE, desc.cullFace != GL_NONE);
+		if (desc.cullFace != GL_NONE && StateChanges(desc.cullFace != cullMode))
+		{
+			glCullFace(desc.cullFace);
+			cullMode = desc.cullFace;
+		}
+		if (StateChanges(desc.frontFace != last.frontFace))
+			glFrontFace(desc.frontFace);
+
+		if (StateChanges(desc.colorWrite != last.colorWrite))
+			glColorMask(desc.colorWrite, desc.colorWrite, desc.colorWrite, desc.colorWrite);
+
+		pipeline = &state;
+		pipelineDesc = desc;
+	}
+
+	// Scissoring is not part of the pipeline state; passes that clip to a region set it around their draws
+	void SetScissorTest(bool enable)
+	{
+		if (Changes(scissorTest, (GLuint)enable))
+			Capability(GL_SCISSOR_TEST, enable);
+	}
+
+	void SetScissorBox(GLint x, GLint y, GLsizei width, GLsizei height)
+	{
+		ScissorBox box = { x, y, width, height };
+		if (Changes(scissorBox, box))
+			glScissor(x, y, width, height);
+	}
+
+	// Deletes buffer and forgets where it was bound, as GL unbinds it
+	void DeleteBuffer(GLuint buffer)
+	{
+		for (std::map<GLenum, GLuint>::iterator it = buffers.begin(); it != buffers.end(); ++it)
+		{
+			if (it->second == buffer)
+				it->second = 0;
+		}
+		for (std::map<GLuint, GLuint>::iterator it = elementBuffers.begin(); it != elementBuffers.end(); ++it)
+		{
+			if (it->second == buffer)
+				it->second = 0;
+		}
+		for (std::map<std::pair<GLenum, GLuint>, BufferRange>::iterator it = bufferRanges.begin(); it != bufferRanges.end(); ++it)
+		{
+			if (it->second.buffer == buffer)
+				it->second.buffer = 0;
+		}
+		for (std::map<std::pair<GLuint, GLuint>, VertexBufferBinding>::iterator it = vertexBuffers.begin(); it != vertexBuffers.end(); ++it)
+		{
+			if (it->second.buffer == buffer)
+				it->second.buffer = 0;
+		}
+		glDeleteBuffers(1, &buffer);
+	}
+
+	// Calls that reached GL and calls dropped as redundant since the last reset
+	void ResetStatistics() { issued = elided = 0; }
+	GLuint GetIssuedCalls() const { return issued; }
+	GLuint GetElidedCalls() const { return elided; }
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <glm/glm.hpp>
 
 #include "Mesh.h"
+#include "MeshOptimizer.h"
 #include "obj_loader.h"
 
 // Constant normals
@@ -61,7 +62,9 @@ public:
 				indices[k + 5] = (i + 1)*n + j + 1;
 				k += 6;
 			}
-		}		
+		}
+
+		MeshOptimizer::Optimize(vertices, indices, "plane");
 	}
 
 	static void GenerateCube(std::vector<Vertex>& vertices)
@@ -144,13 +147,15 @@ public:
 		vertices[i++] = Vertex(d, normal, TEX_COORDS_ARR[3], tangent);
 	}
 
-	static void GenerateFromFile(const GLchar* path, std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+	// numThreads == 0 parses with one worker per hardware thread
+	static void GenerateFromFile(const GLchar* path, std::vector<Vertex>& vertices, std::vector<GLuint>& indices, GLuint numThreads = 0)
 	{
 		vertices.clear();
 		indices.clear();
 
-		OBJModel sphereModel(path);
-		IndexedModel im = sphereModel.ToIndexedModel();		
+		// Welded, so the simplifier and the clusterizer see shared edges
+		OBJModel sphereModel(path, numThreads);
+		IndexedModel im = sphereModel.ToIndexedModel();
 		Vertex v;
 		for (GLuint i = 0; i < im.positions.size(); ++i)
 		{
@@ -163,6 +168,8 @@ public:
 		{
 			indices.push_back(im.indices[i]);
 		}
+
+		MeshOptimizer::Optimize(vertices, indices, path);
 	}
 
 	~Geometry() { }
@@ -0,0 +1,273 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <map>
+#include <cstddef>
+#include <algorithm>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "Vertex.h"
+#include "GLState.h"
+
+const GLuint ARENA_INITIAL_VERTICES	   = 1 << 16;
+const GLuint ARENA_INITIAL_INDEX_BYTES = 1 << 20;
+const GLuint ARENA_INDEX_ALIGNMENT	   = sizeof(GLuint);
+
+enum VERTEX_BINDING
+{
+	VERTEX_BINDING_VERTICES = 0,
+	VERTEX_BINDING_INSTANCES
+};
+
+// First-fit free list over [0, capacity); neighbouring free ranges are merged
+class RangeAllocator
+{
+private:
+	std::map<GLuint, GLuint> freeRanges;	// offset -> size
+	GLuint capacity;
+
+public:
+	RangeAllocator() : capacity(0) { }
+
+	GLuint GetCapacity() const { return capacity; }
+
+	bool Allocate(GLuint size, GLuint alignment, GLuint& offset)
+	{
+		for (std::map<GLuint, GLuint>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it)
+		{
+			GLuint begin   = it->first;
+			GLuint end	   = it->first + it->second;
+			GLuint aligned = (begin + alignment - 1) / alignment * alignment;
+			if (aligned + size > end)
+				continue;
+
+			freeRanges.erase(it);
+			if (aligned > begin)
+				freeRanges[begin] = aligned - begin;
+			if (aligned + size < end)
+				freeRanges[aligned + size] = end - aligned - size;
+
+			offset = aligned;
+			return true;
+		}
+		return false;
+	}
+
+	void Free(GLuint offset, GLuint size)
+	{
+		if (size == 0)
+			return;
+
+		std::map<GLuint, GLuint>::iterator it = freeRanges.insert(std::make_pair(offset, size)).first;
+
+		std::map<GLuint, GLuint>::iterator next = it;
+		++next;
+		if (next != freeRanges.end() && it->first + it->second == next->first)
+		{
+			it->second += next->second;
+			freeRanges.erase(next);
+		}
+
+		if (it != freeRanges.begin())
+		{
+			std::map<GLuint, GLuint>::iterator previous = it;
+			--previous;
+			if (previous->first + previous->second == it->first)
+			{
+				previous->second += it->second;
+				freeRanges.erase(it);
+			}
+		}
+	}
+
+	void Grow(GLuint newCapacity)
+	{
+		Free(capacity, newCapacity - capacity);
+		capacity = newCapacity;
+	}
+};
+
+// One vertex buffer, index buffer and VAO shared by every mesh of a vertex format.
+// Meshes own ranges of the buffers and draw with a base vertex and an index offset.
+// Full buffers are replaced by ones twice as large and the content is copied over.
+class GeometryArena
+{
+private:
+	VertexFormat format;
+	GLuint stride;
+	GLuint VAO;
+	GLuint VBO, EBO;
+	GLuint identityInstance;	// bound to the instance binding outside instanced draws
+	RangeAllocator vertexRanges;	// in vertices
+	RangeAllocator indexRanges;		// in bytes
+
+	GeometryArena(const GeometryArena&);
+	GeometryArena& operator=(const GeometryArena&);
+
+	GeometryArena(VertexFormat format)
+	{
+		this->format = format;
+		stride = format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+
+		glGenBuffers(1, &VBO);
+		GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+		glBufferData(GL_COPY_WRITE_BUFFER, ARENA_INITIAL_VERTICES * stride, NULL, GL_STATIC_DRAW);
+		vertexRanges.Grow(ARENA_INITIAL_VERTICES);
+
+		glGenBuffers(1, &EBO);
+		GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glBufferData(GL_COPY_WRITE_BUFFER, ARENA_INITIAL_INDEX_BYTES, NULL, GL_STATIC_DRAW);
+		indexRanges.Grow(ARENA_INITIAL_INDEX_BYTES);
+
+		InstanceData identity;
+		glGenBuffers(1, &identityInstance);
+		GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, identityInstance);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(InstanceData), &identity, GL_STATIC_DRAW);
+
+		glGenVertexArrays(1, &VAO);
+		GLState::Get().BindVertexArray(VAO);
+		AttributeFormats();
+		InstanceAttributeFormats();
+		GLState::Get().BindVertexBuffer(VERTEX_BINDING_VERTICES, VBO, 0, stride);
+		GLState::Get().BindVertexBuffer(VERTEX_BINDING_INSTANCES, identityInstance, 0, sizeof(InstanceData));
+		glVertexBindingDivisor(VERTEX_BINDING_INSTANCES, 1);
+		GLState::Get().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		GLState::Get().BindVertexArray(0);
+	}
+
+	void AttributeFormat(GLuint location, GLint size, GLenum type, GLboolean normalized, GLuint offset, GLuint binding = VERTEX_BINDING_VERTICES)
+	{
+		glVertexAttribFormat(location, size, type, normalized, offset);
+		glVertexAttribBinding(location, binding);
+		glEnableVertexAttribArray(location);
+	}
+
+	// Matrices take one location per column
+	void InstanceAttributeFormats()
+	{
+		for (GLuint i = 0; i < 4; ++i)
+			AttributeFormat(ATTRIBUTE_LOCATION::INSTANCE_MODEL + i, 4, GL_FLOAT, GL_FALSE, offsetof(InstanceData, model) + i * sizeof(glm::vec4), VERTEX_BINDING_INSTANCES);
+		for (GLuint i = 0; i < 3; ++i)
+			AttributeFormat(ATTRIBUTE_LOCATION::INSTANCE_NORMAL + i, 3, GL_FLOAT, GL_FALSE, offsetof(InstanceData, normal) + i * sizeof(glm::vec3), VERTEX_BINDING_INSTANCES);
+
+		glVertexAttribIFormat(ATTRIBUTE_LOCATION::INSTANCE_MATERIAL, 1, GL_UNSIGNED_INT, offsetof(InstanceData, material));
+		glVertexAttribBinding(ATTRIBUTE_LOCATION::INSTANCE_MATERIAL, VERTEX_BINDING_INSTANCES);
+		glEnableVertexAttribArray(ATTRIBUTE_LOCATION::INSTANCE_MATERIAL);
+	}
+
+	void AttributeFormats()
+	{
+		if (format == VERTEX_FORMAT_PACKED)
+		{
+			AttributeFormat(ATTRIBUTE_LOCATION::POSITION, POSITION_LENGTH, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(PackedVertex, position));
+			AttributeFormat(ATTRIBUTE_LOCATION::NORMAL, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, normal));
+			AttributeFormat(ATTRIBUTE_LOCATION::TEX_COORDS, TEX_COORDS_LENGTH, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, texCoords));
+			AttributeFormat(ATTRIBUTE_LOCATION::TANGENT, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, tangent));
+		}
+		else
+		{
+			AttributeFormat(ATTRIBUTE_LOCATION::POSITION, POSITION_LENGTH, GL_FLOAT, GL_FALSE, offsetof(Vertex, position));
+			AttributeFormat(ATTRIBUTE_LOCATION::NORMAL, NORMAL_LENGTH, GL_FLOAT, GL_FALSE, offsetof(Vertex, normal));
+			AttributeFormat(ATTRIBUTE_LOCATION::TEX_COORDS, TEX_COORDS_LENGTH, GL_FLOAT, GL_FALSE, offsetof(Vertex, texCoords));
+			AttributeFormat(ATTRIBUTE_LOCATION::TANGENT, TANGENG_LENGTH, GL_FLOAT, GL_FALSE, offsetof(Vertex, tangent));
+		}
+	}
+
+	// Returns a larger copy of buffer and deletes the original
+	static GLuint GrowBuffer(GLuint buffer, GLuint size, GLuint newSize)
+	{
+		GLuint grown;
+		glGenBuffers(1, &grown);
+		GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, grown);
+		glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+		GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+		GLState::Get().DeleteBuffer(buffer);
+		return grown;
+	}
+
+	static void Upload(GLuint buffer, GLuint offset, GLuint size, const void* data)
+	{
+		GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+	}
+
+public:
+	// Arenas are created with the first mesh of their format, so a context must be current
+	static GeometryArena& Get(VertexFormat format)
+	{
+		static GeometryArena floatArena(VERTEX_FORMAT_FLOAT);
+		if (format == VERTEX_FORMAT_FLOAT)
+			return floatArena;
+
+		static GeometryArena packedArena(VERTEX_FORMAT_PACKED);
+		return packedArena;
+	}
+
+	// Copies count vertices of the arena's format and returns the first vertex
+	GLuint AllocateVertices(const void* vertices, GLuint count)
+	{
+		GLuint first = 0;
+		if (count == 0)
+			return first;
+
+		if (!vertexRanges.Allocate(count, 1, first))
+		{
+			GLuint capacity = vertexRanges.GetCapacity();
+			GLuint newCapacity = std::max(capacity * 2, capacity + count);
+			VBO = GrowBuffer(VBO, capacity * stride, newCapacity * stride);
+			vertexRanges.Grow(newCapacity);
+			vertexRanges.Allocate(count, 1, first);
+
+			GLState::Get().BindVertexArray(VAO);
+			GLState::Get().BindVertexBuffer(VERTEX_BINDING_VERTICES, VBO, 0, stride);
+			GLState::Get().BindVertexArray(0);
+		}
+
+		Upload(VBO, first * stride, count * stride, vertices);
+		return first;
+	}
+
+	// Copies size bytes of indices and returns their byte offset
+	GLuint AllocateIndices(const void* indices, GLuint size)
+	{
+		GLuint offset = 0;
+		if (size == 0)
+			return offset;
+
+		if (!indexRanges.Allocate(size, ARENA_INDEX_ALIGNMENT, offset))
+		{
+			GLuint capacity = indexRanges.GetCapacity();
+			GLuint newCapacity = std::max(capacity * 2, capacity + size);
+			EBO = GrowBuffer(EBO, capacity, newCapacity);
+			indexRanges.Grow(newCapacity);
+			indexRanges.Allocate(size, ARENA_INDEX_ALIGNMENT, offset);
+
+			GLState::Get().BindVertexArray(VAO);
+			GLState::Get().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			GLState::Get().BindVertexArray(0);
+		}
+
+		Upload(EBO, offset, size, indices);
+		return offset;
+	}
+
+	void FreeVertices(GLuint first, GLuint count) { vertexRanges.Free(first, count); }
+	void FreeIndices(GLuint offset, GLuint size) { indexRanges.Free(offset, size); }
+
+	void Bind() { GLState::Get().BindVertexArray(VAO); }
+	// The vertex array stays bound until another arena binds its own
+	void Unbind() { }
+
+	// Sources the instance attributes of the bound arena from InstanceData records at offset in buffer
+	void BindInstances(GLuint buffer, GLuint offset) { GLState::Get().BindVertexBuffer(VERTEX_BINDING_INSTANCES, buffer, offset, sizeof(InstanceData)); }
+	void UnbindInstances() { GLState::Get().BindVertexBuffer(VERTEX_BINDING_INSTANCES, identityInstance, 0, sizeof(InstanceData)); }
+
+	GLuint GetVertexArray() const { return VAO; }
+	GLuint GetVertexBuffer() const { return VBO; }
+	GLuint GetIndexBuffer() const { return EBO; }
+};
+
+#endif
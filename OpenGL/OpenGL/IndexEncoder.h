@@ -0,0 +1,293 @@
+#ifndef INDEX_ENCODER_H
+#define INDEX_ENCODER_H
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include <GL/glew.h>
+
+enum IndexEncoding
+{
+	INDEX_ENCODING_LIST = 0,	// GL_TRIANGLES
+	INDEX_ENCODING_STRIPS		// GL_TRIANGLE_STRIP with primitive restart
+};
+
+typedef struct IndexRange
+{
+	GLuint firstIndex;
+	GLuint numIndices;
+
+	IndexRange() : firstIndex(0), numIndices(0) { }
+	IndexRange(GLuint firstIndex, GLuint numIndices) : firstIndex(firstIndex), numIndices(numIndices) { }
+} IndexRange;
+
+// Part of the index buffer whose indices are relative to baseVertex
+typedef struct IndexSegment
+{
+	GLuint firstIndex;
+	GLuint numIndices;
+	GLint baseVertex;
+} IndexSegment;
+
+// Consecutive units drawn together with one index type
+typedef struct IndexGroup
+{
+	GLenum type;			// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	GLuint restartIndex;	// largest value of the type
+	GLuint firstIndex;
+	GLuint byteOffset;		// of firstIndex in the buffer
+	GLuint firstSegment;
+	GLuint numSegments;
+
+	GLuint IndexSize() const { return type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint); }
+
+	const GLvoid* Offset(GLuint index) const
+	{
+		return (const GLvoid*)((size_t)byteOffset + (size_t)(index - firstIndex) * IndexSize());
+	}
+} IndexGroup;
+
+typedef struct EncodedIndices
+{
+	GLenum mode;
+	std::vector<GLubyte> data;
+	std::vector<IndexRange> units;		// the input units, in encoded indices
+	std::vector<GLint> baseVertices;	// per unit
+	std::vector<IndexSegment> segments;
+	std::vector<IndexGroup> groups;
+} EncodedIndices;
+
+// Strip separator before the indices are narrowed
+const GLuint STRIP_RESTART = 0xFFFFFFFF;
+
+// Encodes triangle lists into the smallest index type that can address them,
+// optionally as triangle strips separated by restart indices
+class IndexEncoder
+{
+private:
+	static GLint FindTriangle(const std::vector<std::pair<unsigned long long, GLuint> >& edges, const std::vector<bool>& used, GLuint from, GLuint to)
+	{
+		unsigned long long key = ((unsigned long long)from << 32) | to;
+		std::vector<std::pair<unsigned long long, GLuint> >::const_iterator it =
+			std::lower_bound(edges.begin(), edges.end(), std::make_pair(key, (GLuint)0));
+		for (; it != edges.end() && it->first == key; ++it)
+		{
+			if (!used[it->second])
+				return it->second;
+		}
+		return -1;
+	}
+
+	// Greedy strips in the original triangle order, which keeps the vertex cache
+	// order mostly intact; every strip ends with a restart index
+	static void Stripify(const GLuint* indices, GLuint count, std::vector<GLuint>& strips)
+	{
+		GLuint numTriangles = count / 3;
+
+		std::vector<std::pair<unsigned long long, GLuint> > edges;
+		edges.reserve(count);
+		for (GLuint t = 0; t < numTriangles; ++t)
+		{
+			for (GLuint k = 0; k < 3; ++k)
+				edges.push_back(std::make_pair(((unsigned long long)indices[3 * t + k] << 32) | indices[3 * t + (k + 1) % 3], t));
+		}
+		std::sort(edges.begin(), edges.end());
+
+		std::vector<bool> used(numTriangles, false);
+		std::vector<GLuint> strip;
+
+		for (GLuint t = 0; t < numTriangles; ++t)
+		{
+			const GLuint* triangle = &indices[3 * t];
+			if (used[t] || triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[0] == triangle[2])
+				continue;
+			used[t] = true;
+
+			// Start with the rotation that has a neighbour across its last edge
+			GLuint rotation = 0;
+			for (GLuint r = 0; r < 3; ++r)
+			{
+				if (FindTriangle(edges, used, triangle[(r + 2) % 3], triangle[(r + 1) % 3]) >= 0)
+				{
+					rotation = r;
+					break;
+				}
+			}
+
+			strip.clear();
+			for (GLuint k = 0; k < 3; ++k)
+				strip.push_back(triangle[(rotation + k) % 3]);
+
+			// Odd triangles of a strip are wound in reverse
+			while (true)
+			{
+				GLuint n = strip.size();
+				bool odd = (n - 2) % 2 == 1;
+				GLuint from = odd ? strip[n - 1] : strip[n - 2];
+				GLuint to	= odd ? strip[n - 2] : strip[n - 1];
+
+				GLint next = FindTriangle(edges, used, from, to);
+				if (next < 0)
+					break;
+				used[next] = true;
+
+				const GLuint* neighbour = &indices[3 * next];
+				for (GLuint k = 0; k < 3; ++k)
+				{
+					if (neighbour[k] == from && neighbour[(k + 1) % 3] == to)
+					{
+						strip.push_back(neighbour[(k + 2) % 3]);
+						break;
+					}
+				}
+			}
+
+			strips.insert(strips.end(), strip.begin(), strip.end());
+			strips.push_back(STRIP_RESTART);
+		}
+	}
+
+	// Gathers the units of a group into segments spanning at most maxSpan vertices;
+	// false when a single unit spans more
+	static bool BuildSegments(const GLuint* source, const std::vector<IndexRange>& units, GLuint firstUnit, GLuint endUnit, GLuint maxSpan,
+		std::vector<IndexSegment>& segments)
+	{
+		IndexSegment segment;
+		GLuint segmentMin = 0, segmentMax = 0;
+		bool open = false;
+
+		for (GLuint u = firstUnit; u < endUnit; ++u)
+		{
+			const IndexRange& unit = units[u];
+			GLuint unitMin = 0xFFFFFFFF, unitMax = 0;
+			for (GLuint i = unit.firstIndex; i < unit.firstIndex + unit.numIndices; ++i)
+			{
+				if (source[i] == STRIP_RESTART)
+					continue;
+				unitMin = std::min(unitMin, source[i]);
+				unitMax = std::max(unitMax, source[i]);
+			}
+			if (unitMin > unitMax)
+				unitMin = unitMax = open ? segmentMin : 0;
+
+			if (unitMax - unitMin > maxSpan)
+				return false;
+
+			if (open && std::max(segmentMax, unitMax) - std::min(segmentMin, unitMin) > maxSpan)
+			{
+				segments.push_back(segment);
+				open = false;
+			}
+
+			if (!open)
+			{
+				segment.firstIndex = unit.firstIndex;
+				segmentMin = unitMin;
+				segmentMax = unitMax;
+				open = true;
+			}
+
+			segmentMin = std::min(segmentMin, unitMin);
+			segmentMax = std::max(segmentMax, unitMax);
+			segment.numIndices = unit.firstIndex + unit.numIndices - segment.firstIndex;
+			segment.baseVertex = segmentMin;
+		}
+
+		if (open)
+			segments.push_back(segment);
+		return true;
+	}
+
+public:
+	// Units are the ranges drawn on their own (clusters, whole LODs) and never straddle
+	// a segment; group g holds units [groupUnits[g], groupUnits[g + 1]) and is drawn with
+	// one index type. A group is 16-bit when its units fit segments spanning at most 2^16
+	// vertices, drawn with a base vertex each, and 32-bit otherwise.
+	static void Encode(const GLuint* indices, const std::vector<IndexRange>& units, const std::vector<GLuint>& groupUnits,
+		IndexEncoding encoding, EncodedIndices& result)
+	{
+		result.mode = encoding == INDEX_ENCODING_STRIPS ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+		result.units.assign(units.begin(), units.end());
+		result.baseVertices.assign(units.size(), 0);
+		result.segments.clear();
+		result.groups.clear();
+		result.data.clear();
+
+		std::vector<GLuint> strips;
+		const GLuint* source = indices;
+		if (encoding == INDEX_ENCODING_STRIPS)
+		{
+			for (GLuint u = 0; u < units.size(); ++u)
+			{
+				result.units[u].firstIndex = strips.size();
+				Stripify(indices + units[u].firstIndex, units[u].numIndices, strips);
+				result.units[u].numIndices = strips.size() - result.units[u].firstIndex;
+			}
+			source = strips.empty() ? NULL : &strips[0];
+		}
+
+		// With strips the largest 16-bit value is the restart index
+		const GLuint maxSpan = encoding == INDEX_ENCODING_STRIPS ? 0xFFFE : 0xFFFF;
+
+		for (GLuint g = 0; g + 1 < groupUnits.size(); ++g)
+		{
+			GLuint firstUnit = groupUnits[g], endUnit = groupUnits[g + 1];
+
+			IndexGroup group;
+			group.firstIndex   = firstUnit < endUnit ? result.units[firstUnit].firstIndex : 0;
+			group.firstSegment = result.segments.size();
+			GLuint numIndices  = firstUnit < endUnit ? result.units[endUnit - 1].firstIndex + result.units[endUnit - 1].numIndices - group.firstIndex : 0;
+
+			if (BuildSegments(source, result.units, firstUnit, endUnit, maxSpan, result.segments))
+			{
+				group.type		   = GL_UNSIGNED_SHORT;
+				group.restartIndex = 0xFFFF;
+			}
+			else
+			{
+				result.segments.resize(group.firstSegment);
+				IndexSegment segment;
+				segment.firstIndex = group.firstIndex;
+				segment.numIndices = numIndices;
+				segment.baseVertex = 0;
+				result.segments.push_back(segment);
+
+				group.type		   = GL_UNSIGNED_INT;
+				group.restartIndex = 0xFFFFFFFF;
+				while (result.data.size() % sizeof(GLuint) != 0)
+					result.data.push_back(0);
+			}
+			group.numSegments = result.segments.size() - group.firstSegment;
+			group.byteOffset  = result.data.size();
+			result.data.resize(result.data.size() + numIndices * group.IndexSize());
+
+			for (GLuint s = group.firstSegment; s < group.firstSegment + group.numSegments; ++s)
+			{
+				const IndexSegment& segment = result.segments[s];
+				if (segment.numIndices == 0)
+					continue;
+
+				GLubyte* data = &result.data[0] + (size_t)group.Offset(segment.firstIndex);
+				for (GLuint i = 0; i < segment.numIndices; ++i)
+				{
+					GLuint index = source[segment.firstIndex + i];
+					if (group.type == GL_UNSIGNED_SHORT)
+						((GLushort*)data)[i] = index == STRIP_RESTART ? (GLushort)0xFFFF : (GLushort)(index - segment.baseVertex);
+					else
+						((GLuint*)data)[i] = index;
+				}
+
+				for (GLuint u = firstUnit; u < endUnit; ++u)
+				{
+					if (result.units[u].firstIndex >= segment.firstIndex && result.units[u].firstIndex < segment.firstIndex + segment.numIndices)
+						result.baseVertices[u] = segment.baseVertex;
+				}
+			}
+
+			result.groups.push_back(group);
+		}
+	}
+};
+
+#endif
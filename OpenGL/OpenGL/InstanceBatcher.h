@@ -0,0 +1,84 @@
+#ifndef INSTANCE_BATCHER_H
+#define INSTANCE_BATCHER_H
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "UniformRing.h"
+
+// Instances of one mesh LOD sharing a material
+typedef struct InstanceBatch
+{
+	Mesh* mesh;
+	Material* material;
+	GLuint lod;
+	std::vector<InstanceData> instances;
+} InstanceBatch;
+
+// Collects submissions during a pass and draws every mesh, material and LOD
+// combination with one instanced call. Instance data is streamed through the
+// frame's ring region, so flushed batches never wait on the GPU.
+// Instanced draws skip cluster culling; the LOD is chosen per submission.
+class InstanceBatcher
+{
+private:
+	std::vector<InstanceBatch> batches;
+	GLuint numBatches;	// batches in use; the rest keep their storage for the next pass
+
+	GLuint drawCalls;
+	GLuint drawnInstances;
+
+public:
+	InstanceBatcher() : numBatches(0), drawCalls(0), drawnInstances(0) { }
+
+	void Submit(Mesh& mesh, Material& material, GLuint lod, const glm::mat4& model, GLuint materialIndex = 0)
+	{
+		GLuint b = 0;
+		while (b < numBatches && (batches[b].mesh != &mesh || batches[b].material != &material || batches[b].lod != lod))
+			b++;
+
+		if (b == numBatches)
+		{
+			if (numBatches == batches.size())
+				batches.push_back(InstanceBatch());
+			batches[b].mesh		= &mesh;
+			batches[b].material = &material;
+			batches[b].lod		= lod;
+			batches[b].instances.clear();
+			numBatches++;
+		}
+
+		batches[b].instances.push_back(InstanceData(model, materialIndex));
+	}
+
+	// Draws and clears the batches with shader, which must be in use; textures stay the caller's
+	void Flush(UniformRing& ring, const Shader& shader)
+	{
+		Material* material = NULL;
+		for (GLuint b = 0; b < numBatches; ++b)
+		{
+			InstanceBatch& batch = batches[b];
+			if (batch.material != material)
+			{
+				material = batch.material;
+				material->Use(shader);
+			}
+
+			GLuint offset = ring.Write(&batch.instances[0], batch.instances.size() * sizeof(InstanceData));
+			batch.mesh->DrawElementsInstanced(batch.lod, ring.GetBuffer(), offset, batch.instances.size());
+			drawCalls++;
+			drawnInstances += batch.instances.size();
+		}
+		numBatches = 0;
+	}
+
+	void ResetStatistics() { drawCalls = drawnInstances = 0; }
+	GLuint GetDrawCalls() const { return drawCalls; }
+	GLuint GetDrawnInstances() const { return drawnInstances; }
+};
+
+#endif
@@ -1,15 +1,100 @@
 #ifndef LIGHT_H
 #define LIGHT_H
 
+#include <cmath>
+#include <algorithm>
+
 #include <GL/glew.h>
 #include <glm/glm.hpp>
-#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// Attenuated light below this is cut off; sets the range lights are binned with
+const GLfloat LIGHT_CUTOFF_INTENSITY = 1.0f / 256.0f;
+// Range of lights whose attenuation never reaches the cutoff
+const GLfloat LIGHT_MAX_RANGE = 1000.0f;
+// Near plane of the shadow maps of spot lights; pushing it out spreads depth precision
+const GLfloat LIGHT_SHADOW_NEAR = 1.0f;
+// Widest cone, in degrees, a spot light's shadow map covers
+const GLfloat LIGHT_SHADOW_MAX_CUTOFF = 80.0f;
+
+// std140 mirrors of the light structs of the Lights block; vec3 members take 16 bytes
+typedef struct LightUniforms
+{
+	glm::vec4 ambient;
+	glm::vec4 diffuse;
+	glm::vec4 specular;
+	glm::vec4 position;
+} LightUniforms;
+
+typedef struct DirectionalLightUniforms
+{
+	LightUniforms light;
+} DirectionalLightUniforms;
+
+typedef struct PointLightUniforms
+{
+	LightUniforms light;
+	GLfloat constant;
+	GLfloat linear;
+	GLfloat quadratic;
+	GLint shadowIndex;	// cube of the point shadow array, -1 for none
+	GLfloat shadowNear;
+	GLfloat shadowFar;
+	GLfloat shadowBias;
+	GLfloat padding;
+} PointLightUniforms;
+
+typedef struct SpotLightUniforms
+{
+	LightUniforms light;
+	glm::vec3 direction;
+	GLfloat cutOff;
+	GLfloat outerCutOff;
+	GLfloat constant;
+	GLfloat linear;
+	GLfloat quadratic;
+	glm::mat4 shadowMatrix;	// world to shadow atlas coordinates and depth
+	GLint shadowed;
+	GLfloat shadowBias;
+	GLint padding[2];
+} SpotLightUniforms;
+
+// World space sphere outside of which a light adds nothing
+typedef struct LightBounds
+{
+	glm::vec3 center;
+	GLfloat radius;
+} LightBounds;
+
+// Reflections in the floor see the lights mirrored in the y = 0 plane
+inline glm::vec3 MirrorY(const glm::vec3& v, bool mirrored)
+{
+	return mirrored ? glm::vec3(v.x, -v.y, v.z) : v;
+}
+
+inline void WriteLight(LightUniforms& uniforms, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular,
+	const glm::vec3& position, bool mirrored)
+{
+	uniforms.ambient  = glm::vec4(ambient, 0.0f);
+	uniforms.diffuse  = glm::vec4(diffuse, 0.0f);
+	uniforms.specular = glm::vec4(specular, 0.0f);
+	uniforms.position = glm::vec4(MirrorY(position, mirrored), 0.0f);
+}
 
-template <typename T>
-std::string Str(const T & t) {
-	std::ostringstream os;
-	os << t;
-	return os.str();
+// Distance past which constant + linear * d + quadratic * d^2 attenuates the
+// brightest channel of the light below LIGHT_CUTOFF_INTENSITY
+inline GLfloat AttenuationRange(const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular,
+	GLfloat constant, GLfloat linear, GLfloat quadratic)
+{
+	glm::vec3 brightest = glm::max(ambient, glm::max(diffuse, specular));
+	GLfloat c = constant - std::max(brightest.x, std::max(brightest.y, brightest.z)) / LIGHT_CUTOFF_INTENSITY;
+	if (c >= 0.0f)
+		return 0.0f;
+	if (quadratic > 0.0f)
+		return std::min((-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic), LIGHT_MAX_RANGE);
+	if (linear > 0.0f)
+		return std::min(-c / linear, LIGHT_MAX_RANGE);
+	return LIGHT_MAX_RANGE;
 }
 
 class DirectionalLight
@@ -20,8 +105,6 @@ private:
 	glm::vec3 specular;
 	glm::vec3 position;
 
-	GLuint uAmbient, uDiffuse, uSpecular, uPosition;
-
 public:
 	glm::vec3 GetPosition() { return position; }
 
@@ -34,11 +117,6 @@ public:
 		diffuse   = light.diffuse;
 		specular  = light.specular;
 		position  = light.position;
-
-		uAmbient  = light.uAmbient;
-		uDiffuse  = light.uDiffuse;
-		uSpecular = light.uSpecular;
-		uPosition = light.uPosition;
 		return *this;
 	}
 
@@ -51,25 +129,9 @@ public:
 		this->position = position;
 	}
 
-	void SetUniforms(const GLuint& program)
-	{
-		uAmbient  = glGetUniformLocation(program, "directionalLight.light.ambient");
-		uDiffuse  = glGetUniformLocation(program, "directionalLight.light.diffuse");
-		uSpecular = glGetUniformLocation(program, "directionalLight.light.specular");
-		uPosition = glGetUniformLocation(program, "directionalLight.light.position");
-	}
-
-	void Use()
+	void Write(DirectionalLightUniforms& uniforms, bool mirrored) const
 	{
-		glUniform3fv(uAmbient, 1, glm::value_ptr(ambient));
-		glUniform3fv(uDiffuse, 1, glm::value_ptr(diffuse));
-		glUniform3fv(uSpecular, 1, glm::value_ptr(specular));
-		glUniform3fv(uPosition, 1, glm::value_ptr(position));
-	}
-
-	void InvertY()
-	{
-		this->position.y = (-1) * this->position.y;
+		WriteLight(uniforms.light, ambient, diffuse, specular, position, mirrored);
 	}
 
 	void Move(GLfloat dx, GLfloat dz)
@@ -91,11 +153,10 @@ private:
 	float constant;
 	float linear;
 	float quadratic;
-
-	GLuint uAmbient, uDiffuse, uSpecular, uPosition, uConstant, uLinear, uQuadratic;
+	bool castsShadows;
 	
 public:
-	PointLight() { }
+	PointLight() : castsShadows(false) { }
 
 	PointLight& operator=(const PointLight& light)
 	{
@@ -106,14 +167,7 @@ public:
 		constant  = light.constant;
 		linear    = light.linear;
 		quadratic = light.quadratic;
-
-		uAmbient   = light.uAmbient;
-		uDiffuse   = light.uDiffuse;
-		uSpecular  = light.uSpecular;
-		uPosition  = light.uPosition;
-		uConstant  = light.uConstant;
-		uLinear    = light.uLinear;
-		uQuadratic = light.uQuadratic;
+		castsShadows = light.castsShadows;
 		return *this;
 	}
 
@@ -127,35 +181,45 @@ public:
 		this->constant  = constant;
 		this->linear    = linear;
 		this->quadratic = quadratic;
+		this->castsShadows = false;
 	}
 
-	void SetUniforms(const GLuint& program, int light)
+	// Leaves the shadow off, like SpotLight::Write
+	void Write(PointLightUniforms& uniforms, bool mirrored) const
 	{
-		uAmbient   = glGetUniformLocation(program, ("pointLight[" + Str(light) + "].light.ambient").c_str());
-		uDiffuse   = glGetUniformLocation(program, ("pointLight[" + Str(light) + "].light.diffuse").c_str());
-		uSpecular  = glGetUniformLocation(program, ("pointLight[" + Str(light) + "].light.specular").c_str());
-		uPosition  = glGetUniformLocation(program, ("pointLight[" + Str(light) + "].light.position").c_str());
-		uConstant  = glGetUniformLocation(program, ("pointLight[" + Str(light) + "].constant").c_str());
-		uLinear	   = glGetUniformLocation(program, ("pointLight[" + Str(light) + "].linear").c_str());
-		uQuadratic = glGetUniformLocation(program, ("pointLight[" + Str(light) + "].quadratic").c_str());
+		WriteLight(uniforms.light, ambient, diffuse, specular, position, mirrored);
+		uniforms.constant	 = constant;
+		uniforms.linear		 = linear;
+		uniforms.quadratic	 = quadratic;
+		uniforms.shadowIndex = -1;
+		uniforms.shadowNear	 = 0.0f;
+		uniforms.shadowFar	 = 0.0f;
+		uniforms.shadowBias	 = 0.0f;
 	}
 
-	void Use()
+	LightBounds GetBounds(bool mirrored) const
 	{
-		glUniform3fv(uAmbient, 1, glm::value_ptr(ambient));
-		glUniform3fv(uDiffuse, 1, glm::value_ptr(diffuse));
-		glUniform3fv(uSpecular, 1, glm::value_ptr(specular));
-		glUniform3fv(uPosition, 1, glm::value_ptr(position));
-		glUniform1f(uConstant, constant);
-		glUniform1f(uLinear, linear);
-		glUniform1f(uQuadratic, quadratic);
+		LightBounds bounds;
+		bounds.center = MirrorY(position, mirrored);
+		bounds.radius = AttenuationRange(ambient, diffuse, specular, constant, linear, quadratic);
+		return bounds;
 	}
 
-	void InvertY()
+	// How much of the view the light can shade: its brightest channel times the
+	// angle its range subtends from the eye, capped once the eye is inside it
+	GLfloat GetImportance(const glm::vec3& eye) const
 	{
-		this->position.y = (-1) * this->position.y;
+		glm::vec3 brightest = glm::max(ambient, glm::max(diffuse, specular));
+		GLfloat range = AttenuationRange(ambient, diffuse, specular, constant, linear, quadratic);
+		return std::max(brightest.x, std::max(brightest.y, brightest.z)) * range / std::max(glm::length(position - eye), std::max(range, 1.0f));
 	}
 
+	void SetCastsShadows(bool castsShadows) { this->castsShadows = castsShadows; }
+	bool CastsShadows() const { return castsShadows; }
+
+	glm::vec3 GetPosition() const { return position; }
+	void SetPosition(const glm::vec3& position) { this->position = position; }
+
 	~PointLight() { }
 };
 
@@ -168,13 +232,15 @@ private:
 
 	glm::vec3 position;
 	glm::vec3 direction;
-	float cutOff;
+	float cutOff;		// in degrees
 	float outerCutOff;
-
-	GLuint uAmbient, uDiffuse, uSpecular, uPosition, uDirection, uCutOff, uOuterCutOff;
+	float constant;
+	float linear;
+	float quadratic;
+	GLuint shadowResolution;	// of its shadow atlas tile, 0 for none
 
 public:
-	SpotLight() { }
+	SpotLight() : shadowResolution(0) { }
 
 	SpotLight& operator=(const SpotLight& light)
 	{
@@ -185,19 +251,16 @@ public:
 		direction	= light.direction;
 		cutOff		= light.cutOff;
 		outerCutOff = light.outerCutOff;
-
-		uAmbient	 = light.uAmbient;
-		uDiffuse	 = light.uDiffuse;
-		uSpecular	 = light.uSpecular;
-		uPosition	 = light.uPosition;
-		uDirection	 = light.uDirection;
-		uCutOff		 = light.uCutOff;
-		uOuterCutOff = light.uOuterCutOff;
+		constant	= light.constant;
+		linear		= light.linear;
+		quadratic	= light.quadratic;
+		shadowResolution = light.shadowResolution;
 		return *this;
 	}
 
 	SpotLight(const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular,
-		const glm::vec3& position, const glm::vec3& direction, float cutOff, float outerCutOff)
+		const glm::vec3& position, const glm::vec3& direction, float cutOff, float outerCutOff,
+		float constant = 1.0f, float linear = 0.07f, float quadratic = 0.017f)
 	{
 		this->ambient	  = ambient;
 		this->diffuse	  = diffuse;
@@ -206,30 +269,70 @@ public:
 		this->direction	  = direction;
 		this->cutOff	  = cutOff;
 		this->outerCutOff = outerCutOff;
+		this->constant	  = constant;
+		this->linear	  = linear;
+		this->quadratic	  = quadratic;
+		this->shadowResolution = 0;
 	}
 
-	void SetUniforms(const GLuint& program)
+	// Leaves the shadow off; the renderer fills it in for the lights it has a tile for
+	void Write(SpotLightUniforms& uniforms, bool mirrored) const
 	{
-		uAmbient	 = glGetUniformLocation(program, "spotLight.light.ambient");
-		uDiffuse	 = glGetUniformLocation(program, "spotLight.light.diffuse");
-		uSpecular	 = glGetUniformLocation(program, "spotLight.light.specular");
-		uPosition    = glGetUniformLocation(program, "spotLight.light.position");
-		uDirection   = glGetUniformLocation(program, "spotLight.direction");
-		uCutOff		 = glGetUniformLocation(program, "spotLight.cutOff");
-		uOuterCutOff = glGetUniformLocation(program, "spotLight.outerCutOff");
+		WriteLight(uniforms.light, ambient, diffuse, specular, position, mirrored);
+		uniforms.direction	 = MirrorY(direction, mirrored);
+		uniforms.cutOff		 = glm::cos(glm::radians(cutOff));
+		uniforms.outerCutOff = glm::cos(glm::radians(outerCutOff));
+		uniforms.constant	 = constant;
+		uniforms.linear		 = linear;
+		uniforms.quadratic	 = quadratic;
+		uniforms.shadowMatrix = glm::mat4(1.0f);
+		uniforms.shadowed	  = 0;
+		uniforms.shadowBias	  = 0.0f;
 	}
-	
-	void Use()
+
+	// Bounding sphere of the cone the outer cut off spans up to the attenuation range
+	LightBounds GetBounds(bool mirrored) const
 	{
-		glUniform3fv(uAmbient, 1, glm::value_ptr(ambient));
-		glUniform3fv(uDiffuse, 1, glm::value_ptr(diffuse));
-		glUniform3fv(uSpecular, 1, glm::value_ptr(specular));
-		glUniform3fv(uPosition, 1, glm::value_ptr(position));
-		glUniform3fv(uDirection, 1, glm::value_ptr(direction));
-		glUniform1f(uCutOff, glm::cos(glm::radians(cutOff)));
-		glUniform1f(uOuterCutOff, glm::cos(glm::radians(outerCutOff)));
+		GLfloat range = AttenuationRange(ambient, diffuse, specular, constant, linear, quadratic);
+		GLfloat angle = glm::radians(outerCutOff);
+		glm::vec3 apex = MirrorY(position, mirrored);
+		glm::vec3 axis = glm::normalize(MirrorY(direction, mirrored));
+
+		LightBounds bounds;
+		if (angle >= glm::radians(90.0f))
+		{
+			bounds.center = apex;
+			bounds.radius = range;
+		}
+		else if (angle > glm::radians(45.0f))
+		{
+			// The sphere around the base also holds the apex
+			bounds.center = apex + axis * (range * std::cos(angle));
+			bounds.radius = range * std::sin(angle);
+		}
+		else
+		{
+			// Narrow cones: the sphere through the apex and the rim of the base
+			bounds.radius = range / (2.0f * std::cos(angle));
+			bounds.center = apex + axis * bounds.radius;
+		}
+		return bounds;
 	}
 
+	// Perspective view of the cone up to the attenuation range
+	void GetShadowMatrices(glm::mat4& projection, glm::mat4& view) const
+	{
+		GLfloat range = AttenuationRange(ambient, diffuse, specular, constant, linear, quadratic);
+		glm::vec3 axis = glm::normalize(direction);
+		glm::vec3 up = std::abs(axis.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		projection = glm::perspective(2.0f * glm::radians(std::min(outerCutOff, LIGHT_SHADOW_MAX_CUTOFF)), 1.0f,
+			LIGHT_SHADOW_NEAR, std::max(range, 2.0f * LIGHT_SHADOW_NEAR));
+		view = glm::lookAt(position, position + axis, up);
+	}
+
+	void SetShadowResolution(GLuint resolution) { shadowResolution = resolution; }
+	GLuint GetShadowResolution() const { return shadowResolution; }
+
 	void SetPosition(const glm::vec3& position) { this->position = position; }
 
 	void SetDirection(const glm::vec3& direction) { this->direction = direction; }
@@ -0,0 +1,338 @@
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <xmmintrin.h>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Light.h"
+
+// Clusters of the view frustum: screen tiles times depth slices, logarithmic for
+// perspective views and linear for orthographic ones. Must match the lit shaders.
+const GLuint LIGHT_GRID_X = 16;
+const GLuint LIGHT_GRID_Y = 9;
+const GLuint LIGHT_GRID_Z = 24;
+const GLuint LIGHT_GRID_CLUSTERS = LIGHT_GRID_X * LIGHT_GRID_Y * LIGHT_GRID_Z;
+
+// Lights of each kind a cluster keeps, which bounds the cost of a pixel
+const GLuint LIGHT_GRID_MAX_CLUSTER_LIGHTS = 64;
+// Fewer lights per worker than this are binned on the calling thread
+const GLuint LIGHT_GRID_LIGHTS_PER_THREAD = 128;
+
+// std430 element of the LightClusters buffer. The cluster's point light indices
+// start at offset in the LightIndices buffer and its spot light indices follow.
+typedef struct LightCluster
+{
+	GLuint offset;
+	GLuint pointCount;
+	GLuint spotCount;
+} LightCluster;
+
+// View space spheres of the lights touching one slice, as a structure of arrays
+// padded to a multiple of 4 for the SIMD test
+typedef struct LightCandidates
+{
+	std::vector<GLfloat> x, y, z, radius;
+	std::vector<GLuint> lights;
+
+	void Clear()
+	{
+		x.clear();
+		y.clear();
+		z.clear();
+		radius.clear();
+		lights.clear();
+	}
+
+	void Add(const glm::vec4& sphere, GLuint light)
+	{
+		x.push_back(sphere.x);
+		y.push_back(sphere.y);
+		z.push_back(sphere.z);
+		radius.push_back(sphere.w);
+		lights.push_back(light);
+	}
+
+	void Pad()
+	{
+		GLuint size = (lights.size() + 3) & ~3;
+		x.resize(size, 0.0f);
+		y.resize(size, 0.0f);
+		z.resize(size, 0.0f);
+		radius.resize(size, 0.0f);
+	}
+} LightCandidates;
+
+// Slices of the grid one thread bins, with the clusters and indices it produced
+typedef struct LightGridWorker
+{
+	GLuint firstSlice;
+	GLuint endSlice;
+	LightCandidates points;
+	LightCandidates spots;
+	std::vector<LightCluster> clusters;	// offsets into indices
+	std::vector<GLuint> indices;
+} LightGridWorker;
+
+// Bins point and spot lights into the clusters of a view on the CPU. Every slice
+// gathers the lights whose depth range reaches it, then tests their spheres against
+// the bounds of each of its clusters four at a time; workers own disjoint slices, so
+// each writes its clusters' compact index lists without sharing anything.
+class LightGrid
+{
+private:
+	glm::mat4 projection;
+	bool logarithmic;
+	GLfloat nearPlane;
+	GLfloat farPlane;
+	GLfloat sliceScale;
+	GLfloat sliceBias;
+
+	// View space bounds of every cluster, rebuilt when the projection changes
+	std::vector<glm::vec3> boundsMin;
+	std::vector<glm::vec3> boundsMax;
+
+	// View space spheres and the slices they reach; spot lights follow the point lights
+	std::vector<glm::vec4> spheres;
+	std::vector<GLint> firstSlices;
+	std::vector<GLint> lastSlices;
+	GLuint numPointLights;
+
+	std::vector<LightGridWorker> workers;
+	std::vector<LightCluster> clusters;
+	std::vector<GLuint> indices;
+
+	GLfloat SliceDepth(GLuint slice) const
+	{
+		GLfloat t = (GLfloat)slice / LIGHT_GRID_Z;
+		return logarithmic ? nearPlane * std::pow(farPlane / nearPlane, t) : nearPlane + (farPlane - nearPlane) * t;
+	}
+
+	// depth is the distance in front of the viewer
+	GLint Slice(GLfloat depth) const
+	{
+		if (depth <= nearPlane)
+			return 0;
+		GLint slice = (GLint)std::floor((logarithmic ? std::log(depth) : depth) * sliceScale + sliceBias);
+		return std::min(std::max(slice, 0), (GLint)LIGHT_GRID_Z - 1);
+	}
+
+	// Bit i is set when sphere first + i touches the box
+	static int TouchesBox(const LightCandidates& candidates, GLuint first, const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		__m128 zero = _mm_setzero_ps();
+		__m128 x = _mm_loadu_ps(&candidates.x[first]);
+		__m128 y = _mm_loadu_ps(&candidates.y[first]);
+		__m128 z = _mm_loadu_ps(&candidates.z[first]);
+		__m128 radius = _mm_loadu_ps(&candidates.radius[first]);
+
+		__m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(boxMin.x), x), zero), _mm_max_ps(_mm_sub_ps(x, _mm_set1_ps(boxMax.x)), zero));
+		__m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(boxMin.y), y), zero), _mm_max_ps(_mm_sub_ps(y, _mm_set1_ps(boxMax.y)), zero));
+		__m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(boxMin.z), z), zero), _mm_max_ps(_mm_sub_ps(z, _mm_set1_ps(boxMax.z)), zero));
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		return _mm_movemask_ps(_mm_cmple_ps(distance, _mm_mul_ps(radius, radius)));
+	}
+
+	// Appends the candidates touching the box, at most LIGHT_GRID_MAX_CLUSTER_LIGHTS
+	static GLuint Bin(const LightCandidates& candidates, const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<GLuint>& indices)
+	{
+		GLuint count = 0;
+		GLuint numCandidates = candidates.lights.size();
+		for (GLuint first = 0; first < numCandidates && count < LIGHT_GRID_MAX_CLUSTER_LIGHTS; first += 4)
+		{
+			int mask = TouchesBox(candidates, first, boxMin, boxMax);
+			if (numCandidates - first < 4)
+				mask &= (1 << (numCandidates - first)) - 1;
+			for (GLuint i = 0; mask && count < LIGHT_GRID_MAX_CLUSTER_LIGHTS; ++i, mask >>= 1)
+			{
+				if (mask & 1)
+				{
+					indices.push_back(candidates.lights[first + i]);
+					count++;
+				}
+			}
+		}
+		return count;
+	}
+
+	void BinSlices(LightGridWorker* worker)
+	{
+		worker->clusters.clear();
+		worker->indices.clear();
+		for (GLuint slice = worker->firstSlice; slice < worker->endSlice; ++slice)
+		{
+			worker->points.Clear();
+			worker->spots.Clear();
+			for (GLuint i = 0; i < spheres.size(); ++i)
+			{
+				if (firstSlices[i] <= (GLint)slice && (GLint)slice <= lastSlices[i])
+				{
+					if (i < numPointLights)
+						worker->points.Add(spheres[i], i);
+					else
+						worker->spots.Add(spheres[i], i - numPointLights);
+				}
+			}
+			worker->points.Pad();
+			worker->spots.Pad();
+
+			GLuint first = slice * LIGHT_GRID_X * LIGHT_GRID_Y;
+			for (GLuint c = first; c < first + LIGHT_GRID_X * LIGHT_GRID_Y; ++c)
+			{
+				LightCluster cluster;
+				cluster.offset	   = worker->indices.size();
+				cluster.pointCount = Bin(worker->points, boundsMin[c], boundsMax[c], worker->indices);
+				cluster.spotCount  = Bin(worker->spots, boundsMin[c], boundsMax[c], worker->indices);
+				worker->clusters.push_back(cluster);
+			}
+		}
+	}
+
+public:
+	LightGrid() : logarithmic(true), nearPlane(0.1f), farPlane(1000.0f), sliceScale(0.0f), sliceBias(0.0f), numPointLights(0),
+		clusters(LIGHT_GRID_CLUSTERS)
+	{
+		projection[3][3] = 0.0f;	// differs from any projection, so the first one builds the bounds
+	}
+
+	// Rebuilds the cluster bounds when projection differs from the last one
+	void SetProjection(const glm::mat4& projection)
+	{
+		if (projection == this->projection)
+			return;
+		this->projection = projection;
+
+		logarithmic = projection[3][3] != 1.0f;
+		if (logarithmic)
+		{
+			nearPlane  = projection[3][2] / (projection[2][2] - 1.0f);
+			farPlane   = projection[3][2] / (projection[2][2] + 1.0f);
+			sliceScale = LIGHT_GRID_Z / std::log(farPlane / nearPlane);
+			sliceBias  = -std::log(nearPlane) * sliceScale;
+		}
+		else
+		{
+			nearPlane  = (projection[3][2] + 1.0f) / projection[2][2];
+			farPlane   = (projection[3][2] - 1.0f) / projection[2][2];
+			sliceScale = LIGHT_GRID_Z / (farPlane - nearPlane);
+			sliceBias  = -nearPlane * sliceScale;
+		}
+
+		// View space rays through the tile corners, from the near to the far plane
+		glm::mat4 inverse = glm::inverse(projection);
+		std::vector<glm::vec3> nearCorners, farCorners;
+		for (GLuint y = 0; y <= LIGHT_GRID_Y; ++y)
+		{
+			for (GLuint x = 0; x <= LIGHT_GRID_X; ++x)
+			{
+				glm::vec2 ndc(2.0f * x / LIGHT_GRID_X - 1.0f, 2.0f * y / LIGHT_GRID_Y - 1.0f);
+				glm::vec4 nearCorner = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+				glm::vec4 farCorner	 = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+				nearCorners.push_back(glm::vec3(nearCorner) / nearCorner.w);
+				farCorners.push_back(glm::vec3(farCorner) / farCorner.w);
+			}
+		}
+
+		boundsMin.resize(LIGHT_GRID_CLUSTERS);
+		boundsMax.resize(LIGHT_GRID_CLUSTERS);
+		for (GLuint z = 0; z < LIGHT_GRID_Z; ++z)
+		{
+			GLfloat depths[2] = { SliceDepth(z), SliceDepth(z + 1) };
+			for (GLuint y = 0; y < LIGHT_GRID_Y; ++y)
+			{
+				for (GLuint x = 0; x < LIGHT_GRID_X; ++x)
+				{
+					GLuint c = x + LIGHT_GRID_X * (y + LIGHT_GRID_Y * z);
+					boundsMin[c] = glm::vec3(1e30f);
+					boundsMax[c] = glm::vec3(-1e30f);
+					for (GLuint corner = 0; corner < 4; ++corner)
+					{
+						GLuint ray = (x + (corner & 1)) + (LIGHT_GRID_X + 1) * (y + (corner >> 1));
+						const glm::vec3& n = nearCorners[ray];
+						const glm::vec3& f = farCorners[ray];
+						for (GLuint d = 0; d < 2; ++d)
+						{
+							glm::vec3 p = n + (f - n) * ((depths[d] + n.z) / (n.z - f.z));
+							boundsMin[c] = glm::min(boundsMin[c], p);
+							boundsMax[c] = glm::max(boundsMax[c], p);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Bins the lights of pointBounds and spotBounds, in world space, for view;
+	// numThreads == 0 uses up to one worker per hardware thread
+	void Build(const glm::mat4& view, const std::vector<LightBounds>& pointBounds, const std::vector<LightBounds>& spotBounds,
+		GLuint numThreads = 0)
+	{
+		numPointLights = pointBounds.size();
+		spheres.clear();
+		firstSlices.clear();
+		lastSlices.clear();
+		for (GLuint i = 0; i < pointBounds.size() + spotBounds.size(); ++i)
+		{
+			const LightBounds& bounds = i < numPointLights ? pointBounds[i] : spotBounds[i - numPointLights];
+			glm::vec4 sphere(glm::vec3(view * glm::vec4(bounds.center, 1.0f)), bounds.radius);
+			GLfloat nearDepth = -sphere.z - sphere.w;
+			GLfloat farDepth  = -sphere.z + sphere.w;
+			bool visible = sphere.w > 0.0f && farDepth >= nearPlane && nearDepth <= farPlane;
+			spheres.push_back(sphere);
+			firstSlices.push_back(visible ? Slice(nearDepth) : 1);
+			lastSlices.push_back(visible ? Slice(farDepth) : 0);
+		}
+
+		if (numThreads == 0)
+			numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+		numThreads = std::min(numThreads, std::min((GLuint)spheres.size() / LIGHT_GRID_LIGHTS_PER_THREAD, LIGHT_GRID_Z));
+		numThreads = std::max(numThreads, 1u);
+
+		workers.resize(numThreads);
+		for (GLuint i = 0; i < numThreads; ++i)
+		{
+			workers[i].firstSlice = LIGHT_GRID_Z * i / numThreads;
+			workers[i].endSlice	  = LIGHT_GRID_Z * (i + 1) / numThreads;
+		}
+		if (numThreads == 1)
+			BinSlices(&workers[0]);
+		else
+		{
+			std::vector<std::thread> threads;
+			for (GLuint i = 0; i < numThreads; ++i)
+				threads.push_back(std::thread(&LightGrid::BinSlices, this, &workers[i]));
+			for (GLuint i = 0; i < numThreads; ++i)
+				threads[i].join();
+		}
+
+		// Workers hold consecutive slices; rebase their offsets into one index list
+		indices.clear();
+		GLuint c = 0;
+		for (GLuint i = 0; i < numThreads; ++i)
+		{
+			GLuint base = indices.size();
+			indices.insert(indices.end(), workers[i].indices.begin(), workers[i].indices.end());
+			for (GLuint j = 0; j < workers[i].clusters.size(); ++j, ++c)
+			{
+				clusters[c] = workers[i].clusters[j];
+				clusters[c].offset += base;
+			}
+		}
+		// A range of zero bytes cannot be bound
+		if (indices.empty())
+			indices.push_back(0);
+	}
+
+	// x and y map the view depth, logged for perspective views (z == 1), to the slice
+	glm::vec4 GetSliceParameters() const { return glm::vec4(sliceScale, sliceBias, logarithmic ? 1.0f : 0.0f, 0.0f); }
+
+	const std::vector<LightCluster>& GetClusters() const { return clusters; }
+	const std::vector<GLuint>& GetIndices() const { return indices; }
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// View of a whole file mapped into the address space, read-only unless opened
+// writable, in which case stores go back to the file. The bytes stay valid for the
+// lifetime of the object.
+class MappedFile
+{
+private:
+	const char* data;
+	size_t size;
+	bool writable;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data != NULL)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data != NULL)
+			munmap((void*)data, size);
+		if (file != -1)
+			close(file);
+		file = -1;
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+public:
+	MappedFile(const std::string& path, bool writable = false)
+		: data(NULL), size(0), writable(writable)
+	{
+#ifdef _WIN32
+		mapping = NULL;
+		if (writable)
+			file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		else
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize))
+		{
+			Close();
+			return;
+		}
+		size = (size_t)fileSize.QuadPart;
+		if (size == 0)
+			return;
+
+		mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+			data = (const char*)MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+		if (data == NULL)
+		{
+			std::cout << "ERROR::MAPPED_FILE:: Unable to map " << path << std::endl;
+			Close();
+		}
+#else
+		file = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+		if (file == -1)
+			return;
+
+		struct stat fileStat;
+		if (fstat(file, &fileStat) != 0)
+		{
+			Close();
+			return;
+		}
+		size = (size_t)fileStat.st_size;
+		if (size == 0)
+			return;
+
+		void* view = writable ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (view == MAP_FAILED)
+		{
+			std::cout << "ERROR::MAPPED_FILE:: Unable to map " << path << std::endl;
+			size = 0;
+			Close();
+			return;
+		}
+		data = (const char*)view;
+		madvise(view, size, writable ? MADV_RANDOM : MADV_SEQUENTIAL);
+#endif
+	}
+
+#ifdef _WIN32
+	bool IsOpen() const { return file != INVALID_HANDLE_VALUE; }
+#else
+	bool IsOpen() const { return file != -1; }
+#endif
+
+	const char* Begin() const { return data; }
+	char* WritableBegin() const { return writable ? (char*)data : NULL; }
+	const char* End() const { return data + size; }
+	size_t Size() const { return size; }
+
+	~MappedFile()
+	{
+		Close();
+	}
+};
+
+#endif
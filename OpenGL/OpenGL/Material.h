@@ -5,6 +5,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "Shader.h"
+
+const UniformId MATERIAL_AMBIENT   = UniformTable::Intern("material.ambient");
+const UniformId MATERIAL_DIFFUSE   = UniformTable::Intern("material.diffuse");
+const UniformId MATERIAL_SPECULAR  = UniformTable::Intern("material.specular");
+const UniformId MATERIAL_SHININESS = UniformTable::Intern("material.shininess");
+
 class Material
 {	
 private:
@@ -12,9 +19,10 @@ private:
 	glm::vec3 diffuse;
 	glm::vec3 specular;
 	GLfloat shininess;
+	GLenum cullFace;	// GL_NONE for two-sided surfaces
 
 public:
-	Material() { }
+	Material() : cullFace(GL_BACK) { }
 
 	Material& operator=(const Material& material)
 	{
@@ -22,25 +30,30 @@ public:
 		diffuse   = material.diffuse;
 		specular  = material.specular;
 		shininess = material.shininess;
+		cullFace  = material.cullFace;
 		return *this;
 	}
 
-	Material(const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular, GLfloat shininess)
+	Material(const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular, GLfloat shininess, GLenum cullFace = GL_BACK)
 	{
 		this->ambient = ambient;
 		this->diffuse = diffuse;
 		this->specular = specular;
 		this->shininess = shininess;
+		this->cullFace = cullFace;
 	}
 
-	void Use(const GLuint& program)
+	// Sets the material uniforms of shader, which must be in use
+	void Use(const Shader& shader)
 	{
-		glUniform3fv(glGetUniformLocation(program, "material.ambient"), 1, glm::value_ptr(ambient));
-		glUniform3fv(glGetUniformLocation(program, "material.diffuse"), 1, glm::value_ptr(diffuse));
-		glUniform3fv(glGetUniformLocation(program, "material.specular"), 1, glm::value_ptr(specular));
-		glUniform1f(glGetUniformLocation(program, "material.shininess"), shininess);
+		glUniform3fv(shader.GetUniformLocation(MATERIAL_AMBIENT), 1, glm::value_ptr(ambient));
+		glUniform3fv(shader.GetUniformLocation(MATERIAL_DIFFUSE), 1, glm::value_ptr(diffuse));
+		glUniform3fv(shader.GetUniformLocation(MATERIAL_SPECULAR), 1, glm::value_ptr(specular));
+		glUniform1f(shader.GetUniformLocation(MATERIAL_SHININESS), shininess);
 	}
 
+	GLenum GetCullFace() const { return cullFace; }
+
 	~Material() { }
 };
 
@@ -2,84 +2,147 @@
 #define MESH_H
 
 #include <vector>
+#include <algorithm>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
 
-const GLuint POSITION_LENGTH	= 3;
-const GLuint NORMAL_LENGTH		= 3;
-const GLuint TEX_COORDS_LENGTH	= 2;
-const GLuint TANGENG_LENGTH		= 3;
-const GLuint VERTEX_LENGTH		= POSITION_LENGTH + NORMAL_LENGTH + TEX_COORDS_LENGTH + TANGENG_LENGTH;
+#include "Vertex.h"
+#include "IndexEncoder.h"
+#include "GeometryArena.h"
 
-enum ATTRIBUTE_LOCATION
+// Range of the index buffer drawn for one level of detail
+typedef struct MeshLOD
 {
-	POSITION = 0,
-	NORMAL,	
-	TEX_COORDS,
-	TANGENT
-};
+	GLuint firstIndex;
+	GLuint numIndices;
+	GLfloat error;	// largest object space deviation from the full mesh
+	GLuint firstCluster;
+	GLuint numClusters;
 
-typedef struct Vertex
-{	
-	glm::vec3 position;
-	glm::vec3 normal;	
-	glm::vec2 texCoords;
-	glm::vec3 tangent;
+	MeshLOD() : firstIndex(0), numIndices(0), error(0.0f), firstCluster(0), numClusters(0) { }
+	MeshLOD(GLuint firstIndex, GLuint numIndices, GLfloat error) : firstIndex(firstIndex), numIndices(numIndices), error(error), firstCluster(0), numClusters(0) { }
+} MeshLOD;
 
-	Vertex()
-	{
-		position	= glm::vec3(0.0f);
-		normal		= glm::vec3(0.0f);
-		texCoords	= glm::vec2(0.0f);
-		tangent		= glm::vec3(0.0f);
-	}
+// Contiguous run of triangles culled as a unit, in object space
+typedef struct MeshCluster
+{
+	glm::vec3 center;
+	GLfloat radius;
+	glm::vec3 coneAxis;
+	GLfloat coneCutoff;	// sine of the normal cone's half angle, 1 when it can not be culled
+	GLuint firstIndex;
+	GLuint numIndices;
+} MeshCluster;
 
-	Vertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec2& texCoords, const glm::vec3& tangent)
-	{
-		this->position	= position;
-		this->normal	= normal;
-		this->texCoords = texCoords;
-		this->tangent	= tangent;
-	}
-} Vertex;
+// Per instance and view LOD selection, kept between frames for the hysteresis
+typedef struct LODState
+{
+	GLuint lod;
+
+	LODState() : lod(0) { }
+} LODState;
+
+// Coarser levels are chosen once their error drops this far below the threshold
+const GLfloat LOD_HYSTERESIS = 0.25f;
+
+// A mesh as it is uploaded: vertices in its format, indices encoded, LOD and cluster
+// ranges in encoded indices and base vertices relative to its first vertex. The vertex
+// and index bytes are only pointed to, e.g. into a mapped mesh cache.
+typedef struct MeshData
+{
+	VertexFormat format;
+	GLenum indexMode;
+	GLuint numVertices;
+	GLuint numIndices;	// of the triangle lists the encoding started from
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	const GLvoid* vertices;
+	const GLubyte* indices;
+	GLuint indexBytes;
+	std::vector<MeshLOD> lods;
+	std::vector<MeshCluster> clusters;
+	std::vector<GLint> clusterBaseVertices;
+	std::vector<IndexSegment> segments;
+	std::vector<IndexGroup> groups;	// one per LOD
+} MeshData;
 
 class Mesh
 {
 private:
-	GLuint VAO;
-	GLuint VBO, EBO;
 	GLuint numIndices;
 	GLuint numVertices;
-	
-	void AttributePointers()
-	{
-		glVertexAttribPointer(ATTRIBUTE_LOCATION::POSITION,
-			POSITION_LENGTH,
-			GL_FLOAT, GL_FALSE,
-			VERTEX_LENGTH * sizeof(GLfloat),
-			(const GLvoid*)offsetof(Vertex, position));
-		glEnableVertexAttribArray(ATTRIBUTE_LOCATION::POSITION);
-
-		glVertexAttribPointer(ATTRIBUTE_LOCATION::NORMAL,
-			NORMAL_LENGTH,
-			GL_FLOAT, GL_FALSE,
-			VERTEX_LENGTH * sizeof(GLfloat),
-			(const GLvoid*)offsetof(Vertex, normal));
-		glEnableVertexAttribArray(ATTRIBUTE_LOCATION::NORMAL);
-
-		glVertexAttribPointer(ATTRIBUTE_LOCATION::TEX_COORDS,
-			TEX_COORDS_LENGTH,
-			GL_FLOAT, GL_FALSE,
-			VERTEX_LENGTH * sizeof(GLfloat),
-			(const GLvoid*)offsetof(Vertex, texCoords));
-		glEnableVertexAttribArray(ATTRIBUTE_LOCATION::TEX_COORDS);
-
-		glVertexAttribPointer(ATTRIBUTE_LOCATION::TANGENT,
-			TANGENG_LENGTH,
-			GL_FLOAT, GL_FALSE,
-			VERTEX_LENGTH * sizeof(GLfloat),
-			(const GLvoid*)offsetof(Vertex, tangent));
-		glEnableVertexAttribArray(ATTRIBUTE_LOCATION::TANGENT);
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	std::vector<MeshLOD> lods;
+	std::vector<MeshCluster> clusters;
+	VertexFormat format;
+
+	GLenum indexMode;
+	std::vector<IndexSegment> segments;
+	std::vector<IndexGroup> lodIndexGroups;
+	std::vector<GLint> clusterBaseVertices;
+	std::vector<const GLvoid*> drawOffsets;
+
+	// Ranges owned in the arena of the vertex format
+	GLuint vertexOffset;
+	GLuint indexOffset;
+	GLuint indexBytes;
+
+	// Packed meshes set the decode uniforms of the current program and restore
+	// the identity afterwards, so float meshes drawn later are unaffected
+	void Bind()
+	{
+		GeometryArena::Get(format).Bind();
+		if (indexMode == GL_TRIANGLE_STRIP)
+			glEnable(GL_PRIMITIVE_RESTART);
+		if (format == VERTEX_FORMAT_PACKED)
+		{
+			glm::vec3 scale = boundsMax - boundsMin;
+			glUniform3f(VERTEX_DECODE_LOCATION::POSITION_SCALE, scale.x, scale.y, scale.z);
+			glUniform3f(VERTEX_DECODE_LOCATION::POSITION_OFFSET, boundsMin.x, boundsMin.y, boundsMin.z);
+			glUniform1i(VERTEX_DECODE_LOCATION::OCT_ENCODED, true);
+		}
+	}
+
+	void Unbind()
+	{
+		if (format == VERTEX_FORMAT_PACKED)
+		{
+			glUniform3f(VERTEX_DECODE_LOCATION::POSITION_SCALE, 1.0f, 1.0f, 1.0f);
+			glUniform3f(VERTEX_DECODE_LOCATION::POSITION_OFFSET, 0.0f, 0.0f, 0.0f);
+			glUniform1i(VERTEX_DECODE_LOCATION::OCT_ENCODED, false);
+		}
+		if (indexMode == GL_TRIANGLE_STRIP)
+			glDisable(GL_PRIMITIVE_RESTART);
+		GeometryArena::Get(format).Unbind();
+	}
+
+	// Base vertices and byte offsets become absolute in the arena buffers
+	void Upload(const MeshData& data)
+	{
+		format		= data.format;
+		numVertices = data.numVertices;
+		numIndices	= data.numIndices;
+		boundsMin	= data.boundsMin;
+		boundsMax	= data.boundsMax;
+		lods		= data.lods;
+		clusters	= data.clusters;
+		indexMode	= data.indexMode;
+		segments	= data.segments;
+		lodIndexGroups		= data.groups;
+		clusterBaseVertices = data.clusterBaseVertices;
+
+		GeometryArena& arena = GeometryArena::Get(format);
+		vertexOffset = arena.AllocateVertices(data.vertices, numVertices);
+		indexBytes	 = data.indexBytes;
+		indexOffset	 = arena.AllocateIndices(data.indices, indexBytes);
+		for (GLuint s = 0; s < segments.size(); ++s)
+			segments[s].baseVertex += vertexOffset;
+		for (GLuint c = 0; c < clusterBaseVertices.size(); ++c)
+			clusterBaseVertices[c] += vertexOffset;
+		for (GLuint g = 0; g < lodIndexGroups.size(); ++g)
+			lodIndexGroups[g].byteOffset += indexOffset;
 	}
 
 public:
@@ -87,70 +150,243 @@ public:
 
 	Mesh& operator=(const Mesh& mesh)
 	{
-		VAO = mesh.VAO;
-		VBO = mesh.VBO;
-		EBO = mesh.EBO;
 		numIndices  = mesh.numIndices;
 		numVertices = mesh.numVertices;
+		boundsMin	= mesh.boundsMin;
+		boundsMax	= mesh.boundsMax;
+		lods		= mesh.lods;
+		clusters	= mesh.clusters;
+		format		= mesh.format;
+		indexMode	= mesh.indexMode;
+		segments	= mesh.segments;
+		lodIndexGroups		= mesh.lodIndexGroups;
+		clusterBaseVertices = mesh.clusterBaseVertices;
+		vertexOffset		= mesh.vertexOffset;
+		indexOffset			= mesh.indexOffset;
+		indexBytes			= mesh.indexBytes;
 		return *this;
 	}
 
+	static void ComputeBounds(const std::vector<Vertex>& vertices, glm::vec3& boundsMin, glm::vec3& boundsMax)
+	{
+		boundsMin = boundsMax = vertices.empty() ? glm::vec3(0.0f) : vertices[0].position;
+		for (GLuint i = 1; i < vertices.size(); ++i)
+		{
+			boundsMin = glm::min(boundsMin, vertices[i].position);
+			boundsMax = glm::max(boundsMax, vertices[i].position);
+		}
+	}
+
 	Mesh(const std::vector<Vertex>& vertices)
 	{
 		numVertices = vertices.size();
+		numIndices	= 0;
+		format		= VERTEX_FORMAT_FLOAT;
+		indexMode	= GL_TRIANGLES;
+		ComputeBounds(vertices, boundsMin, boundsMax);
+		lods.push_back(MeshLOD());
+		lodIndexGroups.push_back(IndexGroup());
 
-		glGenVertexArrays(1, &VAO);
-		glBindVertexArray(VAO);
+		vertexOffset = GeometryArena::Get(format).AllocateVertices(&vertices[0], numVertices);
+		indexOffset	 = 0;
+		indexBytes	 = 0;
+	}
 
-		glGenBuffers(1, &VBO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-		
-		AttributePointers();
+	// Packs the vertices into format and encodes the triangle lists; packed and encoded
+	// hold the bytes data points to. Without LODs the whole index buffer is the only level.
+	static void Encode(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, const std::vector<MeshLOD>& lods, const std::vector<MeshCluster>& clusters,
+		VertexFormat format, IndexEncoding encoding, std::vector<PackedVertex>& packed, EncodedIndices& encoded, MeshData& data)
+	{
+		data.format		 = format;
+		data.numVertices = vertices.size();
+		data.numIndices	 = indices.size();
+		data.lods		 = lods;
+		data.clusters	 = clusters;
+		ComputeBounds(vertices, data.boundsMin, data.boundsMax);
+		if (data.lods.empty())
+			data.lods.push_back(MeshLOD(0, data.numIndices, 0.0f));
+
+		data.vertices = vertices.empty() ? NULL : &vertices[0];
+		if (format == VERTEX_FORMAT_PACKED)
+		{
+			packed.resize(vertices.size());
+			for (GLuint i = 0; i < vertices.size(); ++i)
+				packed[i] = PackedVertex(vertices[i], data.boundsMin, data.boundsMax);
+			data.vertices = packed.empty() ? NULL : &packed[0];
+		}
+
+		// Clusters are drawn on their own, LODs without clusters as a whole
+		std::vector<IndexRange> units;
+		std::vector<GLuint> lodUnits;
+		for (GLuint l = 0; l < data.lods.size(); ++l)
+		{
+			const MeshLOD& lod = data.lods[l];
+			lodUnits.push_back(units.size());
+			if (lod.numClusters == 0)
+				units.push_back(IndexRange(lod.firstIndex, lod.numIndices));
+			for (GLuint c = lod.firstCluster; c < lod.firstCluster + lod.numClusters; ++c)
+				units.push_back(IndexRange(data.clusters[c].firstIndex, data.clusters[c].numIndices));
+		}
+		lodUnits.push_back(units.size());
+
+		IndexEncoder::Encode(indices.empty() ? NULL : &indices[0], units, lodUnits, encoding, encoded);
+		data.indexMode	= encoded.mode;
+		data.segments	= encoded.segments;
+		data.groups		= encoded.groups;
+		data.indices	= encoded.data.empty() ? NULL : &encoded.data[0];
+		data.indexBytes = encoded.data.size();
+		data.clusterBaseVertices.assign(data.clusters.size(), 0);
 
-		glBindVertexArray(0);
+		for (GLuint l = 0; l < data.lods.size(); ++l)
+		{
+			MeshLOD& lod = data.lods[l];
+			const IndexRange& first = encoded.units[lodUnits[l]];
+			const IndexRange& last	= encoded.units[lodUnits[l + 1] - 1];
+			lod.firstIndex = first.firstIndex;
+			lod.numIndices = last.firstIndex + last.numIndices - first.firstIndex;
+			for (GLuint c = 0; c < lod.numClusters; ++c)
+			{
+				GLuint unit = lodUnits[l] + c;
+				data.clusters[lod.firstCluster + c].firstIndex = encoded.units[unit].firstIndex;
+				data.clusters[lod.firstCluster + c].numIndices = encoded.units[unit].numIndices;
+				data.clusterBaseVertices[lod.firstCluster + c] = encoded.baseVertices[unit];
+			}
+		}
 	}
 
-	Mesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices)
+	Mesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+		const std::vector<MeshLOD>& lods = std::vector<MeshLOD>(), const std::vector<MeshCluster>& clusters = std::vector<MeshCluster>(),
+		VertexFormat format = VERTEX_FORMAT_FLOAT, IndexEncoding encoding = INDEX_ENCODING_LIST)
 	{
-		numVertices = vertices.size();
-		numIndices = indices.size();		
+		std::vector<PackedVertex> packed;
+		EncodedIndices encoded;
+		MeshData data;
+		Encode(vertices, indices, lods, clusters, format, encoding, packed, encoded, data);
+		Upload(data);
+	}
+
+	// Uploads data as it is, e.g. from a mapped mesh cache
+	Mesh(const MeshData& data)
+	{
+		Upload(data);
+	}
+
+	const glm::vec3& GetBoundsMin() const { return boundsMin; }
+	const glm::vec3& GetBoundsMax() const { return boundsMax; }
+	const std::vector<MeshLOD>& GetLODs() const { return lods; }
+	const std::vector<MeshCluster>& GetClusters() const { return clusters; }
+	GLint GetClusterBaseVertex(GLuint cluster) const { return clusterBaseVertices[cluster]; }
+	VertexFormat GetFormat() const { return format; }
+	GLenum GetIndexMode() const { return indexMode; }
+	const IndexGroup& GetIndexGroup(GLuint lod) const { return lodIndexGroups[std::min(lod, (GLuint)lods.size() - 1)]; }
+	const IndexSegment& GetIndexSegment(GLuint segment) const { return segments[segment]; }
+
+	// Maps decoded vertex positions to object space; the identity for float vertices
+	glm::mat4 GetDecodeMatrix() const
+	{
+		if (format != VERTEX_FORMAT_PACKED)
+			return glm::mat4(1.0f);
+		return glm::translate(boundsMin) * glm::scale(boundsMax - boundsMin);
+	}
+
+	// World space sphere around the bounds, scaled by the largest axis of model
+	void GetBoundingSphere(const glm::mat4& model, glm::vec3& center, GLfloat& radius) const
+	{
+		GLfloat scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		center = glm::vec3(model * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+		radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+	}
+
+	// Picks the coarsest level whose error projects to at most pixelError pixels.
+	// projectionScale is projection[1][1] * viewportHeight / 2; orthographic
+	// projections do not divide by the distance.
+	GLuint SelectLOD(const glm::mat4& model, const glm::vec3& eyePosition, GLfloat projectionScale, bool orthographic, GLfloat pixelError, LODState& state) const
+	{
+		GLfloat scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		glm::vec3 center;
+		GLfloat radius;
+		GetBoundingSphere(model, center, radius);
 
-		glGenVertexArrays(1, &VAO);
-		glBindVertexArray(VAO);
+		GLfloat pixelsPerUnit = projectionScale * scale;
+		if (!orthographic)
+			pixelsPerUnit /= glm::max(glm::length(center - eyePosition) - radius, 0.1f);
+
+		GLuint lod = std::min(state.lod, (GLuint)lods.size() - 1);
+		while (lod > 0 && lods[lod].error * pixelsPerUnit > pixelError)
+			lod--;
+		while (lod + 1 < lods.size() && lods[lod + 1].error * pixelsPerUnit < pixelError * (1.0f - LOD_HYSTERESIS))
+			lod++;
+
+		state.lod = lod;
+		return lod;
+	}
 
-		glGenBuffers(1, &VBO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+	void DrawElements(GLuint lod = 0)
+	{
+		const IndexGroup& group = lodIndexGroups[std::min(lod, (GLuint)lods.size() - 1)];
+		Bind();
+		if (indexMode == GL_TRIANGLE_STRIP)
+			glPrimitiveRestartIndex(group.restartIndex);
+		for (GLuint s = group.firstSegment; s < group.firstSegment + group.numSegments; ++s)
+			glDrawElementsBaseVertex(indexMode, segments[s].numIndices, group.type, group.Offset(segments[s].firstIndex), segments[s].baseVertex);
+		Unbind();
+	}
 
-		glGenBuffers(1, &EBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+	// Draws several index ranges of one LOD, given as counts, first indices and base vertices, in one call
+	void DrawElements(GLuint lod, const std::vector<GLsizei>& counts, const std::vector<GLuint>& firstIndices, const std::vector<GLint>& baseVertices)
+	{
+		if (counts.empty())
+			return;
 
-		AttributePointers();
+		const IndexGroup& group = lodIndexGroups[std::min(lod, (GLuint)lods.size() - 1)];
+		drawOffsets.resize(firstIndices.size());
+		for (GLuint i = 0; i < firstIndices.size(); ++i)
+			drawOffsets[i] = group.Offset(firstIndices[i]);
 
-		glBindVertexArray(0);
+		Bind();
+		if (indexMode == GL_TRIANGLE_STRIP)
+			glPrimitiveRestartIndex(group.restartIndex);
+		glMultiDrawElementsBaseVertex(indexMode, &counts[0], group.type, &drawOffsets[0], counts.size(), &baseVertices[0]);
+		Unbind();
 	}
 
-	void DrawElements()
+	// Draws count instances of one LOD whose InstanceData records start at offset in buffer
+	void DrawElementsInstanced(GLuint lod, GLuint buffer, GLuint offset, GLsizei count)
 	{
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		if (count == 0)
+			return;
+
+		const IndexGroup& group = lodIndexGroups[std::min(lod, (GLuint)lods.size() - 1)];
+		GeometryArena& arena = GeometryArena::Get(format);
+		Bind();
+		arena.BindInstances(buffer, offset);
+		if (indexMode == GL_TRIANGLE_STRIP)
+			glPrimitiveRestartIndex(group.restartIndex);
+		for (GLuint s = group.firstSegment; s < group.firstSegment + group.numSegments; ++s)
+			glDrawElementsInstancedBaseVertex(indexMode, segments[s].numIndices, group.type, group.Offset(segments[s].firstIndex), count, segments[s].baseVertex);
+		arena.UnbindInstances();
+		Unbind();
 	}
 
 	void DrawArrays()
 	{
-		glBindVertexArray(VAO);
-		glDrawArrays(GL_TRIANGLES, 0, numVertices);
-		glBindVertexArray(0);
+		Bind();
+		glDrawArrays(GL_TRIANGLES, vertexOffset, numVertices);
+		Unbind();
+	}
+
+	// Returns the ranges to the arena; meshes are copied by value, so only the last copy may release
+	void Release()
+	{
+		GeometryArena& arena = GeometryArena::Get(format);
+		arena.FreeVertices(vertexOffset, numVertices);
+		arena.FreeIndices(indexOffset, indexBytes);
+		numVertices = numIndices = indexBytes = 0;
 	}
 
 	~Mesh()
 	{
-		// glDeleteBuffers(1, &EBO);
-		// glDeleteBuffers(1, &VBO);
-		// glDeleteVertexArrays(1, &VAO);		
+		// Release();
 	}
 };
 
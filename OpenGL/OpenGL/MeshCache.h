@@ -0,0 +1,204 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "Geometry.h"
+#include "MeshSimplifier.h"
+#include "MeshClusterizer.h"
+#include "MappedFile.h"
+
+// .meshbin layout: MeshBinHeader, numVertices vertices of vertexFormat (vertexSize bytes
+// each), indexBytes of indices in indexEncoding padded to four bytes, numLODs MeshLOD records,
+// numClusters MeshCluster records, numClusters GLint base vertices, numSegments IndexSegment
+// records and numLODs IndexGroup records; see MeshData.
+// Bump MESHBIN_VERSION whenever the processing that produces the cached data changes.
+const GLuint MESHBIN_MAGIC	 = 0x4E42534D; // "MSBN"
+const GLuint MESHBIN_VERSION = 5;
+
+struct MeshBinHeader
+{
+	GLuint magic;
+	GLuint version;
+	GLuint vertexFormat;
+	GLuint vertexSize;
+	GLuint indexEncoding;
+	GLuint indexMode;
+	GLuint numVertices;
+	GLuint numIndices;
+	GLuint indexBytes;
+	GLuint numLODs;
+	GLuint numClusters;
+	GLuint numSegments;
+	unsigned long long sourceSize;
+	unsigned long long sourceHash;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+};
+
+class MeshCache
+{
+private:
+	// FNV-1a over the source bytes
+	static unsigned long long HashSource(const MappedFile& source)
+	{
+		unsigned long long hash = 14695981039346656037ULL;
+		for (const char* c = source.Begin(); c != source.End(); ++c)
+		{
+			hash ^= (unsigned char)*c;
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	static std::string CachePath(const std::string& sourcePath)
+	{
+		size_t slash = sourcePath.find_last_of("/\\");
+		size_t dot	 = sourcePath.find_last_of('.');
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			dot = sourcePath.length();
+		return sourcePath.substr(0, dot) + ".meshbin";
+	}
+
+	// Index bytes are padded so the records after them stay aligned
+	static size_t PaddedIndexBytes(GLuint indexBytes) { return (indexBytes + 3) & ~(size_t)3; }
+
+	static bool IsValid(const MappedFile& cache, const MeshBinHeader& expected)
+	{
+		if (!cache.IsOpen() || cache.Size() < sizeof(MeshBinHeader))
+			return false;
+
+		const MeshBinHeader* header = (const MeshBinHeader*)cache.Begin();
+		return header->magic		 == expected.magic
+			&& header->version		 == expected.version
+			&& header->vertexFormat	 == expected.vertexFormat
+			&& header->vertexSize	 == expected.vertexSize
+			&& header->indexEncoding == expected.indexEncoding
+			&& header->sourceSize	 == expected.sourceSize
+			&& header->sourceHash	 == expected.sourceHash
+			&& header->numLODs		 > 0
+			&& cache.Size() == sizeof(MeshBinHeader) + (size_t)header->numVertices * header->vertexSize + PaddedIndexBytes(header->indexBytes)
+				+ (size_t)header->numLODs * (sizeof(MeshLOD) + sizeof(IndexGroup)) + (size_t)header->numClusters * (sizeof(MeshCluster) + sizeof(GLint))
+				+ (size_t)header->numSegments * sizeof(IndexSegment);
+	}
+
+	template<typename T>
+	static void WriteArray(std::ofstream& file, const std::vector<T>& values)
+	{
+		if (!values.empty())
+			file.write((const char*)&values[0], values.size() * sizeof(T));
+	}
+
+	static void Write(const std::string& path, const MeshBinHeader& header, const MeshData& data)
+	{
+		std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			std::cout << "ERROR::MESH_CACHE:: Unable to write " << path << std::endl;
+			return;
+		}
+
+		const char padding[4] = { 0, 0, 0, 0 };
+		file.write((const char*)&header, sizeof(MeshBinHeader));
+		if (data.vertices)
+			file.write((const char*)data.vertices, (size_t)data.numVertices * header.vertexSize);
+		if (data.indices)
+			file.write((const char*)data.indices, data.indexBytes);
+		file.write(padding, PaddedIndexBytes(data.indexBytes) - data.indexBytes);
+		WriteArray(file, data.lods);
+		WriteArray(file, data.clusters);
+		WriteArray(file, data.clusterBaseVertices);
+		WriteArray(file, data.segments);
+		WriteArray(file, data.groups);
+	}
+
+public:
+	// Loads the mesh from its .meshbin next to the OBJ, rebuilding the cache
+	// when it is missing, from another version or the OBJ content changed.
+	// The cache holds the vertices already in format and the indices already
+	// encoded, so a hit is uploaded from the mapping as it is; asking for
+	// another format or encoding rebuilds it.
+	static Mesh Load(const std::string& objPath, VertexFormat format = VERTEX_FORMAT_FLOAT, IndexEncoding encoding = INDEX_ENCODING_LIST)
+	{
+		MeshBinHeader expected;
+		expected.magic		   = MESHBIN_MAGIC;
+		expected.version	   = MESHBIN_VERSION;
+		expected.vertexFormat  = format;
+		expected.vertexSize	   = format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+		expected.indexEncoding = encoding;
+		{
+			MappedFile source(objPath);
+			expected.sourceSize = source.Size();
+			expected.sourceHash = HashSource(source);
+		}
+
+		std::string cachePath = CachePath(objPath);
+		{
+			MappedFile cache(cachePath);
+			if (IsValid(cache, expected))
+			{
+				const MeshBinHeader* header = (const MeshBinHeader*)cache.Begin();
+				const char* vertices = cache.Begin() + sizeof(MeshBinHeader);
+				const char* indices	 = vertices + (size_t)header->numVertices * header->vertexSize;
+				const MeshLOD* lods	 = (const MeshLOD*)(indices + PaddedIndexBytes(header->indexBytes));
+				const MeshCluster* clusters		 = (const MeshCluster*)(lods + header->numLODs);
+				const GLint* clusterBaseVertices = (const GLint*)(clusters + header->numClusters);
+				const IndexSegment* segments	 = (const IndexSegment*)(clusterBaseVertices + header->numClusters);
+				const IndexGroup* groups		 = (const IndexGroup*)(segments + header->numSegments);
+
+				MeshData data;
+				data.format		 = format;
+				data.indexMode	 = header->indexMode;
+				data.numVertices = header->numVertices;
+				data.numIndices	 = header->numIndices;
+				data.boundsMin	 = header->boundsMin;
+				data.boundsMax	 = header->boundsMax;
+				data.vertices	 = vertices;
+				data.indices	 = (const GLubyte*)indices;
+				data.indexBytes	 = header->indexBytes;
+				data.lods.assign(lods, lods + header->numLODs);
+				data.clusters.assign(clusters, clusters + header->numClusters);
+				data.clusterBaseVertices.assign(clusterBaseVertices, clusterBaseVertices + header->numClusters);
+				data.segments.assign(segments, segments + header->numSegments);
+				data.groups.assign(groups, groups + header->numLODs);
+				return Mesh(data);
+			}
+		}
+
+		std::vector<Vertex> vertices;
+		std::vector<GLuint> indices;
+		std::vector<MeshLOD> lods;
+		std::vector<MeshCluster> clusters;
+		Geometry::GenerateFromFile(objPath.c_str(), vertices, indices);
+		MeshSimplifier::GenerateLODChain(vertices, indices, lods);
+		MeshClusterizer::Build(vertices, indices, lods, clusters);
+
+		std::vector<PackedVertex> packed;
+		EncodedIndices encoded;
+		MeshData data;
+		Mesh::Encode(vertices, indices, lods, clusters, format, encoding, packed, encoded, data);
+
+		expected.indexMode	 = data.indexMode;
+		expected.numVertices = data.numVertices;
+		expected.numIndices	 = data.numIndices;
+		expected.indexBytes	 = data.indexBytes;
+		expected.numLODs	 = data.lods.size();
+		expected.numClusters = data.clusters.size();
+		expected.numSegments = data.segments.size();
+		expected.boundsMin	 = data.boundsMin;
+		expected.boundsMax	 = data.boundsMax;
+		if (!vertices.empty())
+			Write(cachePath, expected, data);
+
+		return Mesh(data);
+	}
+};
+
+#endif
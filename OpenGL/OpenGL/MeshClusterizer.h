@@ -0,0 +1,240 @@
+#ifndef MESH_CLUSTERIZER_H
+#define MESH_CLUSTERIZER_H
+
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+const GLuint MAX_CLUSTER_VERTICES  = 64;
+const GLuint MAX_CLUSTER_TRIANGLES = 124;
+
+// Cones wider than this (cosine of the half angle) are never culled
+const GLfloat MIN_CLUSTER_CONE_DOT = 0.1f;
+
+// Splits every LOD range into clusters of consecutive triangles. The index buffer is
+// already in vertex cache order, so consecutive triangles are also spatially close.
+class MeshClusterizer
+{
+private:
+	static MeshCluster CreateCluster(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, GLuint begin, GLuint end)
+	{
+		MeshCluster cluster;
+		cluster.firstIndex = begin;
+		cluster.numIndices = end - begin;
+
+		glm::vec3 boundsMin = vertices[indices[begin]].position;
+		glm::vec3 boundsMax = boundsMin;
+		glm::vec3 normalSum(0.0f);
+		for (GLuint i = begin; i < end; i += 3)
+		{
+			const glm::vec3& p0 = vertices[indices[i]].position;
+			const glm::vec3& p1 = vertices[indices[i + 1]].position;
+			const glm::vec3& p2 = vertices[indices[i + 2]].position;
+			boundsMin = glm::min(boundsMin, glm::min(p0, glm::min(p1, p2)));
+			boundsMax = glm::max(boundsMax, glm::max(p0, glm::max(p1, p2)));
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			GLfloat length = glm::length(normal);
+			if (length > 0.0f)
+				normalSum += normal / length;
+		}
+
+		cluster.center = (boundsMin + boundsMax) * 0.5f;
+		cluster.radius = 0.0f;
+		for (GLuint i = begin; i < end; ++i)
+			cluster.radius = glm::max(cluster.radius, glm::length(vertices[indices[i]].position - cluster.center));
+
+		GLfloat axisLength = glm::length(normalSum);
+		cluster.coneAxis   = axisLength > 0.0f ? normalSum / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+		cluster.coneCutoff = 1.0f;
+		if (axisLength == 0.0f)
+			return cluster;
+
+		GLfloat minDot = 1.0f;
+		for (GLuint i = begin; i < end; i += 3)
+		{
+			const glm::vec3& p0 = vertices[indices[i]].position;
+			const glm::vec3& p1 = vertices[indices[i + 1]].position;
+			const glm::vec3& p2 = vertices[indices[i + 2]].position;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			GLfloat length = glm::length(normal);
+			if (length > 0.0f)
+				minDot = glm::min(minDot, glm::dot(cluster.coneAxis, normal / length));
+		}
+
+		if (minDot > MIN_CLUSTER_CONE_DOT)
+			cluster.coneCutoff = glm::sqrt(1.0f - minDot * minDot);
+		return cluster;
+	}
+
+public:
+	static void Build(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, std::vector<MeshLOD>& lods, std::vector<MeshCluster>& clusters)
+	{
+		clusters.clear();
+
+		// A vertex belongs to the current cluster when its stamp matches
+		std::vector<GLuint> stamps(vertices.size(), 0);
+		GLuint stamp = 1;
+
+		for (GLuint l = 0; l < lods.size(); ++l)
+		{
+			MeshLOD& lod = lods[l];
+			lod.firstCluster = clusters.size();
+
+			GLuint end = lod.firstIndex + lod.numIndices;
+			GLuint clusterBegin = lod.firstIndex;
+			GLuint clusterVertices = 0;
+
+			for (GLuint i = lod.firstIndex; i < end; i += 3)
+			{
+				GLuint a = indices[i], b = indices[i + 1], c = indices[i + 2];
+				GLuint newVertices = (stamps[a] != stamp) + (stamps[b] != stamp && b != a) + (stamps[c] != stamp && c != a && c != b);
+
+				if (clusterVertices + newVertices > MAX_CLUSTER_VERTICES || (i - clusterBegin) / 3 == MAX_CLUSTER_TRIANGLES)
+				{
+					clusters.push_back(CreateCluster(vertices, indices, clusterBegin, i));
+					clusterBegin	= i;
+					clusterVertices = 0;
+					stamp++;
+					newVertices = 1 + (b != a) + (c != a && c != b);
+				}
+
+				stamps[a] = stamps[b] = stamps[c] = stamp;
+				clusterVertices += newVertices;
+			}
+
+			if (clusterBegin < end)
+				clusters.push_back(CreateCluster(vertices, indices, clusterBegin, end));
+			stamp++;
+
+			lod.numClusters = clusters.size() - lod.firstCluster;
+		}
+	}
+};
+
+// Normalized planes of the frustum of clip, pointing inwards: left, right, bottom, top, near, far
+inline void ExtractFrustumPlanes(const glm::mat4& clip, glm::vec4 planes[6])
+{
+	for (GLuint i = 0; i < 3; ++i)
+	{
+		glm::vec4 row(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+		glm::vec4 w(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+		planes[2 * i]	  = w + row;
+		planes[2 * i + 1] = w - row;
+	}
+	for (GLuint i = 0; i < 6; ++i)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+inline bool SphereInFrustum(const glm::vec4 planes[6], const glm::vec3& center, GLfloat radius)
+{
+	for (GLuint i = 0; i < 6; ++i)
+	{
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+			return false;
+	}
+	return true;
+}
+
+// Culls the clusters of a mesh against the frustum and their normal cones for one view,
+// then draws the surviving clusters with adjacent ranges sharing a base vertex merged.
+class ClusterCuller
+{
+private:
+	glm::mat4 viewProjection;
+	glm::vec3 eyePosition;
+	glm::vec3 viewDirection;
+	bool orthographic;
+
+	std::vector<GLsizei> counts;
+	std::vector<GLuint> firstIndices;
+	std::vector<GLint> baseVertices;
+
+	GLuint testedClusters;
+	GLuint culledClusters;
+
+public:
+	ClusterCuller() : orthographic(false), testedClusters(0), culledClusters(0) { }
+
+	void SetView(const glm::mat4& projection, const glm::mat4& view)
+	{
+		glm::mat4 inverseView = glm::inverse(view);
+		viewProjection = projection * view;
+		eyePosition	   = glm::vec3(inverseView[3]);
+		viewDirection  = -glm::normalize(glm::vec3(inverseView[2]));
+		orthographic   = projection[3][3] == 1.0f;
+	}
+
+	void Draw(Mesh& mesh, const glm::mat4& model, GLuint lod)
+	{
+		const std::vector<MeshLOD>& lods = mesh.GetLODs();
+		const std::vector<MeshCluster>& clusters = mesh.GetClusters();
+		const MeshLOD& level = lods[std::min(lod, (GLuint)lods.size() - 1)];
+		if (level.numClusters == 0)
+		{
+			mesh.DrawElements(lod);
+			return;
+		}
+
+		// Frustum planes and the viewer in object space
+		glm::vec4 planes[6];
+		ExtractFrustumPlanes(viewProjection * model, planes);
+
+		glm::mat4 inverseModel = glm::inverse(model);
+		glm::vec3 eye		= glm::vec3(inverseModel * glm::vec4(eyePosition, 1.0f));
+		glm::vec3 direction = glm::normalize(glm::vec3(inverseModel * glm::vec4(viewDirection, 0.0f)));
+
+		counts.clear();
+		firstIndices.clear();
+		baseVertices.clear();
+		GLuint rangeEnd = (GLuint)-1;
+
+		for (GLuint c = level.firstCluster; c < level.firstCluster + level.numClusters; ++c)
+		{
+			const MeshCluster& cluster = clusters[c];
+			testedClusters++;
+
+			bool visible = SphereInFrustum(planes, cluster.center, cluster.radius);
+
+			if (visible)
+			{
+				if (orthographic)
+					visible = glm::dot(direction, cluster.coneAxis) < cluster.coneCutoff;
+				else
+				{
+					glm::vec3 toCenter = cluster.center - eye;
+					visible = glm::dot(toCenter, cluster.coneAxis) < cluster.coneCutoff * glm::length(toCenter) + cluster.radius;
+				}
+			}
+
+			if (!visible)
+			{
+				culledClusters++;
+				continue;
+			}
+
+			GLint baseVertex = mesh.GetClusterBaseVertex(c);
+			if (cluster.firstIndex == rangeEnd && baseVertex == baseVertices.back())
+				counts.back() += cluster.numIndices;
+			else
+			{
+				counts.push_back(cluster.numIndices);
+				firstIndices.push_back(cluster.firstIndex);
+				baseVertices.push_back(baseVertex);
+			}
+			rangeEnd = cluster.firstIndex + cluster.numIndices;
+		}
+
+		mesh.DrawElements(lod, counts, firstIndices, baseVertices);
+	}
+
+	void ResetStatistics() { testedClusters = culledClusters = 0; }
+	GLuint GetTestedClusters() const { return testedClusters; }
+	GLuint GetCulledClusters() const { return culledClusters; }
+};
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+// Size of the LRU cache modelled by the triangle reordering
+const GLuint OPTIMIZER_CACHE_SIZE = 32;
+// Size of the FIFO post-transform cache used for the statistics
+const GLuint ANALYZER_CACHE_SIZE  = 16;
+
+typedef struct VertexCacheStatistics
+{
+	GLfloat acmr;	// transformed vertices per triangle
+	GLfloat atvr;	// transformed vertices per vertex
+
+	VertexCacheStatistics() : acmr(0.0f), atvr(0.0f) { }
+} VertexCacheStatistics;
+
+class MeshOptimizer
+{
+private:
+	// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation"
+	static GLfloat VertexScore(GLint cachePosition, GLuint remainingTriangles)
+	{
+		const GLfloat CACHE_DECAY_POWER	  = 1.5f;
+		const GLfloat LAST_TRIANGLE_SCORE = 0.75f;
+		const GLfloat VALENCE_BOOST_SCALE = 2.0f;
+		const GLfloat VALENCE_BOOST_POWER = 0.5f;
+
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		GLfloat score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+				score = LAST_TRIANGLE_SCORE;
+			else
+			{
+				GLfloat scaler = 1.0f / (OPTIMIZER_CACHE_SIZE - 3);
+				score = glm::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+			}
+		}
+
+		return score + VALENCE_BOOST_SCALE * glm::pow((GLfloat)remainingTriangles, -VALENCE_BOOST_POWER);
+	}
+
+	// Splits the index buffer where the FIFO cache fully misses a triangle;
+	// every returned value is the first index of a cluster
+	static std::vector<GLuint> HardBoundaries(const std::vector<GLuint>& indices, GLuint numVertices)
+	{
+		std::vector<GLuint> boundaries;
+		std::vector<GLuint> timestamps(numVertices, 0);
+		GLuint time = ANALYZER_CACHE_SIZE + 1;
+
+		for (GLuint i = 0; i < indices.size(); i += 3)
+		{
+			GLuint misses = 0;
+			for (GLuint k = 0; k < 3; ++k)
+			{
+				if (time - timestamps[indices[i + k]] > ANALYZER_CACHE_SIZE)
+				{
+					timestamps[indices[i + k]] = time++;
+					misses++;
+				}
+			}
+
+			if (i == 0 || misses == 3)
+				boundaries.push_back(i);
+		}
+
+		return boundaries;
+	}
+
+public:
+	static VertexCacheStatistics AnalyzeVertexCache(const std::vector<GLuint>& indices, GLuint numVertices)
+	{
+		VertexCacheStatistics statistics;
+		if (indices.empty() || numVertices == 0)
+			return statistics;
+
+		std::vector<GLuint> timestamps(numVertices, 0);
+		GLuint time = ANALYZER_CACHE_SIZE + 1;
+		GLuint misses = 0;
+
+		for (GLuint i = 0; i < indices.size(); ++i)
+		{
+			if (time - timestamps[indices[i]] > ANALYZER_CACHE_SIZE)
+			{
+				timestamps[indices[i]] = time++;
+				misses++;
+			}
+		}
+
+		statistics.acmr = (GLfloat)misses / (indices.size() / 3);
+		statistics.atvr = (GLfloat)misses / numVertices;
+		return statistics;
+	}
+
+	// Reorders triangles for post-transform cache locality
+	static void OptimizeVertexCache(std::vector<GLuint>& indices, GLuint numVertices)
+	{
+		GLuint numTriangles = indices.size() / 3;
+		if (numTriangles == 0)
+			return;
+
+		// Triangles adjacent to each vertex; the live ones are kept at the front of each list
+		std::vector<GLuint> remaining(numVertices, 0);
+		for (GLuint i = 0; i < indices.size(); ++i)
+			remaining[indices[i]]++;
+
+		std::vector<GLuint> offsets(numVertices + 1, 0);
+		for (GLuint v = 0; v < numVertices; ++v)
+			offsets[v + 1] = offsets[v] + remaining[v];
+
+		std::vector<GLuint> adjacency(indices.size());
+		std::vector<GLuint> cursor(offsets.begin(), offsets.end() - 1);
+		for (GLuint i = 0; i < indices.size(); ++i)
+			adjacency[cursor[indices[i]]++] = i / 3;
+
+		std::vector<GLint> cachePosition(numVertices, -1);
+		std::vector<GLfloat> vertexScore(numVertices);
+		for (GLuint v = 0; v < numVertices; ++v)
+			vertexScore[v] = VertexScore(-1, remaining[v]);
+
+		std::vector<GLfloat> triangleScore(numTriangles);
+		for (GLuint t = 0; t < numTriangles; ++t)
+			triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+
+		std::vector<bool> emitted(numTriangles, false);
+		std::vector<GLuint> cache, newCache;
+		cache.reserve(OPTIMIZER_CACHE_SIZE + 3);
+		newCache.reserve(OPTIMIZER_CACHE_SIZE + 3);
+
+		std::vector<GLuint> result;
+		result.reserve(indices.size());
+
+		GLint bestTriangle = -1;
+		GLuint scanCursor = 0;
+
+		for (GLuint n = 0; n < numTriangles; ++n)
+		{
+			// Nothing adjacent to the cache: continue with the next unemitted triangle
+			if (bestTriangle < 0)
+			{
+				while (emitted[scanCursor])
+					scanCursor++;
+				bestTriangle = scanCursor;
+			}
+
+			const GLuint* triangle = &indices[3 * bestTriangle];
+			emitted[bestTriangle] = true;
+			result.insert(result.end(), triangle, triangle + 3);
+
+			for (GLuint k = 0; k < 3; ++k)
+			{
+				GLuint v = triangle[k];
+				GLuint* list = &adjacency[offsets[v]];
+				for (GLuint j = 0; j < remaining[v]; ++j)
+				{
+					if (list[j] == (GLuint)bestTriangle)
+					{
+						std::swap(list[j], list[remaining[v] - 1]);
+						break;
+					}
+				}
+				remaining[v]--;
+			}
+
+			newCache.assign(triangle, triangle + 3);
+			for (GLuint i = 0; i < cache.size(); ++i)
+			{
+				if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+					newCache.push_back(cache[i]);
+			}
+
+			for (GLuint i = 0; i < newCache.size(); ++i)
+			{
+				GLuint v = newCache[i];
+				cachePosition[v] = i < OPTIMIZER_CACHE_SIZE ? (GLint)i : -1;
+				vertexScore[v] = VertexScore(cachePosition[v], remaining[v]);
+			}
+
+			GLfloat bestScore = -1.0f;
+			bestTriangle = -1;
+			for (GLuint i = 0; i < newCache.size(); ++i)
+			{
+				GLuint v = newCache[i];
+				for (GLuint j = 0; j < remaining[v]; ++j)
+				{
+					GLuint t = adjacency[offsets[v] + j];
+					triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+					if (triangleScore[t] > bestScore)
+					{
+						bestScore = triangleScore[t];
+						bestTriangle = t;
+					}
+				}
+			}
+
+			if (newCache.size() > OPTIMIZER_CACHE_SIZE)
+				newCache.resize(OPTIMIZER_CACHE_SIZE);
+			cache.swap(newCache);
+		}
+
+		indices.swap(result);
+	}
+
+	// Sander, Nehab, Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw".
+	// Clusters start where the cache restarts, so moving them keeps the ACMR; clusters facing
+	// away from the mesh center are drawn first to occlude the rest.
+	static void OptimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices)
+	{
+		if (indices.empty())
+			return;
+
+		std::vector<GLuint> boundaries = HardBoundaries(indices, vertices.size());
+		boundaries.push_back(indices.size());
+		GLuint numClusters = boundaries.size() - 1;
+		if (numClusters < 2)
+			return;
+
+		glm::vec3 meshCentroid(0.0f);
+		GLfloat meshArea = 0.0f;
+		std::vector<glm::vec3> clusterCentroids(numClusters, glm::vec3(0.0f));
+		std::vector<glm::vec3> clusterNormals(numClusters, glm::vec3(0.0f));
+		std::vector<GLfloat> clusterAreas(numClusters, 0.0f);
+
+		for (GLuint c = 0; c < numClusters; ++c)
+		{
+			for (GLuint i = boundaries[c]; i < boundaries[c + 1]; i += 3)
+			{
+				const glm::vec3& p0 = vertices[indices[i]].position;
+				const glm::vec3& p1 = vertices[indices[i + 1]].position;
+				const glm::vec3& p2 = vertices[indices[i + 2]].position;
+				glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				GLfloat area = glm::length(normal);
+
+				clusterCentroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+				clusterNormals[c]	+= normal;
+				clusterAreas[c]		+= area;
+			}
+			meshCentroid += clusterCentroids[c];
+			meshArea	 += clusterAreas[c];
+		}
+		if (meshArea > 0.0f)
+			meshCentroid /= meshArea;
+
+		std::vector<std::pair<GLfloat, GLuint> > order(numClusters);
+		for (GLuint c = 0; c < numClusters; ++c)
+		{
+			glm::vec3 centroid = clusterAreas[c] > 0.0f ? clusterCentroids[c] / clusterAreas[c] : vertices[indices[boundaries[c]]].position;
+			GLfloat normalLength = glm::length(clusterNormals[c]);
+			glm::vec3 normal = normalLength > 0.0f ? clusterNormals[c] / normalLength : glm::vec3(0.0f);
+			order[c] = std::make_pair(-glm::dot(centroid - meshCentroid, normal), c);
+		}
+		std::stable_sort(order.begin(), order.end());
+
+		std::vector<GLuint> result;
+		result.reserve(indices.size());
+		for (GLuint i = 0; i < numClusters; ++i)
+		{
+			GLuint c = order[i].second;
+			result.insert(result.end(), indices.begin() + boundaries[c], indices.begin() + boundaries[c + 1]);
+		}
+
+		indices.swap(result);
+	}
+
+	// Orders vertices by first use and drops unreferenced ones
+	static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+	{
+		std::vector<GLuint> remap(vertices.size(), (GLuint)-1);
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+
+		for (GLuint i = 0; i < indices.size(); ++i)
+		{
+			GLuint& index = remap[indices[i]];
+			if (index == (GLuint)-1)
+			{
+				index = result.size();
+				result.push_back(vertices[indices[i]]);
+			}
+			indices[i] = index;
+		}
+
+		vertices.swap(result);
+	}
+
+	static void Optimize(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, const std::string& name)
+	{
+		VertexCacheStatistics before = AnalyzeVertexCache(indices, vertices.size());
+
+		OptimizeVertexCache(indices, vertices.size());
+		OptimizeOverdraw(indices, vertices);
+		OptimizeVertexFetch(vertices, indices);
+
+		VertexCacheStatistics after = AnalyzeVertexCache(indices, vertices.size());
+
+		std::cout << "MESH_OPTIMIZER::" << name
+			<< ": ACMR " << before.acmr << " -> " << after.acmr
+			<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+	}
+};
+
+#endif
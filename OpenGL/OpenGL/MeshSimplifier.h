@@ -0,0 +1,330 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "MeshOptimizer.h"
+
+// Fractions of the full triangle count kept by each LOD after the first
+const GLfloat LOD_TRIANGLE_RATIOS[] = { 0.5f, 0.25f, 0.1f, 0.05f };
+const GLuint NUM_LOD_RATIOS = sizeof(LOD_TRIANGLE_RATIOS) / sizeof(LOD_TRIANGLE_RATIOS[0]);
+// A level is only kept when it removes at least this fraction of the previous one
+const GLfloat LOD_MIN_REDUCTION = 0.1f;
+
+// Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics".
+// Vertices are collapsed onto an edge neighbour, so every LOD indexes the
+// original vertex buffer. UV seams and open borders are never collapsed.
+class MeshSimplifier
+{
+private:
+	typedef struct Quadric
+	{
+		GLdouble a00, a01, a02, a11, a12, a22;
+		GLdouble b0, b1, b2;
+		GLdouble c;
+		GLdouble weight;
+
+		Quadric() : a00(0), a01(0), a02(0), a11(0), a12(0), a22(0), b0(0), b1(0), b2(0), c(0), weight(0) { }
+
+		Quadric(const glm::dvec3& n, GLdouble d, GLdouble w)
+		{
+			a00 = w * n.x * n.x; a01 = w * n.x * n.y; a02 = w * n.x * n.z;
+			a11 = w * n.y * n.y; a12 = w * n.y * n.z; a22 = w * n.z * n.z;
+			b0	= w * n.x * d;	 b1	 = w * n.y * d;	  b2  = w * n.z * d;
+			c	= w * d * d;
+			weight = w;
+		}
+
+		Quadric& operator+=(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02;
+			a11 += q.a11; a12 += q.a12; a22 += q.a22;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2;
+			c += q.c;
+			weight += q.weight;
+			return *this;
+		}
+
+		GLdouble Evaluate(const glm::dvec3& p) const
+		{
+			GLdouble result = a00 * p.x * p.x + 2.0 * a01 * p.x * p.y + 2.0 * a02 * p.x * p.z
+							+ a11 * p.y * p.y + 2.0 * a12 * p.y * p.z
+							+ a22 * p.z * p.z
+							+ 2.0 * (b0 * p.x + b1 * p.y + b2 * p.z)
+							+ c;
+			return result > 0.0 ? result : 0.0;
+		}
+	} Quadric;
+
+	typedef struct Collapse
+	{
+		GLdouble cost;
+		GLuint from;
+		GLuint to;
+		GLuint fromVersion;
+		GLuint toVersion;
+
+		bool operator<(const Collapse& other) const { return cost > other.cost; }
+	} Collapse;
+
+	static glm::dvec3 Position(const std::vector<Vertex>& vertices, GLuint v)
+	{
+		return glm::dvec3(vertices[v].position);
+	}
+
+	// Vertices sharing a position with another vertex sit on an attribute seam
+	static void FindSeams(const std::vector<Vertex>& vertices, std::vector<bool>& locked)
+	{
+		std::vector<GLuint> order(vertices.size());
+		for (GLuint i = 0; i < order.size(); ++i)
+			order[i] = i;
+
+		std::sort(order.begin(), order.end(), [&vertices](GLuint a, GLuint b)
+		{
+			const glm::vec3& p = vertices[a].position;
+			const glm::vec3& q = vertices[b].position;
+			if (p.x != q.x) return p.x < q.x;
+			if (p.y != q.y) return p.y < q.y;
+			return p.z < q.z;
+		});
+
+		for (GLuint i = 1; i < order.size(); ++i)
+		{
+			if (vertices[order[i]].position == vertices[order[i - 1]].position)
+				locked[order[i]] = locked[order[i - 1]] = true;
+		}
+	}
+
+	// Vertices on an edge used by a single triangle sit on an open border
+	static void FindBorders(const std::vector<GLuint>& indices, std::vector<bool>& locked)
+	{
+		std::vector<std::pair<GLuint, GLuint> > edges;
+		edges.reserve(indices.size());
+		for (GLuint i = 0; i < indices.size(); i += 3)
+		{
+			for (GLuint k = 0; k < 3; ++k)
+			{
+				GLuint a = indices[i + k], b = indices[i + (k + 1) % 3];
+				edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+
+		for (GLuint i = 0; i < edges.size();)
+		{
+			GLuint j = i + 1;
+			while (j < edges.size() && edges[j] == edges[i])
+				j++;
+			if (j - i == 1)
+				locked[edges[i].first] = locked[edges[i].second] = true;
+			i = j;
+		}
+	}
+
+	// Rejects collapses that flip or degenerate a surviving triangle around 'from'
+	static bool IsCollapseValid(const std::vector<Vertex>& vertices, const std::vector<GLuint>& triangles,
+		const std::vector<bool>& removed, const std::vector<GLuint>& adjacent, GLuint from, GLuint to)
+	{
+		glm::dvec3 target = Position(vertices, to);
+		for (GLuint i = 0; i < adjacent.size(); ++i)
+		{
+			GLuint t = adjacent[i];
+			if (removed[t])
+				continue;
+
+			const GLuint* triangle = &triangles[3 * t];
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+				continue;
+
+			glm::dvec3 p[3], q[3];
+			for (GLuint k = 0; k < 3; ++k)
+			{
+				p[k] = Position(vertices, triangle[k]);
+				q[k] = triangle[k] == from ? target : p[k];
+			}
+
+			glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+			glm::dvec3 after  = glm::cross(q[1] - q[0], q[2] - q[0]);
+			GLdouble lengths = glm::length(before) * glm::length(after);
+			if (lengths == 0.0 || glm::dot(before, after) < 0.2 * lengths)
+				return false;
+		}
+		return true;
+	}
+
+public:
+	// Returns at most targetIndexCount indices when the mesh allows it; error receives
+	// the largest distance (in object units) introduced by any collapse
+	static std::vector<GLuint> Simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, GLuint targetIndexCount, GLfloat& error)
+	{
+		GLuint numVertices  = vertices.size();
+		GLuint numTriangles = indices.size() / 3;
+		GLuint targetTriangles = targetIndexCount / 3;
+
+		std::vector<GLuint> triangles(indices);
+		std::vector<bool> removedTriangles(numTriangles, false);
+		std::vector<bool> removedVertices(numVertices, false);
+		std::vector<bool> locked(numVertices, false);
+		std::vector<GLuint> versions(numVertices, 0);
+		std::vector<Quadric> quadrics(numVertices);
+		std::vector<std::vector<GLuint> > adjacency(numVertices);
+
+		FindSeams(vertices, locked);
+		FindBorders(indices, locked);
+
+		for (GLuint t = 0; t < numTriangles; ++t)
+		{
+			glm::dvec3 p0 = Position(vertices, triangles[3 * t]);
+			glm::dvec3 p1 = Position(vertices, triangles[3 * t + 1]);
+			glm::dvec3 p2 = Position(vertices, triangles[3 * t + 2]);
+			glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+			GLdouble area = glm::length(normal);
+			if (area > 0.0)
+				normal /= area;
+
+			Quadric quadric(normal, -glm::dot(normal, p0), area);
+			for (GLuint k = 0; k < 3; ++k)
+			{
+				quadrics[triangles[3 * t + k]] += quadric;
+				adjacency[triangles[3 * t + k]].push_back(t);
+			}
+		}
+
+		std::priority_queue<Collapse> heap;
+		auto pushCollapse = [&](GLuint from, GLuint to)
+		{
+			if (locked[from] || from == to)
+				return;
+
+			Quadric quadric = quadrics[from];
+			quadric += quadrics[to];
+
+			Collapse collapse;
+			collapse.cost		 = quadric.weight > 0.0 ? quadric.Evaluate(Position(vertices, to)) / quadric.weight : 0.0;
+			collapse.from		 = from;
+			collapse.to			 = to;
+			collapse.fromVersion = versions[from];
+			collapse.toVersion	 = versions[to];
+			heap.push(collapse);
+		};
+
+		for (GLuint t = 0; t < numTriangles; ++t)
+		{
+			for (GLuint k = 0; k < 3; ++k)
+			{
+				pushCollapse(triangles[3 * t + k], triangles[3 * t + (k + 1) % 3]);
+				pushCollapse(triangles[3 * t + (k + 1) % 3], triangles[3 * t + k]);
+			}
+		}
+
+		GLdouble maxCost = 0.0;
+		GLuint liveTriangles = numTriangles;
+
+		while (liveTriangles > targetTriangles && !heap.empty())
+		{
+			Collapse collapse = heap.top();
+			heap.pop();
+
+			GLuint from = collapse.from, to = collapse.to;
+			if (removedVertices[from] || removedVertices[to] ||
+				versions[from] != collapse.fromVersion || versions[to] != collapse.toVersion)
+				continue;
+
+			if (!IsCollapseValid(vertices, triangles, removedTriangles, adjacency[from], from, to))
+				continue;
+
+			for (GLuint i = 0; i < adjacency[from].size(); ++i)
+			{
+				GLuint t = adjacency[from][i];
+				if (removedTriangles[t])
+					continue;
+
+				GLuint* triangle = &triangles[3 * t];
+				if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+				{
+					removedTriangles[t] = true;
+					liveTriangles--;
+					continue;
+				}
+
+				for (GLuint k = 0; k < 3; ++k)
+				{
+					if (triangle[k] == from)
+						triangle[k] = to;
+				}
+				adjacency[to].push_back(t);
+			}
+
+			removedVertices[from] = true;
+			adjacency[from].clear();
+			quadrics[to] += quadrics[from];
+			versions[to]++;
+			maxCost = std::max(maxCost, collapse.cost);
+
+			// Drop dead triangles from the survivor and requeue its edges
+			std::vector<GLuint>& adjacent = adjacency[to];
+			adjacent.erase(std::remove_if(adjacent.begin(), adjacent.end(), [&removedTriangles](GLuint t) { return removedTriangles[t]; }), adjacent.end());
+			std::sort(adjacent.begin(), adjacent.end());
+			adjacent.erase(std::unique(adjacent.begin(), adjacent.end()), adjacent.end());
+
+			for (GLuint i = 0; i < adjacent.size(); ++i)
+			{
+				const GLuint* triangle = &triangles[3 * adjacent[i]];
+				for (GLuint k = 0; k < 3; ++k)
+				{
+					if (triangle[k] != to)
+					{
+						pushCollapse(triangle[k], to);
+						pushCollapse(to, triangle[k]);
+					}
+				}
+			}
+		}
+
+		std::vector<GLuint> result;
+		result.reserve(liveTriangles * 3);
+		for (GLuint t = 0; t < numTriangles; ++t)
+		{
+			if (!removedTriangles[t])
+				result.insert(result.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+		}
+
+		error = (GLfloat)glm::sqrt(maxCost);
+		return result;
+	}
+
+	// Appends the coarser levels to the index buffer; lods[0] covers the original indices
+	static void GenerateLODChain(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices, std::vector<MeshLOD>& lods)
+	{
+		lods.clear();
+		lods.push_back(MeshLOD(0, indices.size(), 0.0f));
+
+		GLuint fullIndexCount = indices.size();
+		for (GLuint i = 0; i < NUM_LOD_RATIOS; ++i)
+		{
+			const MeshLOD& previous = lods.back();
+			std::vector<GLuint> source(indices.begin() + previous.firstIndex, indices.begin() + previous.firstIndex + previous.numIndices);
+
+			GLuint target = (GLuint)(fullIndexCount * LOD_TRIANGLE_RATIOS[i]) / 3 * 3;
+			GLfloat error = 0.0f;
+			std::vector<GLuint> level = Simplify(vertices, source, target, error);
+			if (level.empty() || level.size() > previous.numIndices * (1.0f - LOD_MIN_REDUCTION))
+				break;
+
+			MeshOptimizer::OptimizeVertexCache(level, vertices.size());
+
+			// Each level is simplified from the one before, so its distance to LOD0 is bounded by the sum
+			MeshLOD lod(indices.size(), level.size(), error + previous.error);
+			indices.insert(indices.end(), level.begin(), level.end());
+			lods.push_back(lod);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef MULTI_DRAW_BACKEND_H
+#define MULTI_DRAW_BACKEND_H
+
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "UniformRing.h"
+
+// Layout defined by glMultiDrawElementsIndirect
+typedef struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;		// in indices of the bucket's type from the start of the index buffer
+	GLint baseVertex;
+	GLuint baseInstance;	// selects the draw's InstanceData
+} DrawElementsIndirectCommand;
+
+// A submitted draw; draws with equal keys share one multi-draw call
+typedef struct MultiDrawRecord
+{
+	Mesh* mesh;
+	Material* material;
+	GLuint lod;
+	glm::mat4 model;
+
+	// Arena, index type and primitive mode are fixed for one glMultiDrawElementsIndirect
+	bool SameBucket(const MultiDrawRecord& record) const
+	{
+		return material == record.material
+			&& mesh->GetFormat() == record.mesh->GetFormat()
+			&& mesh->GetIndexMode() == record.mesh->GetIndexMode()
+			&& mesh->GetIndexGroup(lod).type == record.mesh->GetIndexGroup(record.lod).type;
+	}
+
+	bool operator<(const MultiDrawRecord& record) const
+	{
+		if (material != record.material)
+			return material < record.material;
+		if (mesh->GetFormat() != record.mesh->GetFormat())
+			return mesh->GetFormat() < record.mesh->GetFormat();
+		if (mesh->GetIndexMode() != record.mesh->GetIndexMode())
+			return mesh->GetIndexMode() < record.mesh->GetIndexMode();
+		return mesh->GetIndexGroup(lod).type < record.mesh->GetIndexGroup(record.lod).type;
+	}
+} MultiDrawRecord;
+
+// Turns the draws of a pass into indirect commands over the shared geometry arenas.
+// The per-draw data lives in the instance stream: every command's baseInstance points
+// at its InstanceData, so the shaders read it as instance attributes without
+// ARB_shader_draw_parameters. Packed meshes fold their position decoding into that
+// model matrix, which lets meshes with different bounds share a call.
+class MultiDrawBackend
+{
+private:
+	std::vector<MultiDrawRecord> draws;
+	std::vector<InstanceData> instances;
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<GLuint> bucketCommands;	// first command of every bucket, plus the end
+
+	GLuint drawCalls;
+	GLuint drawCommands;
+
+	void Draw(const MultiDrawRecord& first, GLuint ringBuffer, GLuint instanceOffset, GLuint commandOffset, GLuint firstCommand, GLuint numCommands)
+	{
+		GeometryArena& arena = GeometryArena::Get(first.mesh->GetFormat());
+		const IndexGroup& group = first.mesh->GetIndexGroup(first.lod);
+		GLenum mode = first.mesh->GetIndexMode();
+
+		arena.Bind();
+		arena.BindInstances(ringBuffer, instanceOffset);
+		glUniform1i(VERTEX_DECODE_LOCATION::OCT_ENCODED, first.mesh->GetFormat() == VERTEX_FORMAT_PACKED);
+		if (mode == GL_TRIANGLE_STRIP)
+		{
+			glEnable(GL_PRIMITIVE_RESTART);
+			glPrimitiveRestartIndex(group.restartIndex);
+		}
+
+		if (GLEW_ARB_multi_draw_indirect)
+			glMultiDrawElementsIndirect(mode, group.type, (const GLvoid*)((size_t)commandOffset + firstCommand * sizeof(DrawElementsIndirectCommand)), numCommands, 0);
+		else
+		{
+			for (GLuint c = firstCommand; c < firstCommand + numCommands; ++c)
+			{
+				const DrawElementsIndirectCommand& command = commands[c];
+				glDrawElementsInstancedBaseVertexBaseInstance(mode, command.count, group.type, (const GLvoid*)((size_t)command.firstIndex * group.IndexSize()),
+					command.instanceCount, command.baseVertex, command.baseInstance);
+			}
+		}
+
+		if (mode == GL_TRIANGLE_STRIP)
+			glDisable(GL_PRIMITIVE_RESTART);
+		glUniform1i(VERTEX_DECODE_LOCATION::OCT_ENCODED, false);
+		arena.UnbindInstances();
+		arena.Unbind();
+		drawCalls++;
+	}
+
+public:
+	MultiDrawBackend() : drawCalls(0), drawCommands(0) { }
+
+	void Submit(Mesh& mesh, Material& material, GLuint lod, const glm::mat4& model)
+	{
+		MultiDrawRecord record;
+		record.mesh		= &mesh;
+		record.material = &material;
+		record.lod		= lod;
+		record.model	= model;
+		draws.push_back(record);
+	}
+
+	// Draws and clears the submitted draws with shader, which must be in use, one call per bucket.
+	// The PerDraw block should hold the identity; textures stay the caller's.
+	void Flush(UniformRing& ring, const Shader& shader)
+	{
+		if (draws.empty())
+			return;
+
+		std::stable_sort(draws.begin(), draws.end());
+
+		instances.clear();
+		commands.clear();
+		bucketCommands.clear();
+		for (GLuint d = 0; d < draws.size(); ++d)
+		{
+			const MultiDrawRecord& draw = draws[d];
+			if (d == 0 || !draw.SameBucket(draws[d - 1]))
+				bucketCommands.push_back(commands.size());
+
+			// The decode scales positions only; normals are decoded unit vectors and take the object's transform
+			instances.push_back(InstanceData(draw.model * draw.mesh->GetDecodeMatrix(), glm::inverseTranspose(glm::mat3(draw.model)), 0));
+
+			// Segments keep their own base vertex, so 16-bit LODs become several commands
+			const IndexGroup& group = draw.mesh->GetIndexGroup(draw.lod);
+			for (GLuint s = group.firstSegment; s < group.firstSegment + group.numSegments; ++s)
+			{
+				const IndexSegment& segment = draw.mesh->GetIndexSegment(s);
+				if (segment.numIndices == 0)
+					continue;
+
+				DrawElementsIndirectCommand command;
+				command.count		  = segment.numIndices;
+				command.instanceCount = 1;
+				command.firstIndex	  = (GLuint)((size_t)group.Offset(segment.firstIndex) / group.IndexSize());
+				command.baseVertex	  = segment.baseVertex;
+				command.baseInstance  = d;
+				commands.push_back(command);
+			}
+		}
+		bucketCommands.push_back(commands.size());
+
+		GLuint instanceOffset = ring.Write(&instances[0], instances.size() * sizeof(InstanceData));
+		GLuint commandOffset  = commands.empty() ? 0 : ring.Write(&commands[0], commands.size() * sizeof(DrawElementsIndirectCommand));
+
+		GLState::Get().BindBuffer(GL_DRAW_INDIRECT_BUFFER, ring.GetBuffer());
+
+		Material* material = NULL;
+		GLuint firstDraw = 0;
+		for (GLuint b = 0; b + 1 < bucketCommands.size(); ++b)
+		{
+			const MultiDrawRecord& first = draws[firstDraw];
+			if (first.material != material)
+			{
+				material = first.material;
+				material->Use(shader);
+			}
+
+			GLuint numCommands = bucketCommands[b + 1] - bucketCommands[b];
+			if (numCommands > 0)
+				Draw(first, ring.GetBuffer(), instanceOffset, commandOffset, bucketCommands[b], numCommands);
+			drawCommands += numCommands;
+
+			while (firstDraw < draws.size() && draws[firstDraw].SameBucket(first))
+				firstDraw++;
+		}
+
+		draws.clear();
+	}
+
+	void ResetStatistics() { drawCalls = drawCommands = 0; }
+	GLuint GetDrawCalls() const { return drawCalls; }
+	GLuint GetDrawCommands() const { return drawCommands; }
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef PIPELINE_STATE_H
+#define PIPELINE_STATE_H
+
+#include <cstddef>
+#include <unordered_map>
+
+#include <GL/glew.h>
+
+// Fixed function state of a draw. Defaults are GL's, except that depth
+// testing and back-face culling are on.
+typedef struct PipelineStateDesc
+{
+	bool blend;
+	GLenum blendSrc;
+	GLenum blendDst;
+
+	bool depthTest;
+	bool depthWrite;
+	GLenum depthFunc;
+
+	bool stencilTest;
+	GLenum stencilFunc;
+	GLint stencilRef;
+	GLuint stencilReadMask;
+	GLuint stencilWriteMask;
+	GLenum stencilFail;
+	GLenum stencilDepthFail;
+	GLenum stencilPass;
+
+	GLenum cullFace;	// GL_NONE draws both sides
+	GLenum frontFace;
+	bool colorWrite;
+
+	PipelineStateDesc() :
+		blend(false), blendSrc(GL_ONE), blendDst(GL_ZERO),
+		depthTest(true), depthWrite(true), depthFunc(GL_LESS),
+		stencilTest(false), stencilFunc(GL_ALWAYS), stencilRef(0), stencilReadMask(0xFF), stencilWriteMask(0xFF),
+		stencilFail(GL_KEEP), stencilDepthFail(GL_KEEP), stencilPass(GL_KEEP),
+		cullFace(GL_BACK), frontFace(GL_CCW), colorWrite(true) { }
+
+	bool operator==(const PipelineStateDesc& desc) const
+	{
+		return blend == desc.blend && blendSrc == desc.blendSrc && blendDst == desc.blendDst
+			&& depthTest == desc.depthTest && depthWrite == desc.depthWrite && depthFunc == desc.depthFunc
+			&& stencilTest == desc.stencilTest && stencilFunc == desc.stencilFunc && stencilRef == desc.stencilRef
+			&& stencilReadMask == desc.stencilReadMask && stencilWriteMask == desc.stencilWriteMask
+			&& stencilFail == desc.stencilFail && stencilDepthFail == desc.stencilDepthFail && stencilPass == desc.stencilPass
+			&& cullFace == desc.cullFace && frontFace == desc.frontFace && colorWrite == desc.colorWrite;
+	}
+
+	// FNV-1a over the fields
+	size_t Hash() const
+	{
+		const GLuint FIELDS[] = { blend, blendSrc, blendDst, depthTest, depthWrite, depthFunc,
+			stencilTest, stencilFunc, (GLuint)stencilRef, stencilReadMask, stencilWriteMask, stencilFail, stencilDepthFail, stencilPass,
+			cullFace, frontFace, colorWrite };
+		size_t hash = 2166136261u;
+		for (GLuint i = 0; i < sizeof(FIELDS) / sizeof(FIELDS[0]); ++i)
+			hash = (hash ^ FIELDS[i]) * 16777619u;
+		return hash;
+	}
+} PipelineStateDesc;
+
+typedef struct PipelineStateHash
+{
+	size_t operator()(const PipelineStateDesc& desc) const { return desc.Hash(); }
+} PipelineStateHash;
+
+// Immutable, interned fixed function state. Equal descriptions share one
+// object, so draws compare their state by pointer; GLState applies it by
+// diffing against the state applied last.
+class PipelineState
+{
+private:
+	PipelineStateDesc desc;
+	GLuint id;
+
+	PipelineState(const PipelineStateDesc& desc, GLuint id) : desc(desc), id(id) { }
+	PipelineState(const PipelineState&);
+	PipelineState& operator=(const PipelineState&);
+
+	typedef std::unordered_map<PipelineStateDesc, PipelineState*, PipelineStateHash> Cache;
+
+	static Cache& GetCache()
+	{
+		static Cache cache;
+		return cache;
+	}
+
+public:
+	// Returns the state object of desc, creating it the first time
+	static const PipelineState& Get(const PipelineStateDesc& desc)
+	{
+		Cache& cache = GetCache();
+		Cache::iterator it = cache.find(desc);
+		if (it == cache.end())
+			it = cache.insert(std::make_pair(desc, new PipelineState(desc, cache.size()))).first;
+		return *it->second;
+	}
+
+	const PipelineStateDesc& GetDesc() const { return desc; }
+	GLuint GetId() const { return id; }
+};
+
+#endif
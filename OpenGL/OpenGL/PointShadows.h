@@ -0,0 +1,347 @@
+#ifndef POINT_SHADOWS_H
+#define POINT_SHADOWS_H
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLState.h"
+#include "Light.h"
+#include "ShadowCache.h"
+#include "ShadowAtlas.h"
+
+// Cubes of the depth array; the least important shadowed lights past it go without
+const GLuint POINT_SHADOW_MAX_LIGHTS = 8;
+const GLuint POINT_SHADOW_FACES = 6;
+const GLuint POINT_SHADOW_RESOLUTION = 512;
+// Cube faces redrawn per frame, across every light
+const GLuint POINT_SHADOW_FACE_BUDGET = 6;
+const GLfloat POINT_SHADOW_NEAR = 0.1f;
+// Depth bias, as a fraction of the fragment's distance to the light
+const GLfloat POINT_SHADOW_DEPTH_BIAS = 0.02f;
+
+// std140 mirror of the PointShadowFaces block of the point shadow geometry shader
+typedef struct PointShadowUniforms
+{
+	glm::mat4 faceViewProjection[POINT_SHADOW_FACES];
+	GLint firstLayer;	// of the light's cube
+	GLint faceMask;		// faces every triangle of the draw is copied to
+	GLint padding[2];
+} PointShadowUniforms;
+
+// A cube of the array and the light whose shadows it holds
+typedef struct PointShadowSlot
+{
+	GLint light;		// -1 while free
+	GLfloat importance;
+	glm::vec3 position;
+	GLfloat farPlane;
+	glm::mat4 viewProjections[POINT_SHADOW_FACES];
+	ShadowCache faces[POINT_SHADOW_FACES];
+	GLuint waiting[POINT_SHADOW_FACES];	// frames each stale face has gone without a redraw
+	GLuint due;			// faces redrawn this frame, as a mask
+	GLuint clear;		// faces to clear before they are redrawn
+} PointShadowSlot;
+
+// Omnidirectional shadows of point lights in the cubes of one depth cube map array.
+// Redrawing six faces per light per frame is what this avoids: every face keeps a
+// ShadowCache of the casters it was drawn with and only turns stale when its light
+// moves or a caster changes inside its frustum. Of the stale faces, a frame redraws
+// at most the face budget, most important light and longest wait first, and all
+// faces due for one light in a single layered pass. A face that waits is shaded
+// with what it last held.
+class PointShadows
+{
+private:
+	GLuint framebuffer;		// every layer, for layered draws
+	GLuint faceFramebuffer;	// one layer at a time, for clears
+	GLuint depthTex;
+	GLuint resolution;
+	ShadowDepthFormat format;
+	GLuint faceBudget;
+
+	PointShadowSlot slots[POINT_SHADOW_MAX_LIGHTS];
+	std::vector<GLint> lightSlots;	// by point light, -1 for none
+
+	GLuint updatedFaces;
+	GLuint staleFaces;
+
+	PointShadows(const PointShadows&);
+	PointShadows& operator=(const PointShadows&);
+
+	void Allocate()
+	{
+		GLState::Get().BindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, depthTex);
+		glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GetShadowInternalFormat(format), resolution, resolution,
+			POINT_SHADOW_MAX_LIGHTS * POINT_SHADOW_FACES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		GLState::Get().BindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+		// Every light takes a cube anew, which clears it
+		for (GLuint i = 0; i < POINT_SHADOW_MAX_LIGHTS; ++i)
+			slots[i].light = -1;
+		lightSlots.clear();
+	}
+
+	// Gives the light a free cube, whose faces all have to be cleared and drawn
+	void Assign(GLuint slot, GLuint light)
+	{
+		PointShadowSlot& s = slots[slot];
+		s.light = light;
+		s.clear = (1 << POINT_SHADOW_FACES) - 1;
+		for (GLuint f = 0; f < POINT_SHADOW_FACES; ++f)
+		{
+			s.faces[f].Invalidate();
+			s.waiting[f] = 0;
+		}
+	}
+
+public:
+	PointShadows() : resolution(POINT_SHADOW_RESOLUTION), format(SHADOW_DEPTH_32), faceBudget(POINT_SHADOW_FACE_BUDGET),
+		updatedFaces(0), staleFaces(0)
+	{
+		for (GLuint i = 0; i < POINT_SHADOW_MAX_LIGHTS; ++i)
+		{
+			slots[i].light = -1;
+			slots[i].due = slots[i].clear = 0;
+		}
+
+		// Filters reaching over the edge of a face read the neighbouring face
+		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+		glGenTextures(1, &depthTex);
+		GLState::Get().BindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, depthTex);
+		SetShadowSampling(GL_TEXTURE_CUBE_MAP_ARRAY);
+		Allocate();
+
+		glGenFramebuffers(1, &framebuffer);
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::POINT_SHADOWS:: Framebuffer is not complete!" << std::endl;
+
+		glGenFramebuffers(1, &faceFramebuffer);
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, faceFramebuffer);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex, 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::POINT_SHADOWS:: Face framebuffer is not complete!" << std::endl;
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// Reallocates the array; every light's cube is cleared and redrawn
+	void SetResolution(GLuint resolution, ShadowDepthFormat format)
+	{
+		this->resolution = resolution;
+		this->format	 = format;
+		Allocate();
+	}
+
+	void SetFaceBudget(GLuint faces) { faceBudget = std::max(faces, 1u); }
+
+	// Gives the most important of the lights that cast shadows a cube, keeping the cubes
+	// of those that had one, and places the faces of each cube at its light
+	void Layout(const std::vector<PointLight>& lights, const glm::vec3& eye)
+	{
+		std::vector<std::pair<GLfloat, GLuint> > ranked;
+		for (GLuint i = 0; i < lights.size(); ++i)
+		{
+			if (lights[i].CastsShadows())
+				ranked.push_back(std::make_pair(-lights[i].GetImportance(eye), i));
+		}
+		std::sort(ranked.begin(), ranked.end());
+		if (ranked.size() > POINT_SHADOW_MAX_LIGHTS)
+			ranked.resize(POINT_SHADOW_MAX_LIGHTS);
+
+		std::vector<GLint> assigned(lights.size(), -1);
+		bool kept[POINT_SHADOW_MAX_LIGHTS] = { false };
+		for (GLuint i = 0; i < ranked.size(); ++i)
+		{
+			GLuint light = ranked[i].second;
+			if (light < lightSlots.size() && lightSlots[light] >= 0)
+			{
+				assigned[light] = lightSlots[light];
+				kept[lightSlots[light]] = true;
+			}
+		}
+		for (GLuint s = 0; s < POINT_SHADOW_MAX_LIGHTS; ++s)
+		{
+			if (!kept[s])
+				slots[s].light = -1;
+		}
+		for (GLuint i = 0, s = 0; i < ranked.size(); ++i)
+		{
+			GLuint light = ranked[i].second;
+			if (assigned[light] >= 0)
+				continue;
+			while (slots[s].light >= 0)
+				s++;
+			Assign(s, light);
+			assigned[light] = s;
+		}
+		lightSlots.swap(assigned);
+
+		// Faces in the order of the layers of a cube map
+		const glm::vec3 DIRECTIONS[POINT_SHADOW_FACES] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+			glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+		const glm::vec3 UPS[POINT_SHADOW_FACES] = { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+			glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+
+		for (GLuint s = 0; s < POINT_SHADOW_MAX_LIGHTS; ++s)
+		{
+			PointShadowSlot& slot = slots[s];
+			if (slot.light < 0)
+				continue;
+
+			const PointLight& light = lights[slot.light];
+			glm::vec3 position = light.GetPosition();
+			slot.position	= position;
+			slot.importance	= light.GetImportance(eye);
+			slot.farPlane	= std::max(light.GetBounds(false).radius, 2.0f * POINT_SHADOW_NEAR);
+			glm::mat4 projection = GetProjection(s);
+			for (GLuint f = 0; f < POINT_SHADOW_FACES; ++f)
+				slot.viewProjections[f] = projection * glm::lookAt(position, position + DIRECTIONS[f], UPS[f]);
+		}
+	}
+
+	// Starts listing the frame's casters for every face
+	void Begin()
+	{
+		for (GLuint s = 0; s < POINT_SHADOW_MAX_LIGHTS; ++s)
+		{
+			slots[s].due = 0;
+			if (slots[s].light < 0)
+				continue;
+			for (GLuint f = 0; f < POINT_SHADOW_FACES; ++f)
+				slots[s].faces[f].Begin(slots[s].viewProjections[f]);
+		}
+	}
+
+	// Lists a caster of the frame with every face of the cube; those outside a face's
+	// frustum, which ends at the light's range, neither dirty nor are drawn into it.
+	// Each cube has its own list, with the LODs chosen for its light.
+	void AddCaster(GLuint slot, const Mesh& mesh, GLuint lod, const glm::mat4& model)
+	{
+		for (GLuint f = 0; f < POINT_SHADOW_FACES; ++f)
+			slots[slot].faces[f].AddCaster(mesh, lod, model);
+	}
+
+	// Picks the stale faces redrawn this frame, up to the face budget, by their light's
+	// importance times the frames they have waited; their caches take the frame's casters
+	void Update()
+	{
+		std::vector<std::pair<GLfloat, GLuint> > stale;
+		for (GLuint s = 0; s < POINT_SHADOW_MAX_LIGHTS; ++s)
+		{
+			PointShadowSlot& slot = slots[s];
+			if (slot.light < 0)
+				continue;
+			for (GLuint f = 0; f < POINT_SHADOW_FACES; ++f)
+			{
+				if (!slot.faces[f].IsStale())
+				{
+					slot.waiting[f] = 0;
+					continue;
+				}
+				slot.waiting[f]++;
+				stale.push_back(std::make_pair(-slot.importance * slot.waiting[f], s * POINT_SHADOW_FACES + f));
+			}
+		}
+		std::sort(stale.begin(), stale.end());
+
+		updatedFaces = std::min((GLuint)stale.size(), faceBudget);
+		staleFaces	 = stale.size() - updatedFaces;
+		for (GLuint i = 0; i < updatedFaces; ++i)
+		{
+			PointShadowSlot& slot = slots[stale[i].second / POINT_SHADOW_FACES];
+			GLuint f = stale[i].second % POINT_SHADOW_FACES;
+			slot.faces[f].Update();
+			slot.waiting[f] = 0;
+			slot.due |= 1 << f;
+		}
+	}
+
+	// Clears the faces of the cube that are due or were just assigned; the caller lets
+	// depth be written and sets the viewport
+	void Clear(GLuint slot)
+	{
+		PointShadowSlot& s = slots[slot];
+		GLuint faces = s.due | s.clear;
+		if (!faces)
+			return;
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, faceFramebuffer);
+		for (GLuint f = 0; f < POINT_SHADOW_FACES; ++f)
+		{
+			if (faces & (1 << f))
+			{
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex, 0, slot * POINT_SHADOW_FACES + f);
+				glClear(GL_DEPTH_BUFFER_BIT);
+			}
+		}
+		s.clear = 0;
+	}
+
+	// Draws into every layer; the geometry shader picks them
+	void Bind() { GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, framebuffer); }
+
+	// Faces of the cube that its caster i, in the order of AddCaster, reaches among those due
+	GLuint GetCasterFaces(GLuint slot, GLuint i) const
+	{
+		const PointShadowSlot& s = slots[slot];
+		GLuint faces = 0;
+		for (GLuint f = 0; f < POINT_SHADOW_FACES; ++f)
+		{
+			if ((s.due & (1 << f)) && s.faces[f].IsVisible(i))
+				faces |= 1 << f;
+		}
+		return faces;
+	}
+
+	void Write(GLuint slot, GLuint faceMask, PointShadowUniforms& uniforms) const
+	{
+		for (GLuint f = 0; f < POINT_SHADOW_FACES; ++f)
+			uniforms.faceViewProjection[f] = slots[slot].viewProjections[f];
+		uniforms.firstLayer = slot * POINT_SHADOW_FACES;
+		uniforms.faceMask	= faceMask;
+	}
+
+	// Fills in the shadow of a light that has a cube
+	void WriteLight(GLuint light, PointLightUniforms& uniforms) const
+	{
+		if (light >= lightSlots.size() || lightSlots[light] < 0)
+			return;
+		uniforms.shadowIndex = lightSlots[light];
+		uniforms.shadowNear	 = POINT_SHADOW_NEAR;
+		uniforms.shadowFar	 = slots[lightSlots[light]].farPlane;
+		uniforms.shadowBias	 = POINT_SHADOW_DEPTH_BIAS;
+	}
+
+	bool HasLight(GLuint slot) const { return slots[slot].light >= 0; }
+
+	// Of every face of the cube; the faces share the light's position and differ in direction
+	glm::mat4 GetProjection(GLuint slot) const { return glm::perspective(glm::radians(90.0f), 1.0f, POINT_SHADOW_NEAR, slots[slot].farPlane); }
+	glm::mat4 GetView(GLuint slot) const { return glm::translate(glm::mat4(1.0f), -slots[slot].position); }
+
+	GLuint GetDueFaces(GLuint slot) const { return slots[slot].due; }
+	GLuint GetResolution() const { return resolution; }
+	GLuint GetTexture() const { return depthTex; }
+
+	// Faces redrawn in the last Update, and those it left stale for later frames
+	GLuint GetUpdatedFaces() const { return updatedFaces; }
+	GLuint GetStaleFaces() const { return staleFaces; }
+
+	~PointShadows()
+	{
+		glDeleteFramebuffers(1, &faceFramebuffer);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(1, &depthTex);
+	}
+};
+
+#endif
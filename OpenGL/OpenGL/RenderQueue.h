@@ -0,0 +1,201 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <map>
+#include <vector>
+#include <cstring>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "Mesh.h"
+#include "Material.h"
+#include "Texture.h"
+#include "TextureUnit.h"
+#include "PipelineState.h"
+
+// Passes run in this order; each one has its own fixed function state
+enum RenderPass
+{
+	RENDER_PASS_SHADOW = 0,				// depth of the shadow casters, queued on its own
+	RENDER_PASS_REFLECTION_MASK,		// stencil of the floor
+	RENDER_PASS_REFLECTION,				// mirrored scene inside the stencil
+	RENDER_PASS_OPAQUE,
+	RENDER_PASS_TRANSPARENT,			// blended, back to front
+	RENDER_PASS_SKYBOX,
+	NUM_RENDER_PASSES
+};
+
+enum RenderDraw
+{
+	RENDER_DRAW_ELEMENTS = 0,	// Mesh::DrawElements
+	RENDER_DRAW_CLUSTERS,		// through the cluster culler
+	RENDER_DRAW_ARRAYS,			// Mesh::DrawArrays
+	RENDER_DRAW_INSTANCED,		// gathered by the instance batcher
+	RENDER_DRAW_MULTI			// gathered by the multi-draw backend
+};
+
+typedef struct RenderItem
+{
+	RenderPass pass;
+	RenderDraw draw;
+	const PipelineState* pipeline;
+	Shader* shader;
+	Material* material;	// NULL leaves the material uniforms alone
+	Texture* diffuse;	// NULL leaves the unit alone
+	Texture* normal;
+	Mesh* mesh;
+	GLuint lod;
+	glm::mat4 model;
+	glm::mat4 inverseTranspose;
+} RenderItem;
+
+// Key bits, most significant first. Transparent items put the depth right after
+// the pass so they are drawn back to front; other passes sort it last, front to back.
+const GLuint RENDER_KEY_PASS_BITS	  = 3;
+const GLuint RENDER_KEY_PIPELINE_BITS = 4;
+const GLuint RENDER_KEY_PROGRAM_BITS  = 8;
+const GLuint RENDER_KEY_MATERIAL_BITS = 8;
+const GLuint RENDER_KEY_TEXTURES_BITS = 9;
+const GLuint RENDER_KEY_MESH_BITS	  = 8;
+const GLuint RENDER_KEY_DEPTH_BITS	  = 24;
+
+// Collects the draws of a frame, encodes their state into 64-bit keys and
+// radix sorts them, so consecutive items share as much state as possible.
+class RenderQueue
+{
+private:
+	std::vector<RenderItem> items;
+	std::vector<unsigned long long> keys;
+	std::vector<unsigned long long> sortedKeys;
+	std::vector<GLuint> order;
+	std::vector<GLuint> sortedOrder;
+
+	// Small ids for the state objects, stable for the lifetime of the queue
+	std::map<const void*, GLuint> pipelineIds;
+	std::map<const void*, GLuint> programIds;
+	std::map<const void*, GLuint> materialIds;
+	std::map<std::pair<const void*, const void*>, GLuint> textureIds;
+	std::map<const void*, GLuint> meshIds;
+
+	template <typename T>
+	static GLuint Intern(std::map<T, GLuint>& ids, const T& object, GLuint bits)
+	{
+		typename std::map<T, GLuint>::iterator it = ids.find(object);
+		if (it != ids.end())
+			return it->second;
+
+		GLuint id = ids.size() & ((1 << bits) - 1);
+		ids[object] = id;
+		return id;
+	}
+
+	// Top bits of the float; positive floats sort like their bit patterns
+	static unsigned long long QuantizeDepth(GLfloat depth)
+	{
+		GLuint bits;
+		depth = glm::max(depth, 0.0f);
+		memcpy(&bits, &depth, sizeof(GLuint));
+		return bits >> (32 - RENDER_KEY_DEPTH_BITS);
+	}
+
+	unsigned long long EncodeKey(const RenderItem& item, GLfloat depth)
+	{
+		unsigned long long pipeline = Intern(pipelineIds, (const void*)item.pipeline, RENDER_KEY_PIPELINE_BITS);
+		unsigned long long program  = Intern(programIds, (const void*)item.shader, RENDER_KEY_PROGRAM_BITS);
+		unsigned long long material = Intern(materialIds, (const void*)item.material, RENDER_KEY_MATERIAL_BITS);
+		unsigned long long textures = Intern(textureIds, std::make_pair((const void*)item.diffuse, (const void*)item.normal), RENDER_KEY_TEXTURES_BITS);
+		unsigned long long mesh		= Intern(meshIds, (const void*)item.mesh, RENDER_KEY_MESH_BITS);
+
+		unsigned long long state = pipeline;
+		state = (state << RENDER_KEY_PROGRAM_BITS) | program;
+		state = (state << RENDER_KEY_MATERIAL_BITS) | material;
+		state = (state << RENDER_KEY_TEXTURES_BITS) | textures;
+		state = (state << RENDER_KEY_MESH_BITS) | mesh;
+
+		const GLuint STATE_BITS = RENDER_KEY_PIPELINE_BITS + RENDER_KEY_PROGRAM_BITS + RENDER_KEY_MATERIAL_BITS + RENDER_KEY_TEXTURES_BITS + RENDER_KEY_MESH_BITS;
+		unsigned long long key = (unsigned long long)item.pass << (STATE_BITS + RENDER_KEY_DEPTH_BITS);
+		if (item.pass == RENDER_PASS_TRANSPARENT)
+			return key | ((((1ULL << RENDER_KEY_DEPTH_BITS) - 1) - QuantizeDepth(depth)) << STATE_BITS) | state;
+		return key | (state << RENDER_KEY_DEPTH_BITS) | QuantizeDepth(depth);
+	}
+
+	// LSD radix sort on bytes, skipping bytes every key shares
+	void RadixSort()
+	{
+		GLuint count = keys.size();
+		sortedKeys.resize(count);
+		sortedOrder.resize(count);
+
+		for (GLuint shift = 0; shift < 64; shift += 8)
+		{
+			GLuint histogram[257] = { 0 };
+			for (GLuint i = 0; i < count; ++i)
+				histogram[((keys[i] >> shift) & 0xFF) + 1]++;
+			if (histogram[((keys[0] >> shift) & 0xFF) + 1] == count)
+				continue;
+
+			for (GLuint b = 1; b < 257; ++b)
+				histogram[b] += histogram[b - 1];
+			for (GLuint i = 0; i < count; ++i)
+			{
+				GLuint slot = histogram[(keys[i] >> shift) & 0xFF]++;
+				sortedKeys[slot]  = keys[i];
+				sortedOrder[slot] = order[i];
+			}
+			keys.swap(sortedKeys);
+			order.swap(sortedOrder);
+		}
+	}
+
+public:
+	// depth is the distance of the item from the viewer
+	void Submit(const RenderItem& item, GLfloat depth)
+	{
+		items.push_back(item);
+		keys.push_back(EncodeKey(item, depth));
+		order.push_back(order.size());
+	}
+
+	// Sorts the submitted items; read them with GetCount and Get until Clear
+	void Sort()
+	{
+		if (!keys.empty())
+			RadixSort();
+	}
+
+	GLuint GetCount() const { return order.size(); }
+	const RenderItem& Get(GLuint i) const { return items[order[i]]; }
+
+	void Clear()
+	{
+		items.clear();
+		keys.clear();
+		order.clear();
+	}
+};
+
+// State changes made while drawing a queue
+typedef struct RenderStatistics
+{
+	GLuint items;
+	GLuint programChanges;
+	GLuint materialChanges;
+	GLuint textureChanges;
+	GLuint drawCalls;
+
+	RenderStatistics() : items(0), programChanges(0), materialChanges(0), textureChanges(0), drawCalls(0) { }
+
+	RenderStatistics& operator+=(const RenderStatistics& statistics)
+	{
+		items			+= statistics.items;
+		programChanges	+= statistics.programChanges;
+		materialChanges += statistics.materialChanges;
+		textureChanges	+= statistics.textureChanges;
+		drawCalls		+= statistics.drawCalls;
+		return *this;
+	}
+} RenderStatistics;
+
+#endif
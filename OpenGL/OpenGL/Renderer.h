@@ -1,7 +1,9 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <cmath>
 #include <vector>
+#include <cstring>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
@@ -10,19 +12,137 @@
 #include "Shader.h"
 #include "Mesh.h"
 #include "Geometry.h"
+#include "MeshSimplifier.h"
+#include "MeshCache.h"
+#include "MeshClusterizer.h"
 #include "Transformation.h"
 #include "Texture.h"
 #include "CubemapTexture.h"
 #include "Material.h"
 #include "Light.h"
+#include "LightGrid.h"
+#include "ShadowCascades.h"
+#include "PointShadows.h"
+#include "UniformRing.h"
+#include "InstanceBatcher.h"
+#include "MultiDrawBackend.h"
+#include "RenderQueue.h"
+#include "GLState.h"
 
-enum UniformLoc
+// Names resolved through the shaders' uniform tables
+const UniformId VIEW_BLOCK_NAME		= UniformTable::Intern("ViewProjectionLighSpace");
+const UniformId PER_DRAW_BLOCK_NAME = UniformTable::Intern("PerDraw");
+const UniformId LIGHTS_BLOCK_NAME	= UniformTable::Intern("Lights");
+const UniformId POINT_SHADOW_BLOCK_NAME	  = UniformTable::Intern("PointShadowFaces");
+const UniformId POINT_LIGHTS_BLOCK_NAME	  = UniformTable::Intern("PointLights");
+const UniformId SPOT_LIGHTS_BLOCK_NAME	  = UniformTable::Intern("SpotLights");
+const UniformId LIGHT_CLUSTERS_BLOCK_NAME = UniformTable::Intern("LightClusters");
+const UniformId LIGHT_INDICES_BLOCK_NAME  = UniformTable::Intern("LightIndices");
+const UniformId REFLECTION			= UniformTable::Intern("reflection");
+const UniformId DIFFUSE_MAP			= UniformTable::Intern("maps.diffuse");
+const UniformId NORMAL_MAP			= UniformTable::Intern("maps.normal");
+const UniformId SHADOW_MAP			= UniformTable::Intern("maps.shadow");
+const UniformId SHADOW_ATLAS_MAP	= UniformTable::Intern("maps.shadowAtlas");
+const UniformId POINT_SHADOW_MAP	= UniformTable::Intern("maps.pointShadows");
+const UniformId SKYBOX_MAP			= UniformTable::Intern("skyboxTex");
+
+// Uniform block binding points
+enum UniformBlockBinding
+{
+	VIEW_BLOCK = 0,
+	PER_DRAW_BLOCK,
+	LIGHTS_BLOCK,
+	POINT_SHADOW_BLOCK,
+};
+
+// Shader storage block binding points
+enum StorageBlockBinding
+{
+	POINT_LIGHTS_BLOCK = 0,
+	SPOT_LIGHTS_BLOCK,
+	LIGHT_CLUSTERS_BLOCK,
+	LIGHT_INDICES_BLOCK,
+};
+
+// std140 mirror of the ViewProjectionLighSpace block, written once per pass
+typedef struct ViewUniforms
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	ShadowCascadeUniforms shadowCascades;
+	glm::vec4 eyePosition;
+	glm::vec4 lightGrid;	// LightGrid::GetSliceParameters
+} ViewUniforms;
+
+// std140 mirror of the PerDraw block, written before every draw
+typedef struct PerDrawUniforms
+{
+	glm::mat4 model;
+	glm::mat4 inverseTranspose;
+} PerDrawUniforms;
+
+// std140 mirror of the Lights block, shared by every lit program and written
+// once per frame; the reflection pass binds a second copy mirrored in the floor.
+// Point and spot lights go to the PointLights and SpotLights storage buffers.
+typedef struct LightsUniforms
+{
+	DirectionalLightUniforms directionalLight;
+} LightsUniforms;
+
+// Ring ranges of the light data seen from one side of the floor
+typedef struct LightRanges
+{
+	GLuint lights;
+	GLuint pointLights;
+	GLuint pointLightsSize;
+	GLuint spotLights;
+	GLuint spotLightsSize;
+	GLuint clusters;		// of the current view
+	GLuint indices;
+	GLuint indicesSize;
+} LightRanges;
+
+// Largest projected LOD error, in pixels, tolerated before switching to a finer level
+const GLfloat LOD_PIXEL_ERROR = 1.0f;
+// Reflections are seen through the translucent floor and tolerate more
+const GLfloat LOD_REFLECTION_ERROR_SCALE = 4.0f;
+
+// Shadow budgets; none of them depends on the window's size
+enum ShadowQuality
+{
+	SHADOW_QUALITY_LOW = 0,
+	SHADOW_QUALITY_MEDIUM,
+	SHADOW_QUALITY_HIGH,
+	NUM_SHADOW_QUALITIES
+};
+
+typedef struct ShadowBudget
+{
+	GLuint cascadeCount;
+	GLuint cascadeResolution;
+	GLuint atlasSize;
+	GLuint maxLightResolution;	// caps what each light asks of the atlas
+	GLuint pointResolution;		// of the faces of the point lights' cubes
+	GLuint pointFaceBudget;		// cube faces redrawn per frame
+	ShadowDepthFormat format;
+	GLint filterRadius;			// PCF over (2 * filterRadius + 1)^2 hardware 2x2 taps
+} ShadowBudget;
+
+const ShadowBudget SHADOW_BUDGETS[NUM_SHADOW_QUALITIES] =
 {
-	MODEL = 10,	
-	INVERSE_TRANSPOSE,
-	EYE_POSITION = 20,
-	SKYBOX_TEX = 30,
+	{ 2, 1024, 2048, 512,  256, 2, SHADOW_DEPTH_16, 0 },
+	{ 3, 2048, 4096, 1024, 512, 4, SHADOW_DEPTH_16, 1 },
+	{ 4, 2048, 4096, 2048, 512, 6, SHADOW_DEPTH_32, 2 },
 };
+const ShadowQuality DEFAULT_SHADOW_QUALITY = SHADOW_QUALITY_HIGH;
+
+// Depth bias of spot light shadows, in the [0, 1] depth of their maps
+const GLfloat SPOT_SHADOW_DEPTH_BIAS = 0.0002f;
+
+// Switch to VERTEX_FORMAT_FLOAT to compare against the full precision layout
+const VertexFormat LOADED_MESH_VERTEX_FORMAT = VERTEX_FORMAT_PACKED;
+// Switch to INDEX_ENCODING_STRIPS to draw triangle strips with primitive restart
+const IndexEncoding LOADED_MESH_INDEX_ENCODING = INDEX_ENCODING_LIST;
 
 class Renderer
 {
@@ -31,15 +151,17 @@ private:
 	GLuint wndHeight;
 	Camera* camera;	
 
-	static const GLuint NUM_SHADERS = 4;
+	static const GLuint NUM_SHADERS = 6;
 	Shader defaultShader;
 	Shader defaultShaderNM;
 	Shader skyboxShader;
 	Shader reflRefrShader;
+	Shader shadowCasterShader;
+	Shader pointShadowShader;
 
-	static const GLuint NUM_POINT_LIGHTS = 3;
 	DirectionalLight directionalLight;	
-	PointLight pointLights[NUM_POINT_LIGHTS];
+	std::vector<PointLight> pointLights;
+	std::vector<SpotLight> spotLights;
 
 	Mesh cubeMesh;
 	Mesh planeMesh;
@@ -49,6 +171,7 @@ private:
 	Material planeMaterial;
 	Material wallMaterial;
 	Material loadedMeshMaterial;
+	Material shadowCasterMaterial;	// shared by every caster, so batches merge across materials
 
 	Transformation cubeTransformation;
 	Transformation planeTransformation;	
@@ -63,10 +186,52 @@ private:
 	Texture wallDiffuseTex;
 	Texture wallNormalTex;	
 
-	Texture shadowMapTex;
 	CubemapTexture skyboxTex;
 
-	GLuint UBO;
+	UniformRing uniformRing;
+	ViewUniforms viewUniforms;
+	LightGrid lightGrid;
+	LightRanges lightRanges[2];	// by mirrored
+	std::vector<LightBounds> pointLightBounds[2];
+	std::vector<LightBounds> spotLightBounds[2];
+	InstanceBatcher instanceBatcher;
+	MultiDrawBackend multiDrawBackend;
+	RenderQueue renderQueue;
+	RenderStatistics renderStatistics;
+	RenderStatistics shadowStatistics;
+
+	// While set, Submit lists shadow casters in shadowItems instead of queueing
+	bool shadowPass;
+	ShadowQuality shadowQuality;
+	ShadowCascades shadowCascades;
+	ShadowAtlas shadowAtlas;
+	std::vector<ShadowTile> spotShadowTiles;	// by spot light
+	std::vector<ShadowCache> spotShadowCaches;
+	std::vector<glm::mat4> spotShadowProjections;
+	std::vector<glm::mat4> spotShadowViews;
+	std::vector<RenderItem> shadowItems;	// in the caches' caster order
+	std::vector<GLfloat> shadowItemDepths;
+	PointShadows pointShadows;
+	std::vector<RenderItem> pointShadowItems[POINT_SHADOW_MAX_LIGHTS];	// by cube, with the LODs of its light
+	std::vector<GLfloat> pointShadowItemDepths[POINT_SHADOW_MAX_LIGHTS];
+	std::vector<GLuint> pointShadowItemFaces;
+
+	// Every view keeps the hysteresis of its own LODs, so a shadow map's casters do not
+	// change with the camera's
+	static const GLuint NUM_SPHERES = 3;
+	LODState sphereLODs[NUM_SPHERES];
+	LODState reflectedSphereLODs[NUM_SPHERES];
+	LODState cascadeSphereLODs[SHADOW_MAX_CASCADES][NUM_SPHERES];
+	std::vector<LODState> spotShadowSphereLODs;	// NUM_SPHERES by spot light
+	LODState pointShadowSphereLODs[POINT_SHADOW_MAX_LIGHTS][NUM_SPHERES];	// by cube
+	LODState* passSphereLODs;	// those of the pass view
+	glm::vec3 lodEyePosition;
+	GLfloat lodProjectionScale;
+	bool lodOrthographic;
+
+	glm::mat4 projection;
+	glm::mat4 view;
+	ClusterCuller clusterCuller;
 
 	void CompileShaders()
 	{
@@ -74,6 +239,8 @@ private:
 		defaultShaderNM = Shader("./res/shaders/default_shader_nm.vs", "./res/shaders/default_shader_nm.fs", "default_shader_nm");
 		skyboxShader	= Shader("./res/shaders/skybox.vs", "./res/shaders/skybox.fs", "skybox");
 		reflRefrShader	= Shader("./res/shaders/reflective_refractive.vs", "./res/shaders/reflective_refractive.fs", "reflective_refractive");
+		shadowCasterShader = Shader("./res/shaders/shadow_caster.vs", "./res/shaders/shadow_caster.fs", "shadow_caster");
+		pointShadowShader  = Shader("./res/shaders/point_shadow.vs", "./res/shaders/point_shadow.gs", "./res/shaders/shadow_caster.fs", "point_shadow");
 	}
 
 	void SetupLights()
@@ -83,67 +250,40 @@ private:
 			glm::vec3(0.0f, 15.0f, 50.0f));
 		
 		float f = 0.5f;
-		pointLights[0] = PointLight(
+		pointLights.push_back(PointLight(
 			glm::vec3(0.0f), glm::vec3(f, f, 0.0f), glm::vec3(0.0f),
 			glm::vec3(10.0f, 1.0f, 0.0f),
-			1.0f, 0.07f, 0.017f);
-		pointLights[1] = PointLight(
+			1.0f, 0.07f, 0.017f));
+		pointLights.push_back(PointLight(
 			glm::vec3(0.0f), glm::vec3(f, 0.0f, f), glm::vec3(0.0f),
 			glm::vec3(-10.0f, 1.0f, 0.0f),
-			1.0f, 0.07f, 0.017f);
-		pointLights[2] = PointLight(
+			1.0f, 0.07f, 0.017f));
+		pointLights.push_back(PointLight(
 			glm::vec3(0.0f), glm::vec3(0.0f, f, f), glm::vec3(0.0f),
 			glm::vec3(0.0f, 1.0f, -10.0f),
-			1.0f, 0.07f, 0.017f);
-	}
+			1.0f, 0.07f, 0.017f));
+		for (GLuint i = 0; i < pointLights.size(); ++i)
+			pointLights[i].SetCastsShadows(true);
 
-	void ActivateDirectionalLights(Shader& shader)
-	{
-		directionalLight.SetUniforms(shader.GetProgram());
-		shader.Use();
-			directionalLight.Use();
-		shader.Unuse();
-	}
-	
-	void ActivatePointLights(Shader& shader)
-	{
-		for (GLuint i = 0; i < NUM_POINT_LIGHTS; ++i)
-			pointLights[i].SetUniforms(shader.GetProgram(), i);
-		shader.Use();
-			for (int i = 0; i < NUM_POINT_LIGHTS; ++i)
-				pointLights[i].Use();
-		shader.Unuse();
-	}
-	
-	void ActivateSpotLight(Shader& shader)
-	{
-		
-	}
-
-	void AcivateLights(Shader& shader)
-	{
-		ActivateDirectionalLights(shader);
-		ActivatePointLights(shader);
-	}
-
-	void LightsInvertY()
-	{
-		directionalLight.InvertY();
-		for (GLuint i = 0; i < NUM_POINT_LIGHTS; ++i)
-			pointLights[i].InvertY();
+		spotLights.push_back(SpotLight(
+			glm::vec3(0.0f), glm::vec3(f), glm::vec3(f),
+			glm::vec3(0.0f, 25.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+			12.5f, 17.5f));
+		spotLights.back().SetShadowResolution(1024);
 	}
 
 	void LoadMeshes()
 	{
 		std::vector<Vertex> vertices;
 		std::vector<GLuint> indices;
+		std::vector<MeshLOD> lods;
 
 		Geometry::GenerateCube(vertices);
 		cubeMesh	= Mesh(vertices);
 		Geometry::GeneratePlane(30, 30, 2, 2, vertices, indices);
-		planeMesh	= Mesh(vertices, indices);
-		Geometry::GenerateFromFile("./res/objects/sphere.obj", vertices, indices);
-		loadedMesh	= Mesh(vertices, indices);
+		MeshSimplifier::GenerateLODChain(vertices, indices, lods);
+		planeMesh	= Mesh(vertices, indices, lods);
+		loadedMesh	= MeshCache::Load("./res/objects/sphere.obj", LOADED_MESH_VERTEX_FORMAT, LOADED_MESH_INDEX_ENCODING);
 
 		cubeTransformation		 = Transformation();
 		planeTransformation		 = Transformation();
@@ -151,7 +291,7 @@ private:
 		skyboxTransformation	 = Transformation();
 		
 		cubeMaterial		 = Material(glm::vec3(1.0f), glm::vec3(1.0f), glm::vec3(1.0f), 2);
-		planeMaterial		 = Material(glm::vec3(1.0f), glm::vec3(1.0f), glm::vec3(1.0f), 64);
+		planeMaterial		 = Material(glm::vec3(1.0f), glm::vec3(1.0f), glm::vec3(1.0f), 64, GL_NONE);
 		wallMaterial		 = Material(glm::vec3(1.0f), glm::vec3(1.0f), glm::vec3(1.0f), 2);
 		loadedMeshMaterial	 = Material(glm::vec3(1.0f), glm::vec3(1.0f), glm::vec3(1.0f), 128);		
 
@@ -165,261 +305,734 @@ private:
 		skyboxTex		= CubemapTexture("./res/textures/cubemaps/", "jpg");		
 	}
 
+	// Call after loadedMeshTransformation has been placed
+	GLuint SelectSphereLOD(GLuint sphere, bool reflection)
+	{
+		GLfloat pixelError = reflection ? LOD_PIXEL_ERROR * LOD_REFLECTION_ERROR_SCALE : LOD_PIXEL_ERROR;
+		return loadedMesh.SelectLOD(loadedMeshTransformation.GetModel(), lodEyePosition, lodProjectionScale, lodOrthographic, pixelError,
+			reflection ? reflectedSphereLODs[sphere] : passSphereLODs[sphere]);
+	}
+
 	void SetupUniformBufferObjects()
 	{
-		const GLuint BINDING_POINT0 = 0;
-		GLuint UBIndices[NUM_SHADERS];
-		const GLchar* UB_NAME = "ViewProjectionLighSpace";
-		const GLuint PROGRAMS[NUM_SHADERS] = { defaultShader.GetProgram(), defaultShaderNM.GetProgram(), skyboxShader.GetProgram(), reflRefrShader.GetProgram() };  // add the reference to the new shader's program here
-		GLuint i = 0;
-
-		glGenBuffers(1, &UBO);
-		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
-		glBufferData(GL_UNIFORM_BUFFER, 3 * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-		glBindBufferBase(GL_UNIFORM_BUFFER, BINDING_POINT0, UBO);
-		
-		for (i = 0; i < NUM_SHADERS; ++i)
+		Shader* shaders[NUM_SHADERS] = { &defaultShader, &defaultShaderNM, &skyboxShader, &reflRefrShader, &shadowCasterShader, &pointShadowShader };  // add the reference to the new shader here
+
+		for (GLuint i = 0; i < NUM_SHADERS; ++i)
 		{
-			UBIndices[i] = glGetUniformBlockIndex(PROGRAMS[i], UB_NAME);
-			glUniformBlockBinding(PROGRAMS[i], UBIndices[i], BINDING_POINT0);
-		}		
+			GLuint viewIndex	= shaders[i]->GetUniformBlockIndex(VIEW_BLOCK_NAME);
+			GLuint perDrawIndex = shaders[i]->GetUniformBlockIndex(PER_DRAW_BLOCK_NAME);
+			GLuint lightsIndex	= shaders[i]->GetUniformBlockIndex(LIGHTS_BLOCK_NAME);
+			GLuint pointShadowIndex = shaders[i]->GetUniformBlockIndex(POINT_SHADOW_BLOCK_NAME);
+			if (viewIndex != GL_INVALID_INDEX)
+				glUniformBlockBinding(shaders[i]->GetProgram(), viewIndex, UniformBlockBinding::VIEW_BLOCK);
+			if (perDrawIndex != GL_INVALID_INDEX)
+				glUniformBlockBinding(shaders[i]->GetProgram(), perDrawIndex, UniformBlockBinding::PER_DRAW_BLOCK);
+			if (lightsIndex != GL_INVALID_INDEX)
+				glUniformBlockBinding(shaders[i]->GetProgram(), lightsIndex, UniformBlockBinding::LIGHTS_BLOCK);
+			if (pointShadowIndex != GL_INVALID_INDEX)
+				glUniformBlockBinding(shaders[i]->GetProgram(), pointShadowIndex, UniformBlockBinding::POINT_SHADOW_BLOCK);
+
+			const UniformId STORAGE_BLOCKS[] = { POINT_LIGHTS_BLOCK_NAME, SPOT_LIGHTS_BLOCK_NAME, LIGHT_CLUSTERS_BLOCK_NAME, LIGHT_INDICES_BLOCK_NAME };
+			const StorageBlockBinding STORAGE_BINDINGS[] = { POINT_LIGHTS_BLOCK, SPOT_LIGHTS_BLOCK, LIGHT_CLUSTERS_BLOCK, LIGHT_INDICES_BLOCK };
+			for (GLuint j = 0; j < 4 && GLEW_ARB_shader_storage_buffer_object; ++j)
+			{
+				GLuint index = shaders[i]->GetStorageBlockIndex(STORAGE_BLOCKS[j]);
+				if (index != GL_INVALID_INDEX)
+					glShaderStorageBlockBinding(shaders[i]->GetProgram(), index, STORAGE_BINDINGS[j]);
+			}
+		}
 	}
 
-	// For animation	
-	GLfloat dt = 0.0f;
-	
-public:
-	void SetDeltaTime(GLfloat deltaTime) { dt += deltaTime; }
+	// Texture unit of a sampler, -1 for samplers the renderer does not know
+	static GLint GetSamplerUnit(UniformId sampler)
+	{
+		if (sampler == DIFFUSE_MAP)
+			return TEXTURE_UNIT::DIFFUSE_UNIT;
+		if (sampler == NORMAL_MAP)
+			return TEXTURE_UNIT::NORMAL_UNIT;
+		if (sampler == SHADOW_MAP)
+			return TEXTURE_UNIT::SHADOW_UNIT;
+		if (sampler == SHADOW_ATLAS_MAP)
+			return TEXTURE_UNIT::SHADOW_ATLAS_UNIT;
+		if (sampler == POINT_SHADOW_MAP)
+			return TEXTURE_UNIT::POINT_SHADOW_UNIT;
+		if (sampler == SKYBOX_MAP)
+			return TEXTURE_UNIT::SKYBOX_UNIT;
+		return -1;
+	}
 
-	void SetProjectionMatrix(glm::mat4 projection)
+	// Points the samplers every program reports at the fixed texture units
+	void SetupSamplers()
 	{
-		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
-		glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(projection));
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		Shader* shaders[NUM_SHADERS] = { &defaultShader, &defaultShaderNM, &skyboxShader, &reflRefrShader, &shadowCasterShader, &pointShadowShader };
+		for (GLuint i = 0; i < NUM_SHADERS; ++i)
+		{
+			const std::vector<UniformId>& samplers = shaders[i]->GetSamplers();
+			shaders[i]->Use();
+			for (GLuint j = 0; j < samplers.size(); ++j)
+			{
+				GLint unit = GetSamplerUnit(samplers[j]);
+				if (unit < 0)
+					std::cout << "ERROR::RENDERER:: A sampler of shader " << i << " has no texture unit" << std::endl;
+				else
+					glUniform1i(shaders[i]->GetUniformLocation(samplers[j]), unit);
+			}
+			shaders[i]->Unuse();
+		}
 	}
 
-	void SetViewMatrix(glm::mat4 view)
+	// Streams the view constants of the coming pass into the ring
+	void UploadViewUniforms()
 	{
-		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
-		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(view));
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		viewUniforms.eyePosition = glm::vec4(camera->GetEyePos(), 1.0f);
+		uniformRing.Bind(UniformBlockBinding::VIEW_BLOCK, &viewUniforms, sizeof(ViewUniforms));
 	}
 
-	void SetLightSpaceMatrix(glm::mat4 lightSpace) {
-		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
-		glBufferSubData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(lightSpace));
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	// Streams the transformation of the next draw into the ring; instanced
+	// draws multiply it with the model of each instance
+	void UploadDrawUniforms(const glm::mat4& model, const glm::mat4& inverseTranspose)
+	{
+		PerDrawUniforms perDraw;
+		perDraw.model			 = model;
+		perDraw.inverseTranspose = inverseTranspose;
+		uniformRing.Bind(UniformBlockBinding::PER_DRAW_BLOCK, &perDraw, sizeof(PerDrawUniforms));
 	}
 
-	void SetShadowMapTexture(const GLuint& shadowMapTex) { this->shadowMapTex = shadowMapTex; }
+	void UploadDrawUniforms(Transformation& transformation)
+	{
+		UploadDrawUniforms(transformation.GetModel(), transformation.GetInverseTranspose());
+	}
 
-	glm::vec3 GetDirectionalLightPosition() { return directionalLight.GetPosition(); }
-	
-	Renderer(Camera* camera, GLuint wndWidth, GLuint wndHeight)
-	{		
-		this->camera = camera;
-		this->wndWidth = wndWidth;
-		this->wndHeight = wndHeight;
+	void Submit(RenderPass pass, RenderDraw draw, Shader& shader, Material* material, Texture* diffuse, Texture* normal,
+		Mesh& mesh, GLuint lod, Transformation& transformation, bool castsShadow = true)
+	{
+		// Mirrored geometry, the floor's stencil and the skybox cast nothing
+		if (shadowPass && (!castsShadow || (pass != RENDER_PASS_OPAQUE && pass != RENDER_PASS_TRANSPARENT)))
+			return;
 
-		CompileShaders();
-		SetupLights();
-		LoadMeshes();
-		SetupUniformBufferObjects();
+		RenderItem item;
+		item.pass			  = shadowPass ? RENDER_PASS_SHADOW : pass;
+		item.draw			  = draw;
+		item.pipeline		  = &GetPipelineState(item.pass, material);
+		item.shader			  = shadowPass ? &shadowCasterShader : &shader;
+		item.material		  = shadowPass ? &shadowCasterMaterial : material;
+		item.diffuse		  = shadowPass ? NULL : diffuse;
+		item.normal			  = shadowPass ? NULL : normal;
+		item.mesh			  = &mesh;
+		item.lod			  = lod;
+		item.model			  = transformation.GetModel();
+		item.inverseTranspose = transformation.GetInverseTranspose();
+		GLfloat depth = glm::length(glm::vec3(item.model[3]) - camera->GetEyePos());
+		if (shadowPass)
+		{
+			shadowItems.push_back(item);
+			shadowItemDepths.push_back(depth);
+		}
+		else
+			renderQueue.Submit(item, depth);
 	}
-	
-	void RenderScene()
-	{			
-		
-#pragma region Floor reflection
-		// Draw to stencil buffer
-		glEnable(GL_STENCIL_TEST);
-		glDisable(GL_DEPTH_TEST);
-
-		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-		glDepthMask(GL_FALSE);
-		glStencilMask(0xFF);
-		glStencilFunc(GL_ALWAYS, 1, 0xFF);		
-
-		// Floor
-		planeTransformation.Rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-		planeTransformation.Translate(glm::vec3(0.0f, 0.0f, 0.0f));
-		defaultShader.Use();
-			glUniformMatrix4fv(UniformLoc::MODEL, 1, false, glm::value_ptr(planeTransformation.GetModel()));
-			glUniformMatrix4fv(UniformLoc::INVERSE_TRANSPOSE, 1, false, glm::value_ptr(planeTransformation.GetInverseTranspose()));
-			glUniform1i(glGetUniformLocation(defaultShader.GetProgram(), "reflection"), false);
-			planeMesh.DrawElements();
-		defaultShader.Unuse();
-
-		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-		glDepthMask(GL_TRUE);
-		glStencilMask(0x00);
-		glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-
-		// Reflection
-		RenderReflection();
-
-		glEnable(GL_DEPTH_TEST);
-		glDisable(GL_STENCIL_TEST);
-#pragma endregion Floor reflection
-
-		// Lights
-		AcivateLights(defaultShader);
-
-		// Floor
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		planeTransformation.Rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-		planeTransformation.Translate(glm::vec3(0.0f, 0.0f, 0.0f));
-		defaultShader.Use();
-			glUniform3fv(UniformLoc::EYE_POSITION, 1, glm::value_ptr(camera->GetEyePos()));
-			glUniformMatrix4fv(UniformLoc::MODEL, 1, false, glm::value_ptr(planeTransformation.GetModel()));
-			glUniformMatrix4fv(UniformLoc::INVERSE_TRANSPOSE, 1, false, glm::value_ptr(planeTransformation.GetInverseTranspose()));
-			glUniform1i(glGetUniformLocation(defaultShader.GetProgram(), "reflection"), false);
-			planeMaterial.Use(defaultShader.GetProgram());
-			checkeredTex.Use(defaultShader.GetProgram(), "maps.diffuse", 0);
-			shadowMapTex.Use(defaultShader.GetProgram(), "maps.shadow", 3);
-			planeMesh.DrawElements();
-			checkeredTex.Unuse();
-		defaultShader.Unuse();
-		glDisable(GL_BLEND);
-
-		// Center sphere
+
+	// Queues the spheres of one side of the floor
+	void SubmitSpheres(RenderPass pass, GLfloat height, bool reflection)
+	{
 		loadedMeshTransformation.Scale(glm::vec3(50.0f));
-		loadedMeshTransformation.Translate(glm::vec3(0.0f, 5.0f, 0.0f));
-		defaultShader.Use();			
-			glUniform3fv(UniformLoc::EYE_POSITION, 1, glm::value_ptr(camera->GetEyePos()));
-			glUniformMatrix4fv(UniformLoc::MODEL, 1, false, glm::value_ptr(loadedMeshTransformation.GetModel()));
-			glUniformMatrix4fv(UniformLoc::INVERSE_TRANSPOSE, 1, false, glm::value_ptr(loadedMeshTransformation.GetInverseTranspose()));
-			glUniform1i(glGetUniformLocation(defaultShader.GetProgram(), "reflection"), false);
-			loadedMeshMaterial.Use(defaultShader.GetProgram());
-			marbleTex.Use(defaultShader.GetProgram(), "maps.diffuse", 0);
-			shadowMapTex.Use(defaultShader.GetProgram(), "maps.shadow", 3);
-			loadedMesh.DrawElements();
-			marbleTex.Unuse();
-		defaultShader.Unuse();	
-
-		// Lights
-		AcivateLights(reflRefrShader);
-
-		// Reflective/Refractive spheres
-		reflRefrShader.Use();			
-			glUniform3fv(UniformLoc::EYE_POSITION, 1, glm::value_ptr(camera->GetEyePos()));
-		reflRefrShader.Use();
+		loadedMeshTransformation.Translate(glm::vec3(0.0f, height, 0.0f));
+		Submit(pass, RENDER_DRAW_CLUSTERS, defaultShader, &loadedMeshMaterial, &marbleTex, NULL, loadedMesh, SelectSphereLOD(0, reflection), loadedMeshTransformation);
+
+		GLuint sphere = 1;
 		for (GLfloat i = -10.0f; i <= 10.0f; i += 20.0f)
-		{			
+		{
 			loadedMeshTransformation.Scale(glm::vec3(50.0f));
-			loadedMeshTransformation.Translate(glm::vec3(i, 5.0f, 0.0f));
-			reflRefrShader.Use();
-				glUniformMatrix4fv(UniformLoc::MODEL, 1, false, glm::value_ptr(loadedMeshTransformation.GetModel()));
-				glUniformMatrix4fv(UniformLoc::INVERSE_TRANSPOSE, 1, false, glm::value_ptr(loadedMeshTransformation.GetInverseTranspose()));
-				glUniform1i(glGetUniformLocation(reflRefrShader.GetProgram(), "reflection"), false);
-				skyboxTex.Use();
-				marbleTex.Use(reflRefrShader.GetProgram(), "maps.diffuse", 0);
-				shadowMapTex.Use(reflRefrShader.GetProgram(), "maps.shadow", 3);
-				loadedMeshMaterial.Use(reflRefrShader.GetProgram());
-				loadedMesh.DrawElements();
-				skyboxTex.Unuse();
-			reflRefrShader.Unuse();
+			loadedMeshTransformation.Translate(glm::vec3(i, height, 0.0f));
+			Submit(pass, RENDER_DRAW_INSTANCED, reflRefrShader, &loadedMeshMaterial, &marbleTex, NULL, loadedMesh, SelectSphereLOD(sphere++, reflection), loadedMeshTransformation);
 		}
+	}
+
+	void SubmitScene()
+	{
+		// Floor, first into the stencil, then blended over the reflection
+		planeTransformation.Rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+		planeTransformation.Translate(glm::vec3(0.0f, 0.0f, 0.0f));
+		Submit(RENDER_PASS_REFLECTION_MASK, RENDER_DRAW_ELEMENTS, defaultShader, NULL, NULL, NULL, planeMesh, 0, planeTransformation);
+		Submit(RENDER_PASS_TRANSPARENT, RENDER_DRAW_ELEMENTS, defaultShader, &planeMaterial, &checkeredTex, NULL, planeMesh, 0, planeTransformation, false);
 
-		// Lights
-		ActivateDirectionalLights(defaultShaderNM);
+		// Spheres
+		if (!shadowPass)
+			SubmitSpheres(RENDER_PASS_REFLECTION, -5.0f, true);
+		SubmitSpheres(RENDER_PASS_OPAQUE, 5.0f, false);
 
 		// Wall
 		glm::mat4 m1;
-		glm::mat4 m2;		
+		glm::mat4 m2;
 		m1 = glm::rotate(glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 		planeTransformation.Rotate(m1);
 		planeTransformation.Translate(glm::vec3(0.0f, 15.0f, -15.0f));
-		RenderWall();				
+		Submit(RENDER_PASS_OPAQUE, RENDER_DRAW_MULTI, defaultShaderNM, &wallMaterial, &wallDiffuseTex, &wallNormalTex, planeMesh, 0, planeTransformation);
 		m2 = glm::rotate(glm::radians(90.0f), glm::vec3(0.0f, -1.0f, 0.0f));
 		planeTransformation.Rotate(m2 * m1);
-		planeTransformation.Translate(glm::vec3(15.0f, 15.0f, 0.0f));	
-		RenderWall();
+		planeTransformation.Translate(glm::vec3(15.0f, 15.0f, 0.0f));
+		Submit(RENDER_PASS_OPAQUE, RENDER_DRAW_MULTI, defaultShaderNM, &wallMaterial, &wallDiffuseTex, &wallNormalTex, planeMesh, 0, planeTransformation);
 		m2 = glm::rotate(glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 		planeTransformation.Rotate(m2 * m1);
-		planeTransformation.Translate(glm::vec3(-15.0f, 15.0f, 0.0f));		
-		RenderWall();
+		planeTransformation.Translate(glm::vec3(-15.0f, 15.0f, 0.0f));
+		Submit(RENDER_PASS_OPAQUE, RENDER_DRAW_MULTI, defaultShaderNM, &wallMaterial, &wallDiffuseTex, &wallNormalTex, planeMesh, 0, planeTransformation);
 
-		// Skybox		
+		// Skybox
 		skyboxTransformation.Scale(glm::vec3(500.0f));
 		skyboxTransformation.Translate(camera->GetEyePos());
-		skyboxShader.Use();
-			glUniformMatrix4fv(UniformLoc::MODEL, 1, false, glm::value_ptr(skyboxTransformation.GetModel()));
-			glFrontFace(GL_CW);
-			skyboxTex.Use();
-			cubeMesh.DrawArrays();
-			skyboxTex.Unuse();
-			glFrontFace(GL_CCW);
-		skyboxShader.Unuse();
+		Submit(RENDER_PASS_SKYBOX, RENDER_DRAW_ARRAYS, skyboxShader, NULL, NULL, NULL, cubeMesh, 0, skyboxTransformation);
 	}
 
-	void RenderWall()
+	// Gives the spot lights that ask for shadows their atlas tiles, capped by the budget,
+	// and their shadow matrices; a light whose tile moved or resized redraws it whole
+	void LayoutSpotShadows()
 	{
-		defaultShaderNM.Use();
-			glUniform3fv(UniformLoc::EYE_POSITION, 1, glm::value_ptr(camera->GetEyePos()));
-			glUniformMatrix4fv(UniformLoc::MODEL, 1, false, glm::value_ptr(planeTransformation.GetModel()));
-			glUniformMatrix4fv(UniformLoc::INVERSE_TRANSPOSE, 1, false, glm::value_ptr(planeTransformation.GetInverseTranspose()));	
-			glUniform1i(glGetUniformLocation(defaultShaderNM.GetProgram(), "reflection"), false);
-			wallMaterial.Use(defaultShaderNM.GetProgram());
-			wallDiffuseTex.Use(defaultShaderNM.GetProgram(), "maps.diffuse", 0);
-			wallNormalTex.Use(defaultShaderNM.GetProgram(), "maps.normal", 1);
-			shadowMapTex.Use(defaultShaderNM.GetProgram(), "maps.shadow", 3);
-			planeMesh.DrawElements();
-			wallNormalTex.Unuse();
-			wallDiffuseTex.Unuse();
-		defaultShaderNM.Unuse();
+		std::vector<GLuint> requests(spotLights.size());
+		for (GLuint i = 0; i < spotLights.size(); ++i)
+			requests[i] = std::min(spotLights[i].GetShadowResolution(), SHADOW_BUDGETS[shadowQuality].maxLightResolution);
+		std::vector<ShadowTile> tiles;
+		shadowAtlas.Layout(requests, tiles);
+
+		spotShadowCaches.resize(spotLights.size());
+		spotShadowProjections.resize(spotLights.size());
+		spotShadowViews.resize(spotLights.size());
+		spotShadowSphereLODs.resize(spotLights.size() * NUM_SPHERES);
+		for (GLuint i = 0; i < spotLights.size(); ++i)
+		{
+			if (i >= spotShadowTiles.size() || !(tiles[i] == spotShadowTiles[i]))
+				spotShadowCaches[i].Invalidate();
+			spotLights[i].GetShadowMatrices(spotShadowProjections[i], spotShadowViews[i]);
+		}
+		spotShadowTiles.swap(tiles);
 	}
 
-	void RenderReflection()
+	// Streams the light data into the ring twice, as seen and mirrored in the floor,
+	// and keeps the bounds the light grid bins each view with. Reflections are not shadowed.
+	void UploadLights()
 	{
-		// Lights
-		LightsInvertY();
-		AcivateLights(defaultShader);
-		LightsInvertY();
+		LayoutSpotShadows();
+		pointShadows.Layout(pointLights, camera->GetEyePos());
 
-		// Center sphere
-		loadedMeshTransformation.Scale(glm::vec3(50.0f));
-		loadedMeshTransformation.Translate(glm::vec3(0.0f, -5.0f, 0.0f));
-		defaultShader.Use();
-			glUniform3fv(UniformLoc::EYE_POSITION, 1, glm::value_ptr(camera->GetEyePos()));
-			glUniformMatrix4fv(UniformLoc::MODEL, 1, false, glm::value_ptr(loadedMeshTransformation.GetModel()));
-			glUniformMatrix4fv(UniformLoc::INVERSE_TRANSPOSE, 1, false, glm::value_ptr(loadedMeshTransformation.GetInverseTranspose()));
-			glUniform1i(glGetUniformLocation(defaultShader.GetProgram(), "reflection"), true);
-			loadedMeshMaterial.Use(defaultShader.GetProgram());
-			marbleTex.Use(defaultShader.GetProgram(), "maps.diffuse", 0);
-			loadedMesh.DrawElements();
-			marbleTex.Unuse();
-		defaultShader.Unuse();
-
-		// Lights
-		LightsInvertY();
-		AcivateLights(reflRefrShader);
-		LightsInvertY();
-
-		// Reflective/Refractive spheres
-		reflRefrShader.Use();			
-			glUniform3fv(UniformLoc::EYE_POSITION, 1, glm::value_ptr(camera->GetEyePos()));
-		reflRefrShader.Use();
-		for (GLfloat i = -10.0f; i <= 10.0f; i += 20.0f)
-		{			
-			loadedMeshTransformation.Scale(glm::vec3(50.0f));
-			loadedMeshTransformation.Translate(glm::vec3(i, -5.0f, 0.0f));
-			reflRefrShader.Use();
-				glUniformMatrix4fv(UniformLoc::MODEL, 1, false, glm::value_ptr(loadedMeshTransformation.GetModel()));
-				glUniformMatrix4fv(UniformLoc::INVERSE_TRANSPOSE, 1, false, glm::value_ptr(loadedMeshTransformation.GetInverseTranspose()));
-				glUniform1i(glGetUniformLocation(reflRefrShader.GetProgram(), "reflection"), true);
-				skyboxTex.Use();				
-				loadedMeshMaterial.Use(reflRefrShader.GetProgram());
-				loadedMesh.DrawElements();
-				skyboxTex.Unuse();
-			reflRefrShader.Unuse();
+		LightsUniforms lights;
+		std::vector<PointLightUniforms> points(std::max((GLuint)pointLights.size(), 1u));	// a range of zero bytes cannot be bound
+		std::vector<SpotLightUniforms> spots(std::max((GLuint)spotLights.size(), 1u));
+		for (GLuint mirrored = 0; mirrored < 2; ++mirrored)
+		{
+			LightRanges& ranges = lightRanges[mirrored];
+			directionalLight.Write(lights.directionalLight, mirrored != 0);
+			ranges.lights = uniformRing.Write(&lights, sizeof(LightsUniforms));
+
+			pointLightBounds[mirrored].resize(pointLights.size());
+			for (GLuint i = 0; i < pointLights.size(); ++i)
+			{
+				pointLights[i].Write(points[i], mirrored != 0);
+				pointLightBounds[mirrored][i] = pointLights[i].GetBounds(mirrored != 0);
+				if (!mirrored)
+					pointShadows.WriteLight(i, points[i]);
+			}
+			ranges.pointLightsSize = points.size() * sizeof(PointLightUniforms);
+			ranges.pointLights	   = uniformRing.Write(&points[0], ranges.pointLightsSize);
+
+			spotLightBounds[mirrored].resize(spotLights.size());
+			for (GLuint i = 0; i < spotLights.size(); ++i)
+			{
+				spotLights[i].Write(spots[i], mirrored != 0);
+				spotLightBounds[mirrored][i] = spotLights[i].GetBounds(mirrored != 0);
+				if (!mirrored && spotShadowTiles[i].size)
+				{
+					spots[i].shadowMatrix = shadowAtlas.GetTileMatrix(spotShadowTiles[i]) * spotShadowProjections[i] * spotShadowViews[i];
+					spots[i].shadowed	  = 1;
+					spots[i].shadowBias	  = SPOT_SHADOW_DEPTH_BIAS;
+				}
+			}
+			ranges.spotLightsSize = spots.size() * sizeof(SpotLightUniforms);
+			ranges.spotLights	  = uniformRing.Write(&spots[0], ranges.spotLightsSize);
+		}
+	}
+
+	// Bins the lights into the clusters of the coming view, once per side of the floor
+	void UploadLightClusters()
+	{
+		for (GLuint mirrored = 0; mirrored < 2; ++mirrored)
+		{
+			LightRanges& ranges = lightRanges[mirrored];
+			lightGrid.Build(view, pointLightBounds[mirrored], spotLightBounds[mirrored]);
+			const std::vector<LightCluster>& clusters = lightGrid.GetClusters();
+			const std::vector<GLuint>& indices		  = lightGrid.GetIndices();
+			ranges.clusters	   = uniformRing.Write(&clusters[0], clusters.size() * sizeof(LightCluster));
+			ranges.indicesSize = indices.size() * sizeof(GLuint);
+			ranges.indices	   = uniformRing.Write(&indices[0], ranges.indicesSize);
+		}
+	}
+
+	void BindLights(bool mirrored)
+	{
+		const LightRanges& ranges = lightRanges[mirrored];
+		uniformRing.BindRange(GL_UNIFORM_BUFFER, UniformBlockBinding::LIGHTS_BLOCK, ranges.lights, sizeof(LightsUniforms));
+		if (!GLEW_ARB_shader_storage_buffer_object)
+			return;
+		uniformRing.BindRange(GL_SHADER_STORAGE_BUFFER, StorageBlockBinding::POINT_LIGHTS_BLOCK, ranges.pointLights, ranges.pointLightsSize);
+		uniformRing.BindRange(GL_SHADER_STORAGE_BUFFER, StorageBlockBinding::SPOT_LIGHTS_BLOCK, ranges.spotLights, ranges.spotLightsSize);
+		uniformRing.BindRange(GL_SHADER_STORAGE_BUFFER, StorageBlockBinding::LIGHT_CLUSTERS_BLOCK, ranges.clusters, LIGHT_GRID_CLUSTERS * sizeof(LightCluster));
+		uniformRing.BindRange(GL_SHADER_STORAGE_BUFFER, StorageBlockBinding::LIGHT_INDICES_BLOCK, ranges.indices, ranges.indicesSize);
+	}
+
+	// Fixed function state of the draws of a pass; materials choose the culled faces
+	const PipelineState& GetPipelineState(RenderPass pass, const Material* material)
+	{
+		PipelineStateDesc desc;
+		desc.cullFace = material ? material->GetCullFace() : GL_BACK;
+		switch (pass)
+		{
+		case RENDER_PASS_SHADOW:
+			// Depth only; the shadow map has no color buffer and the fragment stage is empty
+			break;
+		case RENDER_PASS_REFLECTION_MASK:
+			// The floor masks its reflection seen from either side
+			desc.cullFace		  = GL_NONE;
+			desc.depthTest		  = false;
+			desc.depthWrite		  = false;
+			desc.colorWrite		  = false;
+			desc.stencilTest	  = true;
+			desc.stencilFunc	  = GL_ALWAYS;
+			desc.stencilRef		  = 1;
+			desc.stencilPass	  = GL_REPLACE;
+			break;
+		case RENDER_PASS_REFLECTION:
+			desc.depthTest		  = false;
+			desc.stencilTest	  = true;
+			desc.stencilFunc	  = GL_NOTEQUAL;
+			desc.stencilRef		  = 1;
+			desc.stencilWriteMask = 0x00;
+			break;
+		case RENDER_PASS_TRANSPARENT:
+			desc.blend	  = true;
+			desc.blendSrc = GL_SRC_ALPHA;
+			desc.blendDst = GL_ONE_MINUS_SRC_ALPHA;
+			break;
+		case RENDER_PASS_SKYBOX:
+			// The cube is seen from inside
+			desc.frontFace = GL_CW;
+			break;
+		default:
+			break;
+		}
+		return PipelineState::Get(desc);
+	}
+
+	// Draws what the instance batcher and the multi-draw backend gathered with the program in use
+	void FlushBatches(Shader& shader)
+	{
+		GLuint drawCalls = instanceBatcher.GetDrawCalls() + multiDrawBackend.GetDrawCalls();
+		UploadDrawUniforms(glm::mat4(1.0f), glm::mat4(1.0f));
+		instanceBatcher.Flush(uniformRing, shader);
+		multiDrawBackend.Flush(uniformRing, shader);
+		renderStatistics.drawCalls += instanceBatcher.GetDrawCalls() + multiDrawBackend.GetDrawCalls() - drawCalls;
+	}
+
+	// Sorts the queue and draws it, changing only the state that differs from the previous item
+	void ExecuteRenderQueue()
+	{
+		renderQueue.Sort();
+		renderStatistics = RenderStatistics();
+		renderStatistics.items = renderQueue.GetCount();
+
+		RenderPass pass = NUM_RENDER_PASSES;
+		const PipelineState* pipeline = NULL;
+		Shader* shader = NULL;
+		Material* material = NULL;
+		Texture* diffuse = NULL;
+		Texture* normal = NULL;
+		bool batched = false;
+		RenderDraw batchedDraw = RENDER_DRAW_ELEMENTS;
+
+		for (GLuint i = 0; i < renderQueue.GetCount(); ++i)
+		{
+			const RenderItem& item = renderQueue.Get(i);
+
+			// A state change or another kind of draw ends the gathered batch
+			bool stateChange = item.pass != pass || item.pipeline != pipeline || item.shader != shader || item.material != material
+				|| (item.diffuse && item.diffuse != diffuse) || (item.normal && item.normal != normal);
+			if (batched && (stateChange || item.draw != batchedDraw))
+			{
+				FlushBatches(*shader);
+				batched = false;
+			}
+
+			if (item.pass != pass)
+			{
+				pass = item.pass;
+				if (pass != RENDER_PASS_SHADOW)
+					BindLights(pass == RENDER_PASS_REFLECTION);
+				shader = NULL;
+			}
+
+			if (item.pipeline != pipeline)
+			{
+				pipeline = item.pipeline;
+				GLState::Get().ApplyPipelineState(*pipeline);
+			}
+
+			if (item.shader != shader)
+			{
+				shader = item.shader;
+				shader->Use();
+				glUniform1i(shader->GetUniformLocation(REFLECTION), pass == RENDER_PASS_REFLECTION);
+				material = NULL;
+				renderStatistics.programChanges++;
+			}
+
+			if (item.material && item.material != material)
+			{
+				material = item.material;
+				material->Use(*shader);
+				renderStatistics.materialChanges++;
+			}
+
+			if (item.diffuse && item.diffuse != diffuse)
+			{
+				diffuse = item.diffuse;
+				diffuse->Bind(TEXTURE_UNIT::DIFFUSE_UNIT);
+				renderStatistics.textureChanges++;
+			}
+			if (item.normal && item.normal != normal)
+			{
+				normal = item.normal;
+				normal->Bind(TEXTURE_UNIT::NORMAL_UNIT);
+				renderStatistics.textureChanges++;
+			}
+
+			switch (item.draw)
+			{
+			case RENDER_DRAW_ELEMENTS:
+				UploadDrawUniforms(item.model, item.inverseTranspose);
+				item.mesh->DrawElements(item.lod);
+				renderStatistics.drawCalls++;
+				break;
+			case RENDER_DRAW_CLUSTERS:
+				UploadDrawUniforms(item.model, item.inverseTranspose);
+				clusterCuller.Draw(*item.mesh, item.model, item.lod);
+				renderStatistics.drawCalls++;
+				break;
+			case RENDER_DRAW_ARRAYS:
+				UploadDrawUniforms(item.model, item.inverseTranspose);
+				item.mesh->DrawArrays();
+				renderStatistics.drawCalls++;
+				break;
+			case RENDER_DRAW_INSTANCED:
+				instanceBatcher.Submit(*item.mesh, *item.material, item.lod, item.model);
+				batched = true;
+				break;
+			case RENDER_DRAW_MULTI:
+				multiDrawBackend.Submit(*item.mesh, *item.material, item.lod, item.model);
+				batched = true;
+				break;
+			}
+			batchedDraw = item.draw;
+		}
+
+		if (batched)
+			FlushBatches(*shader);
+		if (shader)
+			shader->Unuse();
+		GLState::Get().ApplyPipelineState(PipelineState::Get(PipelineStateDesc()));
+		renderQueue.Clear();
+	}
+
+	// Matrices the draws of a pass see, into a viewport viewportHeight pixels high;
+	// the light grid only follows the public setters
+	void SetPassView(const glm::mat4& projection, const glm::mat4& view, GLuint viewportHeight, LODState* sphereLODs)
+	{
+		this->projection = projection;
+		this->view		 = view;
+		clusterCuller.SetView(projection, view);
+		passSphereLODs	   = sphereLODs;
+		lodEyePosition	   = glm::vec3(glm::inverse(view)[3]);
+		lodProjectionScale = projection[1][1] * viewportHeight * 0.5f;
+		lodOrthographic	   = projection[3][3] == 1.0f;
+		viewUniforms.projection = projection;
+		viewUniforms.view		= view;
+	}
+
+	// Lists the shadow casters of the scene in shadowItems, with the LODs of the pass view
+	void SubmitShadowCasters()
+	{
+		shadowItems.clear();
+		shadowItemDepths.clear();
+		shadowPass = true;
+		SubmitScene();
+		shadowPass = false;
+	}
+
+	// Updates one shadow map drawn into viewport of the bound framebuffer: nothing is drawn
+	// while its cache is valid; otherwise the dirty region, or all of area on a full update,
+	// is cleared and the shadow casters reaching it are drawn with positions only
+	void RenderShadowView(ShadowCache& cache, const glm::mat4& projection, const glm::mat4& view, const glm::ivec4& viewport, const glm::ivec4& area,
+		LODState* sphereLODs)
+	{
+		SetPassView(projection, view, viewport.w, sphereLODs);
+		SubmitShadowCasters();
+		cache.Begin(projection * view);
+		for (GLuint i = 0; i < shadowItems.size(); ++i)
+			cache.AddCaster(*shadowItems[i].mesh, shadowItems[i].lod, shadowItems[i].model);
+
+		ShadowUpdate update = cache.Update();
+		if (update == SHADOW_UPDATE_NONE)
+			return;
+
+		glm::ivec4 region = area;
+		if (update == SHADOW_UPDATE_PARTIAL)
+		{
+			region = cache.GetDirtyPixels(viewport.z, viewport.w);
+			region.x += viewport.x;
+			region.y += viewport.y;
+		}
+
+		// The default state writes depth, which the clear needs
+		GLState& state = GLState::Get();
+		glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
+		state.ApplyPipelineState(PipelineState::Get(PipelineStateDesc()));
+		state.SetScissorTest(true);
+		state.SetScissorBox(region.x, region.y, region.z, region.w);
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		UploadViewUniforms();
+		for (GLuint i = 0; i < shadowItems.size(); ++i)
+		{
+			if (cache.IsDirty(i))
+				renderQueue.Submit(shadowItems[i], shadowItemDepths[i]);
+		}
+		ExecuteRenderQueue();
+		state.SetScissorTest(false);
+		shadowStatistics += renderStatistics;
+	}
+
+	// Redraws the cube faces the point shadow budget picked. Each light lists the casters
+	// with the LODs seen from it; its due faces take one layered pass per set of faces its
+	// casters reach, the geometry shader copying every triangle to the layers of its set.
+	// Cluster draws are drawn whole, as their culling knows of a single frustum.
+	void RenderPointShadows()
+	{
+		GLuint resolution = pointShadows.GetResolution();
+		pointShadows.Begin();
+		for (GLuint slot = 0; slot < POINT_SHADOW_MAX_LIGHTS; ++slot)
+		{
+			pointShadowItems[slot].clear();
+			pointShadowItemDepths[slot].clear();
+			if (!pointShadows.HasLight(slot))
+				continue;
+
+			// The LODs a face resolution sees from the light, so the cube only depends on the light and its casters
+			SetPassView(pointShadows.GetProjection(slot), pointShadows.GetView(slot), resolution, pointShadowSphereLODs[slot]);
+			SubmitShadowCasters();
+			pointShadowItems[slot].swap(shadowItems);
+			pointShadowItemDepths[slot].swap(shadowItemDepths);
+
+			const std::vector<RenderItem>& items = pointShadowItems[slot];
+			for (GLuint i = 0; i < items.size(); ++i)
+				pointShadows.AddCaster(slot, *items[i].mesh, items[i].lod, items[i].model);
+		}
+		pointShadows.Update();
+
+		GLState& state = GLState::Get();
+		glViewport(0, 0, resolution, resolution);
+		state.ApplyPipelineState(PipelineState::Get(PipelineStateDesc()));
+		for (GLuint slot = 0; slot < POINT_SHADOW_MAX_LIGHTS; ++slot)
+			pointShadows.Clear(slot);
+
+		pointShadows.Bind();
+		for (GLuint slot = 0; slot < POINT_SHADOW_MAX_LIGHTS; ++slot)
+		{
+			GLuint due = pointShadows.GetDueFaces(slot);
+			if (!due)
+				continue;
+
+			const std::vector<RenderItem>& items = pointShadowItems[slot];
+			pointShadowItemFaces.resize(items.size());
+			for (GLuint i = 0; i < items.size(); ++i)
+				pointShadowItemFaces[i] = pointShadows.GetCasterFaces(slot, i);
+
+			// Each set of faces once, in the order its first caster comes
+			for (GLuint first = 0; first < items.size(); ++first)
+			{
+				GLuint faces = pointShadowItemFaces[first];
+				if (!faces)
+					continue;
+
+				PointShadowUniforms uniforms;
+				pointShadows.Write(slot, faces, uniforms);
+				uniformRing.Bind(UniformBlockBinding::POINT_SHADOW_BLOCK, &uniforms, sizeof(PointShadowUniforms));
+				for (GLuint i = first; i < items.size(); ++i)
+				{
+					if (pointShadowItemFaces[i] != faces)
+						continue;
+					RenderItem item = items[i];
+					item.shader = &pointShadowShader;
+					if (item.draw == RENDER_DRAW_CLUSTERS)
+						item.draw = RENDER_DRAW_ELEMENTS;
+					renderQueue.Submit(item, pointShadowItemDepths[slot][i]);
+					pointShadowItemFaces[i] = 0;
+				}
+				ExecuteRenderQueue();
+				shadowStatistics += renderStatistics;
+			}
+		}
+	}
+
+	// For animation	
+	GLfloat dt = 0.0f;
+	
+public:
+	void SetDeltaTime(GLfloat deltaTime) { dt += deltaTime; }
+
+	void SetProjectionMatrix(glm::mat4 projection)
+	{
+		SetPassView(projection, view, wndHeight, sphereLODs);
+		lightGrid.SetProjection(projection);
+		viewUniforms.lightGrid = lightGrid.GetSliceParameters();
+	}
+
+	void SetViewMatrix(glm::mat4 view) { SetPassView(projection, view, wndHeight, sphereLODs); }
+
+	// Bracket every frame; BeginFrame only waits when the GPU is UNIFORM_RING_FRAMES frames behind,
+	// uploads the frame's lights and restarts the frame's counts of GLState calls and batched draws
+	void BeginFrame()
+	{
+		uniformRing.BeginFrame();
+		UploadLights();
+		GLState::Get().ResetStatistics();
+		instanceBatcher.ResetStatistics();
+		multiDrawBackend.ResetStatistics();
+	}
+	void EndFrame() { uniformRing.EndFrame(); }
+
+	glm::vec3 GetDirectionalLightPosition() { return directionalLight.GetPosition(); }
+
+	// Lights added before BeginFrame show from that frame on; each pixel shades
+	// at most LIGHT_GRID_MAX_CLUSTER_LIGHTS of each kind
+	void AddPointLight(const PointLight& light) { pointLights.push_back(light); }
+	void AddSpotLight(const SpotLight& light) { spotLights.push_back(light); }
+	
+	Renderer(Camera* camera, GLuint wndWidth, GLuint wndHeight)
+	{		
+		this->camera = camera;
+		this->wndWidth = wndWidth;
+		this->wndHeight = wndHeight;
+		passSphereLODs	   = sphereLODs;
+		lodEyePosition	   = camera->GetEyePos();
+		lodProjectionScale = (GLfloat)wndHeight;
+		lodOrthographic	   = false;
+		shadowPass		   = false;
+		memset(lightRanges, 0, sizeof(lightRanges));
+
+		if (!GLEW_ARB_shader_storage_buffer_object)
+			std::cout << "ERROR::RENDERER:: ARB_shader_storage_buffer_object is not supported, point and spot lights are off" << std::endl;
+
+		CompileShaders();
+		SetupLights();
+		LoadMeshes();
+		SetupUniformBufferObjects();
+		SetupSamplers();
+		SetShadowQuality(DEFAULT_SHADOW_QUALITY);
+	}
+	
+	void RenderScene()
+	{
+		UploadViewUniforms();
+		UploadLightClusters();
+		GLState::Get().BindTexture(TEXTURE_UNIT::SHADOW_UNIT, GL_TEXTURE_2D_ARRAY, shadowCascades.GetTexture());
+		GLState::Get().BindTexture(TEXTURE_UNIT::SHADOW_ATLAS_UNIT, GL_TEXTURE_2D, shadowAtlas.GetTexture());
+		GLState::Get().BindTexture(TEXTURE_UNIT::POINT_SHADOW_UNIT, GL_TEXTURE_CUBE_MAP_ARRAY, pointShadows.GetTexture());
+		skyboxTex.Use();
+
+		SubmitScene();
+		ExecuteRenderQueue();
+	}
+
+	// Draws count walls on a grid before the camera through the queue, each on its own with
+	// RENDER_DRAW_ELEMENTS or gathered into indirect calls with RENDER_DRAW_MULTI
+	void RenderDrawBenchmark(GLuint count, RenderDraw draw)
+	{
+		UploadViewUniforms();
+		UploadLightClusters();
+
+		GLuint side = (GLuint)std::ceil(std::sqrt((GLfloat)count));
+		GLfloat spacing = 30.0f / side;
+		Transformation transformation;
+		transformation.Scale(glm::vec3(0.8f / side));
+		transformation.Rotate(glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+		for (GLuint i = 0; i < count; ++i)
+		{
+			transformation.Translate(glm::vec3((i % side + 0.5f) * spacing - 15.0f, (i / side + 0.5f) * spacing - 10.0f, -15.0f));
+			Submit(RENDER_PASS_OPAQUE, draw, defaultShaderNM, &wallMaterial, &wallDiffuseTex, &wallNormalTex, planeMesh, 0, transformation);
 		}
+		ExecuteRenderQueue();
 	}
 
+	// Fits the shadow cascades to the current view and projection, the camera's, and
+	// updates those due this frame, then the spot lights' tiles of the shadow atlas and
+	// the point lights' cube faces the budget allows. Leaves a shadow framebuffer bound
+	// and restores the camera's matrices and the window's viewport.
+	void RenderShadowCasters()
+	{
+		glm::mat4 cameraProjection = projection;
+		glm::mat4 cameraView	   = view;
+		shadowCascades.Fit(cameraProjection, cameraView, glm::normalize(-directionalLight.GetPosition()));
+
+		shadowStatistics = RenderStatistics();
+		glm::ivec4 layer(0, 0, shadowCascades.GetResolution(), shadowCascades.GetResolution());
+		for (GLuint i = 0; i < shadowCascades.GetCount(); ++i)
+		{
+			if (!shadowCascades.IsDue(i))
+				continue;
+			shadowCascades.BindLayer(i);
+			RenderShadowView(shadowCascades.GetCache(i), shadowCascades.GetProjection(i), shadowCascades.GetView(), layer, layer, cascadeSphereLODs[i]);
+			shadowCascades.SetDrawn(i);
+		}
+
+		shadowAtlas.Bind();
+		for (GLuint i = 0; i < spotShadowTiles.size(); ++i)
+		{
+			const ShadowTile& tile = spotShadowTiles[i];
+			if (tile.size)
+				RenderShadowView(spotShadowCaches[i], spotShadowProjections[i], spotShadowViews[i], shadowAtlas.GetViewport(tile),
+					glm::ivec4(tile.x, tile.y, tile.size, tile.size), &spotShadowSphereLODs[i * NUM_SPHERES]);
+		}
+
+		RenderPointShadows();
+
+		glViewport(0, 0, wndWidth, wndHeight);
+		SetPassView(cameraProjection, cameraView, wndHeight, sphereLODs);
+		shadowCascades.Write(viewUniforms.shadowCascades);
+		viewUniforms.shadowCascades.filterRadius = SHADOW_BUDGETS[shadowQuality].filterRadius;
+	}
+
+	// Applies the budget of a quality tier; every shadow map is redrawn whole
+	void SetShadowQuality(ShadowQuality quality)
+	{
+		const ShadowBudget& budget = SHADOW_BUDGETS[quality];
+		shadowQuality = quality;
+		shadowCascades.SetCount(budget.cascadeCount);
+		shadowCascades.SetResolution(budget.cascadeResolution, budget.format);
+		shadowAtlas.SetSize(budget.atlasSize, budget.format);
+		pointShadows.SetResolution(budget.pointResolution, budget.format);
+		pointShadows.SetFaceBudget(budget.pointFaceBudget);
+		for (GLuint i = 0; i < spotShadowCaches.size(); ++i)
+			spotShadowCaches[i].Invalidate();
+
+		// Views drawn before the next RenderShadowCasters, or without one, read as unshadowed
+		shadowCascades.Write(viewUniforms.shadowCascades);
+		viewUniforms.shadowCascades.filterRadius = budget.filterRadius;
+	}
+
+	ShadowQuality GetShadowQuality() const { return shadowQuality; }
+
+	const RenderStatistics& GetRenderStatistics() const { return renderStatistics; }
+	const RenderStatistics& GetShadowStatistics() const { return shadowStatistics; }
+	// Splits and update intervals are set through it; count and resolution follow the quality tier
+	ShadowCascades& GetShadowCascades() { return shadowCascades; }
+	const PointShadows& GetPointShadows() const { return pointShadows; }
+
 	~Renderer() { }
 };
 
@@ -8,12 +8,16 @@
 
 #include <GL/glew.h>
 
+#include "GLState.h"
+#include "UniformTable.h"
+
 class Shader
 {
 private:
 	GLuint vertex;
 	GLuint fragment;
 	GLuint program;
+	const UniformTable* uniforms;
 
 	std::string shaderName;
 	
@@ -79,21 +83,30 @@ private:
 
 		for (GLuint i = 0; i < numShaders; ++i)
 			glDeleteShader(shaders[i]);
+
+		uniforms = &UniformTable::Get(program);
 	}
 
 public:
-	Shader() { }
+	Shader() : uniforms(NULL) { }
 
 	Shader& operator=(const Shader& shader)
 	{
 		vertex	 = shader.vertex;		
 		fragment = shader.fragment;
 		program  = shader.program;
+		uniforms = shader.uniforms;
 		shaderName.assign(shader.shaderName);
 		return *this;
 	}
 
-	const GLuint& GetProgram() { return program; }
+	const GLuint& GetProgram() const { return program; }
+
+	// -1 and GL_INVALID_INDEX when the program lacks the uniform or block
+	GLint GetUniformLocation(UniformId id) const { return uniforms->GetLocation(id); }
+	GLuint GetUniformBlockIndex(UniformId id) const { return uniforms->GetBlockIndex(id); }
+	GLuint GetStorageBlockIndex(UniformId id) const { return uniforms->GetStorageBlockIndex(id); }
+	const std::vector<UniformId>& GetSamplers() const { return uniforms->GetSamplers(); }
 
 	Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const std::string& shaderName)
 	{
@@ -103,15 +116,26 @@ public:
 
 		LinkProgram(new GLuint[] {vertex, fragment}, 2);
 	}
-		
+
+	// With a geometry stage between the two
+	Shader(const GLchar* vertexPath, const GLchar* geometryPath, const GLchar* fragmentPath, const std::string& shaderName)
+	{
+		this->shaderName.assign(shaderName);
+		vertex	 = CompileShader(vertexPath, GL_VERTEX_SHADER, "VERTEX");
+		GLuint geometry = CompileShader(geometryPath, GL_GEOMETRY_SHADER, "GEOMETRY");
+		fragment = CompileShader(fragmentPath, GL_FRAGMENT_SHADER, "FRAGMENT");
+
+		LinkProgram(new GLuint[] {vertex, geometry, fragment}, 3);
+	}
+
 	void Use()
 	{
-		glUseProgram(program);
+		GLState::Get().UseProgram(program);
 	}
 
+	// The program stays bound until another one is used
 	void Unuse()
 	{
-		glUseProgram(0);
 	}
 };
 
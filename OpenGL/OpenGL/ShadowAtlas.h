@@ -0,0 +1,206 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+
+enum ShadowDepthFormat
+{
+	SHADOW_DEPTH_16 = 0,
+	SHADOW_DEPTH_32
+};
+
+inline GLenum GetShadowInternalFormat(ShadowDepthFormat format)
+{
+	return format == SHADOW_DEPTH_16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT32F;
+}
+
+// Samplers of the bound depth texture compare against the reference depth and
+// filter the four nearest results, which is 2x2 PCF in hardware
+inline void SetShadowSampling(GLenum target)
+{
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+}
+
+const GLuint SHADOW_ATLAS_SIZE = 4096;
+const GLuint SHADOW_ATLAS_MIN_TILE = 128;
+// Texels around each tile's viewport left at the far plane, so filters reaching
+// past the viewport read lit texels instead of the neighbouring tile
+const GLint SHADOW_ATLAS_BORDER = 4;
+
+// Square region of the atlas in texels; a size of 0 is no tile
+typedef struct ShadowTile
+{
+	GLint x;
+	GLint y;
+	GLuint size;
+
+	bool operator==(const ShadowTile& tile) const { return x == tile.x && y == tile.y && size == tile.size; }
+} ShadowTile;
+
+// One depth texture shared by the shadow maps of lights of any resolution. Each
+// light asks for a power of two tile; Layout packs the largest first in Morton
+// order, which leaves no gaps, and halves the largest requests while they do not fit.
+class ShadowAtlas
+{
+private:
+	GLuint framebuffer;
+	GLuint depthTex;
+	GLuint size;
+	ShadowDepthFormat format;
+
+	ShadowAtlas(const ShadowAtlas&);
+	ShadowAtlas& operator=(const ShadowAtlas&);
+
+	void Allocate()
+	{
+		GLState::Get().BindTexture(GL_TEXTURE_2D, depthTex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GetShadowInternalFormat(format), size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// Every other bit of i, from bit 0 on
+	static GLuint EvenBits(GLuint i)
+	{
+		i &= 0x55555555;
+		i = (i | (i >> 1)) & 0x33333333;
+		i = (i | (i >> 2)) & 0x0f0f0f0f;
+		i = (i | (i >> 4)) & 0x00ff00ff;
+		i = (i | (i >> 8)) & 0x0000ffff;
+		return i;
+	}
+
+	static GLuint FloorPowerOfTwo(GLuint i)
+	{
+		GLuint p = 1;
+		while (p <= i / 2)
+			p *= 2;
+		return p;
+	}
+
+public:
+	ShadowAtlas() : size(SHADOW_ATLAS_SIZE), format(SHADOW_DEPTH_32)
+	{
+		glGenTextures(1, &depthTex);
+		GLState::Get().BindTexture(GL_TEXTURE_2D, depthTex);
+		SetShadowSampling(GL_TEXTURE_2D);
+		Allocate();
+
+		glGenFramebuffers(1, &framebuffer);
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::SHADOW_ATLAS:: Framebuffer is not complete!" << std::endl;
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// Reallocates the texture; its content and every tile's are lost
+	void SetSize(GLuint size, ShadowDepthFormat format)
+	{
+		this->size	 = FloorPowerOfTwo(std::max(size, SHADOW_ATLAS_MIN_TILE));
+		this->format = format;
+		Allocate();
+	}
+
+	// Tiles for the requested resolutions, 0 for lights without shadows. Each gets the
+	// power of two at or below its request, within SHADOW_ATLAS_MIN_TILE and the atlas;
+	// when the atlas is full the lights of the minimum size that come last get none.
+	void Layout(const std::vector<GLuint>& requests, std::vector<ShadowTile>& tiles) const
+	{
+		const GLuint UNITS = (size / SHADOW_ATLAS_MIN_TILE) * (size / SHADOW_ATLAS_MIN_TILE);
+
+		std::vector<GLuint> sizes(requests.size());
+		GLuint units = 0;
+		for (GLuint i = 0; i < requests.size(); ++i)
+		{
+			sizes[i] = requests[i] ? FloorPowerOfTwo(std::max(std::min(requests[i], size), SHADOW_ATLAS_MIN_TILE)) : 0;
+			units	+= (sizes[i] / SHADOW_ATLAS_MIN_TILE) * (sizes[i] / SHADOW_ATLAS_MIN_TILE);
+		}
+		while (units > UNITS)
+		{
+			GLuint largest = 0;
+			for (GLuint i = 1; i < sizes.size(); ++i)
+			{
+				if (sizes[i] > sizes[largest])
+					largest = i;
+			}
+			if (sizes[largest] > SHADOW_ATLAS_MIN_TILE)
+			{
+				GLuint n = sizes[largest] / SHADOW_ATLAS_MIN_TILE;
+				units -= n * n - n * n / 4;
+				sizes[largest] /= 2;
+				continue;
+			}
+			for (GLuint i = sizes.size(); i-- > 0;)
+			{
+				if (sizes[i])
+				{
+					sizes[i] = 0;
+					units--;
+					break;
+				}
+			}
+		}
+
+		// Largest first, so every tile starts at a multiple of its own area
+		std::vector<std::pair<GLuint, GLuint> > order;
+		for (GLuint i = 0; i < sizes.size(); ++i)
+			order.push_back(std::make_pair(size * 2 - sizes[i], i));
+		std::sort(order.begin(), order.end());
+
+		tiles.resize(sizes.size());
+		GLuint offset = 0;
+		for (GLuint i = 0; i < order.size(); ++i)
+		{
+			ShadowTile& tile = tiles[order[i].second];
+			tile.size = sizes[order[i].second];
+			tile.x	  = tile.size ? EvenBits(offset) * SHADOW_ATLAS_MIN_TILE : 0;
+			tile.y	  = tile.size ? EvenBits(offset >> 1) * SHADOW_ATLAS_MIN_TILE : 0;
+			offset	 += (tile.size / SHADOW_ATLAS_MIN_TILE) * (tile.size / SHADOW_ATLAS_MIN_TILE);
+		}
+	}
+
+	// Viewport of a tile, inside its border
+	glm::ivec4 GetViewport(const ShadowTile& tile) const
+	{
+		return glm::ivec4(tile.x + SHADOW_ATLAS_BORDER, tile.y + SHADOW_ATLAS_BORDER, tile.size - 2 * SHADOW_ATLAS_BORDER, tile.size - 2 * SHADOW_ATLAS_BORDER);
+	}
+
+	// Maps the normalized device coordinates of a tile's viewport to texture coordinates and depth
+	glm::mat4 GetTileMatrix(const ShadowTile& tile) const
+	{
+		glm::ivec4 viewport = GetViewport(tile);
+		glm::mat4 matrix(1.0f);
+		matrix[0][0] = 0.5f * viewport.z / size;
+		matrix[1][1] = 0.5f * viewport.w / size;
+		matrix[2][2] = 0.5f;
+		matrix[3]	 = glm::vec4((viewport.x + 0.5f * viewport.z) / size, (viewport.y + 0.5f * viewport.w) / size, 0.5f, 1.0f);
+		return matrix;
+	}
+
+	void Bind() { GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, framebuffer); }
+
+	GLuint GetSize() const { return size; }
+	GLuint GetTexture() const { return depthTex; }
+
+	~ShadowAtlas()
+	{
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(1, &depthTex);
+	}
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "MeshClusterizer.h"
+
+// Pixels added around the dirty region, so rasterization at its border is redrawn too
+const GLint SHADOW_CACHE_PADDING = 1;
+
+// How much of the shadow map a frame has to draw
+enum ShadowUpdate
+{
+	SHADOW_UPDATE_NONE = 0,	// the cached map is still valid
+	SHADOW_UPDATE_PARTIAL,	// only the dirty region
+	SHADOW_UPDATE_FULL
+};
+
+// A shadow caster as drawn into the map, with its light space footprint
+typedef struct ShadowCaster
+{
+	const Mesh* mesh;
+	GLuint lod;
+	glm::mat4 model;
+	glm::vec4 rect;	// xy min and max in normalized device coordinates, empty (min > max) outside the frustum
+} ShadowCaster;
+
+// Keeps the shadow map while neither the light nor a caster changed. Every frame
+// lists its casters in submission order; those whose mesh, LOD or transformation
+// differ from the map's dirty the union of their old and new footprints, which is
+// all that has to be cleared and redrawn. A different light or set of casters
+// invalidates the whole map.
+class ShadowCache
+{
+private:
+	glm::mat4 viewProjection;
+	glm::vec4 frustum[6];
+	bool valid;
+
+	std::vector<ShadowCaster> casters;	// of the map as drawn
+	std::vector<ShadowCaster> pending;	// of the coming frame
+	glm::vec4 dirty;
+
+	GLuint reusedFrames;
+	GLuint partialFrames;
+	GLuint fullFrames;
+
+	static glm::vec4 EmptyRect() { return glm::vec4(1.0f, 1.0f, -1.0f, -1.0f); }
+
+	static bool IsEmpty(const glm::vec4& rect) { return rect.x > rect.z || rect.y > rect.w; }
+
+	static glm::vec4 Union(const glm::vec4& a, const glm::vec4& b)
+	{
+		return glm::vec4(std::min(a.x, b.x), std::min(a.y, b.y), std::max(a.z, b.z), std::max(a.w, b.w));
+	}
+
+	// Projects the box around the bounding sphere; a corner behind a perspective light covers everything
+	glm::vec4 Footprint(const Mesh& mesh, const glm::mat4& model) const
+	{
+		glm::vec3 center;
+		GLfloat radius;
+		mesh.GetBoundingSphere(model, center, radius);
+		if (!SphereInFrustum(frustum, center, radius))
+			return EmptyRect();
+
+		glm::vec4 rect(1.0f, 1.0f, -1.0f, -1.0f);
+		for (GLuint i = 0; i < 8; ++i)
+		{
+			glm::vec3 corner = center + radius * glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+			glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+			if (clip.w <= 0.0f)
+				return glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f);
+			glm::vec2 ndc = glm::vec2(clip) / clip.w;
+			rect = Union(rect, glm::vec4(ndc, ndc));
+		}
+		return glm::clamp(rect, glm::vec4(-1.0f), glm::vec4(1.0f));
+	}
+
+	// Union of the footprints the listed casters changed, all of the map when it is invalid
+	glm::vec4 PendingDirty() const
+	{
+		if (!valid || pending.size() != casters.size())
+			return glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f);
+
+		glm::vec4 rect = EmptyRect();
+		for (GLuint i = 0; i < pending.size(); ++i)
+		{
+			const ShadowCaster& now	 = pending[i];
+			const ShadowCaster& then = casters[i];
+			if (now.mesh != then.mesh || now.lod != then.lod || now.model != then.model)
+				rect = Union(rect, Union(now.rect, then.rect));
+		}
+		return rect;
+	}
+
+public:
+	ShadowCache() : valid(false), dirty(EmptyRect()), reusedFrames(0), partialFrames(0), fullFrames(0) { }
+
+	// Starts listing the casters of a frame seen from the light through viewProjection
+	void Begin(const glm::mat4& viewProjection)
+	{
+		if (viewProjection != this->viewProjection)
+			valid = false;
+		this->viewProjection = viewProjection;
+		ExtractFrustumPlanes(viewProjection, frustum);
+		pending.clear();
+	}
+
+	void AddCaster(const Mesh& mesh, GLuint lod, const glm::mat4& model)
+	{
+		ShadowCaster caster;
+		caster.mesh	 = &mesh;
+		caster.lod	 = lod;
+		caster.model = model;
+		caster.rect	 = Footprint(mesh, model);
+		pending.push_back(caster);
+	}
+
+	// Whether Update would draw anything; the listed casters stay pending, so a
+	// map left stale this frame is compared with what it holds again the next
+	bool IsStale() const { return !IsEmpty(PendingDirty()); }
+
+	// Compares the listed casters with the map's and makes them the map's
+	ShadowUpdate Update()
+	{
+		dirty = PendingDirty();
+		bool full = !valid || pending.size() != casters.size();
+		casters.swap(pending);
+		valid = true;
+
+		if (IsEmpty(dirty))
+		{
+			reusedFrames++;
+			return SHADOW_UPDATE_NONE;
+		}
+		if (full)
+		{
+			fullFrames++;
+			return SHADOW_UPDATE_FULL;
+		}
+		partialFrames++;
+		return SHADOW_UPDATE_PARTIAL;
+	}
+
+	// Whether caster i of the last Update reaches the dirty region
+	bool IsDirty(GLuint i) const
+	{
+		const glm::vec4& rect = casters[i].rect;
+		return !IsEmpty(rect) && rect.x <= dirty.z && dirty.x <= rect.z && rect.y <= dirty.w && dirty.y <= rect.w;
+	}
+
+	// Whether caster i of the last Update falls in the light's frustum at all
+	bool IsVisible(GLuint i) const { return !IsEmpty(casters[i].rect); }
+
+	// Dirty region of the last Update in pixels of a width by height map, as x, y, width and height
+	glm::ivec4 GetDirtyPixels(GLuint width, GLuint height) const
+	{
+		GLint x0 = std::max((GLint)std::floor((dirty.x * 0.5f + 0.5f) * width) - SHADOW_CACHE_PADDING, 0);
+		GLint y0 = std::max((GLint)std::floor((dirty.y * 0.5f + 0.5f) * height) - SHADOW_CACHE_PADDING, 0);
+		GLint x1 = std::min((GLint)std::ceil((dirty.z * 0.5f + 0.5f) * width) + SHADOW_CACHE_PADDING, (GLint)width);
+		GLint y1 = std::min((GLint)std::ceil((dirty.w * 0.5f + 0.5f) * height) + SHADOW_CACHE_PADDING, (GLint)height);
+		return glm::ivec4(x0, y0, x1 - x0, y1 - y0);
+	}
+
+	// Forces the next frame to redraw the whole map, e.g. after the map was cleared
+	void Invalidate() { valid = false; }
+
+	// Frames that drew nothing, part of the map or all of it
+	GLuint GetReusedFrames() const { return reusedFrames; }
+	GLuint GetPartialFrames() const { return partialFrames; }
+	GLuint GetFullFrames() const { return fullFrames; }
+};
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLState.h"
+#include "ShadowCache.h"
+#include "ShadowAtlas.h"
+
+// Size of the cascade arrays of the ViewProjectionLighSpace block
+const GLuint SHADOW_MAX_CASCADES = 4;
+const GLuint SHADOW_CASCADE_COUNT = 4;
+const GLuint SHADOW_CASCADE_RESOLUTION = 2048;
+// Blend between logarithmic (1) and uniform (0) split distances
+const GLfloat SHADOW_CASCADE_SPLIT_LAMBDA = 0.8f;
+// View depth up to which the camera's frustum is shadowed
+const GLfloat SHADOW_CASCADE_MAX_DISTANCE = 150.0f;
+// Casters this far towards the light from a cascade's slice still shadow it
+const GLfloat SHADOW_CASCADE_CASTER_DISTANCE = 100.0f;
+const GLfloat SHADOW_CASCADE_BIAS_TEXELS = 1.5f;
+// Frames between updates of each cascade; staggered, so far cascades take turns
+const GLuint SHADOW_CASCADE_UPDATE_INTERVALS[SHADOW_MAX_CASCADES] = { 1, 1, 2, 4 };
+
+// std140 mirror of the cascade members of the ViewProjectionLighSpace block
+typedef struct ShadowCascadeUniforms
+{
+	glm::mat4 lightSpace[SHADOW_MAX_CASCADES];	// as last drawn
+	glm::vec4 splits;	// far view depth of each cascade
+	glm::vec4 bias;		// in the depth units of each cascade
+	GLint count;
+	GLint filterRadius;	// of the PCF kernel of every shadow map, in hardware 2x2 taps
+	GLint padding[2];
+} ShadowCascadeUniforms;
+
+// Directional light shadows as cascaded shadow maps in the layers of one depth
+// texture array. Each cascade is fitted to a slice of the camera's frustum: the
+// bounding sphere of the slice keeps its size while the camera turns, and its
+// window moves in whole texels, so shadow edges do not crawl while the camera moves.
+// A cascade drawn less often than every frame is shaded with the matrix it was
+// drawn with; fragments it no longer covers fall to the next cascade.
+class ShadowCascades
+{
+private:
+	GLuint framebuffer;
+	GLuint depthTex;
+	GLuint count;
+	GLuint resolution;
+	ShadowDepthFormat format;
+	GLfloat splitLambda;
+	GLfloat maxDistance;
+	GLfloat splitDistances[SHADOW_MAX_CASCADES];	// explicit ones, zero to use the lambda
+	GLuint updateIntervals[SHADOW_MAX_CASCADES];
+	GLuint frame;
+
+	glm::mat4 lightView;
+	glm::mat4 projections[SHADOW_MAX_CASCADES];	// fitted this frame
+	GLfloat splits[SHADOW_MAX_CASCADES];
+	GLfloat bias[SHADOW_MAX_CASCADES];
+	glm::mat4 drawnLightSpaces[SHADOW_MAX_CASCADES];
+	GLfloat drawnBias[SHADOW_MAX_CASCADES];
+	bool drawn[SHADOW_MAX_CASCADES];
+	ShadowCache caches[SHADOW_MAX_CASCADES];
+
+	ShadowCascades(const ShadowCascades&);
+	ShadowCascades& operator=(const ShadowCascades&);
+
+	void Allocate()
+	{
+		GLState::Get().BindTexture(GL_TEXTURE_2D_ARRAY, depthTex);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GetShadowInternalFormat(format), resolution, resolution, count, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		GLState::Get().BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		Invalidate();
+	}
+
+	GLfloat GetSplitDistance(GLuint cascade, GLfloat nearPlane, GLfloat farPlane) const
+	{
+		if (splitDistances[cascade] > 0.0f)
+			return std::min(splitDistances[cascade], farPlane);
+		GLfloat p = (GLfloat)(cascade + 1) / count;
+		GLfloat logarithmic = nearPlane * std::pow(farPlane / nearPlane, p);
+		GLfloat uniform		= nearPlane + (farPlane - nearPlane) * p;
+		return splitLambda * logarithmic + (1.0f - splitLambda) * uniform;
+	}
+
+public:
+	ShadowCascades() : count(SHADOW_CASCADE_COUNT), resolution(SHADOW_CASCADE_RESOLUTION), format(SHADOW_DEPTH_32), splitLambda(SHADOW_CASCADE_SPLIT_LAMBDA),
+		maxDistance(SHADOW_CASCADE_MAX_DISTANCE), frame(0)
+	{
+		for (GLuint i = 0; i < SHADOW_MAX_CASCADES; ++i)
+		{
+			splitDistances[i]  = 0.0f;
+			updateIntervals[i] = SHADOW_CASCADE_UPDATE_INTERVALS[i];
+			splits[i] = bias[i] = drawnBias[i] = 0.0f;
+			drawn[i] = false;
+		}
+
+		glGenTextures(1, &depthTex);
+		GLState::Get().BindTexture(GL_TEXTURE_2D_ARRAY, depthTex);
+		SetShadowSampling(GL_TEXTURE_2D_ARRAY);
+		Allocate();
+
+		glGenFramebuffers(1, &framebuffer);
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex, 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::SHADOW_CASCADES:: Framebuffer is not complete!" << std::endl;
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// Reallocates the array for 1 to SHADOW_MAX_CASCADES cascades
+	void SetCount(GLuint count)
+	{
+		this->count = std::max(1u, std::min(count, SHADOW_MAX_CASCADES));
+		Allocate();
+	}
+
+	void SetResolution(GLuint resolution, ShadowDepthFormat format)
+	{
+		this->resolution = resolution;
+		this->format	 = format;
+		Allocate();
+	}
+
+	void SetSplitLambda(GLfloat lambda) { splitLambda = lambda; }
+
+	void SetMaxDistance(GLfloat distance) { maxDistance = distance; }
+
+	// Far view depths of the cascades, overriding the lambda; NULL returns to it.
+	// The last one becomes the max distance.
+	void SetSplitDistances(const GLfloat* distances)
+	{
+		for (GLuint i = 0; i < SHADOW_MAX_CASCADES; ++i)
+			splitDistances[i] = distances && i < count ? distances[i] : 0.0f;
+		if (distances)
+			maxDistance = distances[count - 1];
+	}
+
+	void SetUpdateInterval(GLuint cascade, GLuint frames) { updateIntervals[cascade] = std::max(frames, 1u); }
+
+	// Forces every cascade to be drawn whole on its next update
+	void Invalidate()
+	{
+		for (GLuint i = 0; i < SHADOW_MAX_CASCADES; ++i)
+		{
+			drawn[i] = false;
+			caches[i].Invalidate();
+		}
+	}
+
+	// Fits the cascades to the frustum of the camera's projection and view, lit along direction
+	void Fit(const glm::mat4& projection, const glm::mat4& view, const glm::vec3& direction)
+	{
+		frame++;
+		glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+		// View space corners of the near and far planes
+		glm::mat4 inverseProjection = glm::inverse(projection);
+		glm::vec3 nearCorners[4], farCorners[4];
+		for (GLuint i = 0; i < 4; ++i)
+		{
+			glm::vec2 ndc(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f);
+			glm::vec4 nearCorner = inverseProjection * glm::vec4(ndc, -1.0f, 1.0f);
+			glm::vec4 farCorner	 = inverseProjection * glm::vec4(ndc, 1.0f, 1.0f);
+			nearCorners[i] = glm::vec3(nearCorner) / nearCorner.w;
+			farCorners[i]  = glm::vec3(farCorner) / farCorner.w;
+		}
+		GLfloat nearPlane = std::max(-nearCorners[0].z, 1e-3f);
+		GLfloat farPlane  = -farCorners[0].z;
+		GLfloat lastSplit = std::min(maxDistance, farPlane);
+		glm::mat4 viewToLight = lightView * glm::inverse(view);
+
+		GLfloat sliceNear = nearPlane;
+		for (GLuint c = 0; c < count; ++c)
+		{
+			GLfloat sliceFar = GetSplitDistance(c, nearPlane, lastSplit);
+			splits[c] = sliceFar;
+
+			// Bounding sphere of the slice, taken in view space where it does not depend on where
+			// the camera looks; view depth is linear along the corner rays
+			glm::vec3 corners[8];
+			glm::vec3 center(0.0f);
+			for (GLuint i = 0; i < 8; ++i)
+			{
+				GLfloat t = ((i < 4 ? sliceNear : sliceFar) + nearCorners[i & 3].z) / (farPlane + nearCorners[i & 3].z);
+				corners[i] = glm::mix(nearCorners[i & 3], farCorners[i & 3], t);
+				center += corners[i] * 0.125f;
+			}
+			GLfloat radius = 0.0f;
+			for (GLuint i = 0; i < 8; ++i)
+				radius = std::max(radius, glm::length(corners[i] - center));
+			radius = std::ceil(radius * 16.0f) / 16.0f;
+			center = glm::vec3(viewToLight * glm::vec4(center, 1.0f));
+
+			// A texel of margin on each side keeps the sphere covered after snapping
+			GLfloat texel  = 2.0f * radius / (resolution - 2);
+			GLfloat extent = radius + texel;
+			center = glm::floor(center / texel) * texel;
+			projections[c] = glm::ortho(center.x - extent, center.x + extent, center.y - extent, center.y + extent,
+				-center.z - extent - SHADOW_CASCADE_CASTER_DISTANCE, -center.z + extent);
+			bias[c] = SHADOW_CASCADE_BIAS_TEXELS * texel / (2.0f * extent + SHADOW_CASCADE_CASTER_DISTANCE);
+			sliceNear = sliceFar;
+		}
+	}
+
+	// Whether the cascade is to be drawn this frame, always so until it has been drawn once
+	bool IsDue(GLuint cascade) const
+	{
+		GLuint interval = updateIntervals[cascade];
+		return !drawn[cascade] || frame % interval == cascade % interval;
+	}
+
+	// Draws into the cascade's layer
+	void BindLayer(GLuint cascade)
+	{
+		GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex, 0, cascade);
+	}
+
+	// Call once the cascade's layer holds what its fitted matrices see
+	void SetDrawn(GLuint cascade)
+	{
+		drawnLightSpaces[cascade] = projections[cascade] * lightView;
+		drawnBias[cascade] = bias[cascade];
+		drawn[cascade] = true;
+	}
+
+	// Cascades that were never drawn map every point outside their layer; filterRadius is left to the caller
+	void Write(ShadowCascadeUniforms& uniforms) const
+	{
+		glm::mat4 outside(0.0f);
+		outside[3] = glm::vec4(2.0f, 2.0f, 2.0f, 1.0f);
+
+		uniforms.count = count;
+		for (GLuint i = 0; i < SHADOW_MAX_CASCADES; ++i)
+		{
+			bool used = i < count && drawn[i];
+			uniforms.lightSpace[i] = used ? drawnLightSpaces[i] : outside;
+			uniforms.splits[i] = i < count ? splits[i] : 0.0f;
+			uniforms.bias[i]   = used ? drawnBias[i] : 0.0f;
+		}
+	}
+
+	GLuint GetCount() const { return count; }
+	GLuint GetResolution() const { return resolution; }
+	GLuint GetTexture() const { return depthTex; }
+	const glm::mat4& GetView() const { return lightView; }
+	const glm::mat4& GetProjection(GLuint cascade) const { return projections[cascade]; }
+	ShadowCache& GetCache(GLuint cascade) { return caches[cascade]; }
+	const ShadowCache& GetCache(GLuint cascade) const { return caches[cascade]; }
+
+	~ShadowCascades()
+	{
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(1, &depthTex);
+	}
+};
+
+#endif
@@ -5,6 +5,9 @@
 #include <GL/glew.h>
 #include <SOIL/SOIL.h>
 
+#include "GLState.h"
+#include "Shader.h"
+
 class Texture
 {
 private:
@@ -31,26 +34,31 @@ public:
 		unsigned char* image = SOIL_load_image(textureLocation.c_str(), &textureWidth, &textureHeight, 0, SOIL_LOAD_RGBA);
 		
 		glGenTextures(1, &texture);
-		glBindTexture(GL_TEXTURE_2D, texture);
+		GLState::Get().BindTexture(GL_TEXTURE_2D, texture);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, textureWidth, textureHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glGenerateMipmap(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, 0);
 
 		SOIL_free_image_data(image);
 	}
 
-	void Use(const GLuint& program, const std::string& name, GLuint i)
+	// Binds to unit i and points the sampler of shader, which must be in use, at it
+	void Use(const Shader& shader, UniformId sampler, GLuint i)
+	{
+		glUniform1i(shader.GetUniformLocation(sampler), i);
+		GLState::Get().BindTexture(i, GL_TEXTURE_2D, texture);
+	}
+
+	// Binds to unit i without touching the sampler uniforms
+	void Bind(GLuint i)
 	{
-		glUniform1i(glGetUniformLocation(program, name.c_str()), i);
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(GL_TEXTURE_2D, texture);		
+		GLState::Get().BindTexture(i, GL_TEXTURE_2D, texture);
 	}
 
+	// The texture stays bound until its unit is given another one
 	void Unuse()
 	{
-		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 
 	~Texture()
@@ -0,0 +1,15 @@
+#ifndef TEXTURE_UNIT_H
+#define TEXTURE_UNIT_H
+
+// Texture units shared by every program; the samplers are set once at startup
+enum TEXTURE_UNIT
+{
+	DIFFUSE_UNIT = 0,
+	NORMAL_UNIT	 = 1,
+	SHADOW_UNIT	 = 3,
+	SHADOW_ATLAS_UNIT = 4,
+	POINT_SHADOW_UNIT = 5,
+	SKYBOX_UNIT	 = 10
+};
+
+#endif
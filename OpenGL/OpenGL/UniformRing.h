@@ -0,0 +1,229 @@
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "GLState.h"
+
+// Frames the CPU may run ahead of the GPU before BeginFrame waits
+const GLuint UNIFORM_RING_FRAMES	 = 3;
+const GLuint UNIFORM_RING_FRAME_SIZE = 1 << 22;	// room for the binned lights of every view
+
+// BeginFrame waits for the oldest frame in slices of 1 ms, in nanoseconds
+const GLuint64 UNIFORM_RING_WAIT_TIMEOUT = 1000000;
+
+// A uniform buffer that stays mapped for its whole life. Every frame writes its
+// constants linearly into its own region and binds them with glBindBufferRange;
+// a fence per region keeps the CPU from overwriting data the GPU still reads.
+// Instance data is streamed the same way and bound as a vertex buffer, light
+// arrays and clusters as shader storage buffers.
+// Without ARB_buffer_storage each write maps its range unsynchronized instead,
+// which the same fences make safe.
+class UniformRing
+{
+private:
+	// A buffer replaced by a larger one, deleted once the GPU is past its last frame
+	typedef struct RetiredBuffer
+	{
+		GLuint buffer;
+		GLsync fence;
+
+		RetiredBuffer(GLuint buffer) : buffer(buffer), fence(0) { }
+	} RetiredBuffer;
+
+	GLuint buffer;
+	GLubyte* mapped;	// NULL when writes map their own range
+	GLuint alignment;
+	GLuint frameSize;
+	GLuint regions[UNIFORM_RING_FRAMES];	// start of every frame's region
+	GLuint frame;
+	GLuint head;
+	GLuint end;
+	GLsync fences[UNIFORM_RING_FRAMES];
+	std::vector<RetiredBuffer> retired;
+
+	UniformRing(const UniformRing&);
+	UniformRing& operator=(const UniformRing&);
+
+	void Allocate(GLuint size)
+	{
+		glGenBuffers(1, &buffer);
+		GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+		if (GLEW_ARB_buffer_storage)
+		{
+			const GLbitfield FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_UNIFORM_BUFFER, size, NULL, FLAGS);
+			mapped = (GLubyte*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, FLAGS);
+		}
+		else
+			glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+
+	void Unmap()
+	{
+		if (!mapped)
+			return;
+		GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		mapped = NULL;
+	}
+
+	// Moves to a buffer whose regions hold at least size more bytes than the current
+	// frame has written. Those bytes are copied to the same offsets, so ranges handed
+	// out earlier in the frame stay valid; the other regions start out free.
+	void Grow(GLuint size)
+	{
+		GLuint start = regions[frame];
+		GLuint used	 = head - start;
+		GLuint required = used + size + alignment;
+		while (frameSize < required)
+			frameSize *= 2;
+
+		GLuint previous = buffer;
+		Unmap();
+		Allocate(start + UNIFORM_RING_FRAMES * frameSize);
+		for (GLuint i = 1; i < UNIFORM_RING_FRAMES; ++i)
+			regions[(frame + i) % UNIFORM_RING_FRAMES] = start + i * frameSize;
+		end = start + frameSize;
+
+		if (used)
+		{
+			GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, previous);
+			GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, start, start, used);
+		}
+
+		// The old buffer's fences only guarded the old buffer; this frame's fence outlives them all
+		for (GLuint i = 0; i < UNIFORM_RING_FRAMES; ++i)
+		{
+			if (fences[i])
+				glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+		retired.push_back(RetiredBuffer(previous));
+	}
+
+public:
+	UniformRing() : buffer(0), mapped(NULL), alignment(256), frameSize(UNIFORM_RING_FRAME_SIZE), frame(0), head(0), end(UNIFORM_RING_FRAME_SIZE)
+	{
+		for (GLuint i = 0; i < UNIFORM_RING_FRAMES; ++i)
+		{
+			regions[i] = i * UNIFORM_RING_FRAME_SIZE;
+			fences[i]  = 0;
+		}
+
+		GLint offsetAlignment;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+		alignment = offsetAlignment;
+		if (GLEW_ARB_shader_storage_buffer_object)
+		{
+			glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+			alignment = std::max(alignment, (GLuint)offsetAlignment);
+		}
+
+		Allocate(UNIFORM_RING_FRAMES * UNIFORM_RING_FRAME_SIZE);
+	}
+
+	// Moves to the next region, waiting only if the GPU is still reading it
+	void BeginFrame()
+	{
+		frame = (frame + 1) % UNIFORM_RING_FRAMES;
+		if (fences[frame])
+		{
+			while (glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, UNIFORM_RING_WAIT_TIMEOUT) == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(fences[frame]);
+			fences[frame] = 0;
+		}
+		head = regions[frame];
+		end	 = head + frameSize;
+
+		for (GLuint i = 0; i < retired.size();)
+		{
+			if (retired[i].fence && glClientWaitSync(retired[i].fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+			{
+				glDeleteSync(retired[i].fence);
+				GLState::Get().DeleteBuffer(retired[i].buffer);
+				retired.erase(retired.begin() + i);
+			}
+			else
+				++i;
+		}
+	}
+
+	// Call after the last draw that reads this frame's constants
+	void EndFrame()
+	{
+		fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		for (GLuint i = 0; i < retired.size(); ++i)
+		{
+			if (!retired[i].fence)
+				retired[i].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+	}
+
+	// Copies size bytes into the frame's region and returns their offset in the buffer.
+	// A region too small for the frame grows the whole ring rather than wrapping onto
+	// data that is still to be drawn.
+	GLuint Write(const void* data, GLuint size)
+	{
+		GLuint offset = (head + alignment - 1) / alignment * alignment;
+		if (offset + size > end)
+		{
+			Grow(size);
+			offset = (head + alignment - 1) / alignment * alignment;
+		}
+
+		if (mapped)
+			memcpy(mapped + offset, data, size);
+		else
+		{
+			GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+			void* range = glMapBufferRange(GL_UNIFORM_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			memcpy(range, data, size);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+		}
+		head = offset + size;
+		return offset;
+	}
+
+	// Binds size bytes written earlier this frame at offset to an indexed binding point of
+	// target, GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER
+	void BindRange(GLenum target, GLuint binding, GLuint offset, GLuint size)
+	{
+		GLState::Get().BindBufferRange(target, binding, buffer, offset, size);
+	}
+
+	// Writes size bytes and binds them to the uniform block binding point
+	void Bind(GLuint binding, const void* data, GLuint size)
+	{
+		BindRange(GL_UNIFORM_BUFFER, binding, Write(data, size), size);
+	}
+
+	GLuint GetBuffer() const { return buffer; }
+
+	~UniformRing()
+	{
+		for (GLuint i = 0; i < UNIFORM_RING_FRAMES; ++i)
+		{
+			if (fences[i])
+				glDeleteSync(fences[i]);
+		}
+		for (GLuint i = 0; i < retired.size(); ++i)
+		{
+			if (retired[i].fence)
+				glDeleteSync(retired[i].fence);
+			GLState::Get().DeleteBuffer(retired[i].buffer);
+		}
+		if (buffer)
+		{
+			Unmap();
+			GLState::Get().DeleteBuffer(buffer);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef UNIFORM_TABLE_H
+#define UNIFORM_TABLE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+
+#include <GL/glew.h>
+
+// Small integer standing for a uniform or block name, equal across programs
+typedef GLuint UniformId;
+
+// Uniforms, uniform and storage blocks and samplers of one linked program, read
+// once through program introspection. Names are interned into UniformIds, so
+// per-frame code resolves a location with an array lookup instead of glGetUniformLocation.
+class UniformTable
+{
+private:
+	std::vector<GLint> locations;	// by UniformId, -1 when the program lacks the uniform
+	std::vector<GLuint> blocks;		// by UniformId, GL_INVALID_INDEX when the program lacks the block
+	std::vector<GLuint> storageBlocks;
+	std::vector<UniformId> samplers;
+
+	UniformTable() { }
+	UniformTable(const UniformTable&);
+	UniformTable& operator=(const UniformTable&);
+
+	static std::unordered_map<std::string, UniformId>& GetNames()
+	{
+		static std::unordered_map<std::string, UniformId> names;
+		return names;
+	}
+
+	static bool IsSampler(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_SAMPLER_2D:
+		case GL_SAMPLER_2D_SHADOW:
+		case GL_SAMPLER_2D_ARRAY:
+		case GL_SAMPLER_2D_ARRAY_SHADOW:
+		case GL_SAMPLER_2D_MULTISAMPLE:
+		case GL_SAMPLER_CUBE:
+		case GL_SAMPLER_CUBE_SHADOW:
+		case GL_SAMPLER_CUBE_MAP_ARRAY:
+		case GL_SAMPLER_CUBE_MAP_ARRAY_SHADOW:
+		case GL_SAMPLER_3D:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	void AddUniform(const std::string& name, GLint location, GLint arraySize, GLenum type)
+	{
+		if (location < 0)
+			return;
+
+		// Arrays of basic types are reported once as "name[0]"; register every element
+		std::string base = name;
+		if (arraySize > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+		{
+			base = name.substr(0, name.size() - 3);
+			SetLocation(Intern(base), location);
+			for (GLint i = 1; i < arraySize; ++i)
+			{
+				std::ostringstream element;
+				element << base << "[" << i << "]";
+				SetLocation(Intern(element.str()), location + i);
+			}
+		}
+		SetLocation(Intern(name), location);
+
+		if (IsSampler(type))
+			samplers.push_back(Intern(base));
+	}
+
+	void SetLocation(UniformId id, GLint location)
+	{
+		if (id >= locations.size())
+			locations.resize(id + 1, -1);
+		locations[id] = location;
+	}
+
+	static void AddBlock(std::vector<GLuint>& blocks, const std::string& name, GLuint index)
+	{
+		UniformId id = Intern(name);
+		if (id >= blocks.size())
+			blocks.resize(id + 1, GL_INVALID_INDEX);
+		blocks[id] = index;
+	}
+
+	void Reflect(GLuint program)
+	{
+		std::vector<GLchar> name;
+		if (GLEW_ARB_program_interface_query)
+		{
+			GLint numUniforms, numBlocks, maxLength, blockMaxLength;
+			glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &numUniforms);
+			glGetProgramInterfaceiv(program, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxLength);
+			glGetProgramInterfaceiv(program, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &numBlocks);
+			glGetProgramInterfaceiv(program, GL_UNIFORM_BLOCK, GL_MAX_NAME_LENGTH, &blockMaxLength);
+			name.resize(std::max(std::max(maxLength, blockMaxLength), 1));
+
+			const GLenum PROPERTIES[] = { GL_BLOCK_INDEX, GL_LOCATION, GL_ARRAY_SIZE, GL_TYPE };
+			for (GLint i = 0; i < numUniforms; ++i)
+			{
+				GLint values[4];
+				glGetProgramResourceiv(program, GL_UNIFORM, i, 4, PROPERTIES, 4, NULL, values);
+				if (values[0] != -1)
+					continue;	// member of a block
+				glGetProgramResourceName(program, GL_UNIFORM, i, name.size(), NULL, &name[0]);
+				AddUniform(&name[0], values[1], values[2], values[3]);
+			}
+			for (GLint i = 0; i < numBlocks; ++i)
+			{
+				glGetProgramResourceName(program, GL_UNIFORM_BLOCK, i, name.size(), NULL, &name[0]);
+				AddBlock(blocks, &name[0], i);
+			}
+
+			if (!GLEW_ARB_shader_storage_buffer_object)
+				return;
+			glGetProgramInterfaceiv(program, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &numBlocks);
+			glGetProgramInterfaceiv(program, GL_SHADER_STORAGE_BLOCK, GL_MAX_NAME_LENGTH, &blockMaxLength);
+			name.resize(std::max((GLint)name.size(), blockMaxLength));
+			for (GLint i = 0; i < numBlocks; ++i)
+			{
+				glGetProgramResourceName(program, GL_SHADER_STORAGE_BLOCK, i, name.size(), NULL, &name[0]);
+				AddBlock(storageBlocks, &name[0], i);
+			}
+		}
+		else
+		{
+			GLint numUniforms, numBlocks, maxLength, blockMaxLength;
+			glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+			glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+			glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numBlocks);
+			glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &blockMaxLength);
+			name.resize(std::max(std::max(maxLength, blockMaxLength), 1));
+
+			for (GLint i = 0; i < numUniforms; ++i)
+			{
+				GLuint index = i;
+				GLint blockIndex, arraySize;
+				GLenum type;
+				glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+				if (blockIndex != -1)
+					continue;
+				glGetActiveUniform(program, index, name.size(), NULL, &arraySize, &type, &name[0]);
+				AddUniform(&name[0], glGetUniformLocation(program, &name[0]), arraySize, type);
+			}
+			for (GLint i = 0; i < numBlocks; ++i)
+			{
+				glGetActiveUniformBlockName(program, i, name.size(), NULL, &name[0]);
+				AddBlock(blocks, &name[0], i);
+			}
+		}
+	}
+
+public:
+	// Returns the id of name, the same for every caller; meant for setup code
+	static UniformId Intern(const std::string& name)
+	{
+		std::unordered_map<std::string, UniformId>& names = GetNames();
+		std::unordered_map<std::string, UniformId>::iterator it = names.find(name);
+		if (it != names.end())
+			return it->second;
+
+		UniformId id = names.size();
+		names[name] = id;
+		return id;
+	}
+
+	// Returns the table of a linked program, reflecting it the first time
+	static const UniformTable& Get(GLuint program)
+	{
+		static std::map<GLuint, UniformTable*> tables;
+		std::map<GLuint, UniformTable*>::iterator it = tables.find(program);
+		if (it != tables.end())
+			return *it->second;
+
+		UniformTable* table = new UniformTable();
+		table->Reflect(program);
+		tables[program] = table;
+		return *table;
+	}
+
+	GLint GetLocation(UniformId id) const { return id < locations.size() ? locations[id] : -1; }
+	GLuint GetBlockIndex(UniformId id) const { return id < blocks.size() ? blocks[id] : GL_INVALID_INDEX; }
+	GLuint GetStorageBlockIndex(UniformId id) const { return id < storageBlocks.size() ? storageBlocks[id] : GL_INVALID_INDEX; }
+	const std::vector<UniformId>& GetSamplers() const { return samplers; }
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef VERTEX_H
+#define VERTEX_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+const GLuint POSITION_LENGTH	= 3;
+const GLuint NORMAL_LENGTH		= 3;
+const GLuint TEX_COORDS_LENGTH	= 2;
+const GLuint TANGENG_LENGTH		= 3;
+const GLuint VERTEX_LENGTH		= POSITION_LENGTH + NORMAL_LENGTH + TEX_COORDS_LENGTH + TANGENG_LENGTH;
+
+enum ATTRIBUTE_LOCATION
+{
+	POSITION = 0,
+	NORMAL,	
+	TEX_COORDS,
+	TANGENT,
+	INSTANCE_MODEL = 4,		// mat4, locations 4-7
+	INSTANCE_NORMAL = 8,	// mat3, locations 8-10
+	INSTANCE_MATERIAL = 11
+};
+
+typedef struct Vertex
+{	
+	glm::vec3 position;
+	glm::vec3 normal;	
+	glm::vec2 texCoords;
+	glm::vec3 tangent;
+
+	Vertex()
+	{
+		position	= glm::vec3(0.0f);
+		normal		= glm::vec3(0.0f);
+		texCoords	= glm::vec2(0.0f);
+		tangent		= glm::vec3(0.0f);
+	}
+
+	Vertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec2& texCoords, const glm::vec3& tangent)
+	{
+		this->position	= position;
+		this->normal	= normal;
+		this->texCoords = texCoords;
+		this->tangent	= tangent;
+	}
+} Vertex;
+
+enum VertexFormat
+{
+	VERTEX_FORMAT_FLOAT = 0,	// Vertex, 44 bytes
+	VERTEX_FORMAT_PACKED		// PackedVertex, 20 bytes
+};
+
+// Uniforms the vertex shaders use to decode packed vertices
+enum VERTEX_DECODE_LOCATION
+{
+	POSITION_SCALE = 15,
+	POSITION_OFFSET,
+	OCT_ENCODED
+};
+
+typedef struct PackedVertex
+{
+	GLushort position[4];	// unorm16 within the mesh bounds, w unused
+	GLshort normal[2];		// octahedral snorm16
+	GLushort texCoords[2];	// half float
+	GLshort tangent[2];		// octahedral snorm16
+
+	static glm::vec2 OctEncode(const glm::vec3& direction)
+	{
+		GLfloat sum = glm::abs(direction.x) + glm::abs(direction.y) + glm::abs(direction.z);
+		if (sum == 0.0f)
+			return glm::vec2(0.0f);
+
+		glm::vec3 v = direction / sum;
+		if (v.z >= 0.0f)
+			return glm::vec2(v.x, v.y);
+		return glm::vec2((1.0f - glm::abs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f),
+						 (1.0f - glm::abs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f));
+	}
+
+	PackedVertex() { }
+
+	PackedVertex(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		glm::vec3 extent = boundsMax - boundsMin;
+		for (GLuint i = 0; i < 3; ++i)
+			position[i] = glm::packUnorm1x16(extent[i] > 0.0f ? (vertex.position[i] - boundsMin[i]) / extent[i] : 0.0f);
+		position[3] = 0;
+
+		glm::vec2 n = OctEncode(vertex.normal);
+		glm::vec2 t = OctEncode(vertex.tangent);
+		for (GLuint i = 0; i < 2; ++i)
+		{
+			normal[i]	 = (GLshort)glm::packSnorm1x16(n[i]);
+			tangent[i]	 = (GLshort)glm::packSnorm1x16(t[i]);
+			texCoords[i] = glm::packHalf1x16(vertex.texCoords[i]);
+		}
+	}
+} PackedVertex;
+
+// Per-instance attributes, read once per instance from vertex binding 1
+typedef struct InstanceData
+{
+	glm::mat4 model;
+	glm::mat3 normal;	// inverse transpose of the upper 3x3 of model
+	GLuint material;
+
+	InstanceData() : model(1.0f), normal(1.0f), material(0) { }
+
+	InstanceData(const glm::mat4& model, GLuint material)
+	{
+		this->model	   = model;
+		this->normal   = glm::inverseTranspose(glm::mat3(model));
+		this->material = material;
+	}
+
+	// When model carries more than the object's transform, e.g. a position decode
+	InstanceData(const glm::mat4& model, const glm::mat3& normal, GLuint material)
+	{
+		this->model	   = model;
+		this->normal   = normal;
+		this->material = material;
+	}
+} InstanceData;
+
+#endif
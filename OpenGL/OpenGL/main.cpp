@@ -1,5 +1,7 @@
 #include <iostream>
+#include <cstdlib>
 #include <vector>
+#include <string>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
@@ -13,12 +15,32 @@
 #include "EventHandler.h"
 #include "Timer.h"
 #include "Renderer.h"
+#include "Benchmark.h"
 
 GLuint wndWidth  = 1024;
 GLuint wndHeight = 768;
 
 int main(int argc, char ** argv)
 {	
+	bool benchMDI = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::string(argv[i]) == "--bench-obj")
+		{
+			Benchmark::RunOBJ();
+			return 0;
+		}
+		if (std::string(argv[i]) == "--import-obj")
+		{
+			// --import-obj [file.obj [budget MB]]
+			std::string path = i + 1 < argc ? argv[i + 1] : "";
+			GLuint budgetMB = i + 2 < argc ? (GLuint)std::atoi(argv[i + 2]) : BENCHMARK_IMPORT_BUDGET_MB;
+			return Benchmark::RunImport(path, budgetMB) ? 0 : 1;
+		}
+		if (std::string(argv[i]) == "--bench-mdi")
+			benchMDI = true;
+	}
+
 	Display display(wndWidth, wndHeight);
 	Camera camera(glm::vec3(0.0f, 5.0f, 20.0f));
 
@@ -28,15 +50,18 @@ int main(int argc, char ** argv)
 
 	Renderer renderer(&camera, wndWidth, wndHeight);
 
-	float w = 25.0f;
-	glm::mat4 projectionOrtho = glm::ortho(-w, w, -w, w, 0.1f, 1000.0f);
 	glm::mat4 projectionPersp = glm::perspective(70.0f, (GLfloat)wndWidth / (GLfloat)wndHeight, 0.1f, 1000.0f);
-	glm::mat4 view		 = glm::lookAt(renderer.GetDirectionalLightPosition(), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-	glm::mat4 lightSpace = projectionOrtho * view;
+
+	if (benchMDI)
+	{
+		Benchmark::RunMDI(display, renderer, projectionPersp, camera.GetViewMatrix());
+		return 0;
+	}
 	
 	SDL_Event e;		
 	while (true)
 	{
+		renderer.BeginFrame();
 		display.Clear(0.2f, 0.2f, 0.2f, 1.0f);
 
 		timer.Tick();
@@ -81,21 +106,15 @@ int main(int argc, char ** argv)
 		renderer.SetDeltaTime((GLfloat)timer.DeltaTime());	
 
 		
-		renderer.SetProjectionMatrix(projectionOrtho);
-		renderer.SetViewMatrix(view);
-		display.RenderSceneToDepthMap();
-		renderer.RenderScene();
-		display.RenderSceneOnscreen();
-		//display.DisplayDepthMapContent();		
-		
+		// The shadow cascades follow the camera's frustum
 		renderer.SetProjectionMatrix(projectionPersp);
 		renderer.SetViewMatrix(camera.GetViewMatrix());
-		renderer.SetLightSpaceMatrix(lightSpace);
-		renderer.SetShadowMapTexture(display.GetShadowMapTexure());
+		renderer.RenderShadowCasters();
 		display.RenderSceneToFrameBuffer();
 		renderer.RenderScene();
 		display.DisplayFrameBufferContent();
 
+		renderer.EndFrame();
 		display.SwapBuffers();
 	}
 
@@ -1,56 +1,163 @@
 #include "obj_loader.h"
-#include <fstream>
+#include "MappedFile.h"
 #include <iostream>
 #include <algorithm>
-#include <map>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+
+static inline unsigned int HashOBJIndex(const OBJIndex& index);
+static inline const char* SkipWhitespace(const char* str, const char* end);
+static inline const char* FindTokenEnd(const char* str, const char* end);
+static inline unsigned int ParseOBJIndexValue(const char*& str, const char* end, unsigned int count, bool* relative);
+static inline float ParseOBJFloatValue(const char*& str, const char* end);
+static OBJIndex ParseOBJIndexTriple(const char* begin, const char* end, unsigned int vertexCount, unsigned int uvCount, unsigned int normalCount,
+    bool* hasUVs, bool* hasNormals, unsigned int* relativeMask);
+template<typename Handler>
+static void ForEachOBJLine(std::FILE* file, std::vector<char>& buffer, Handler handler);
+template<typename Handler>
+static void ForEachOBJTriangle(std::FILE* file, std::vector<char>& buffer, Handler handler);
 
-static bool CompareOBJIndexPtr(const OBJIndex* a, const OBJIndex* b);
-static inline unsigned int FindNextChar(unsigned int start, const char* str, unsigned int length, char token);
-static inline unsigned int ParseOBJIndexValue(const std::string& token, unsigned int start, unsigned int end);
-static inline float ParseOBJFloatValue(const std::string& token, unsigned int start, unsigned int end);
-static inline std::vector<std::string> SplitString(const std::string &s, char delim);
+//Files are only split when every worker gets at least this many bytes
+static const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+enum OBJIndexComponent
+{
+    OBJ_VERTEX_INDEX = 1,
+    OBJ_UV_INDEX = 2,
+    OBJ_NORMAL_INDEX = 4
+};
+
+OBJModel::OBJModel()
+{
+	hasUVs = false;
+	hasNormals = false;
+}
 
-OBJModel::OBJModel(const std::string& fileName)
+OBJModel::OBJModel(const std::string& fileName, unsigned int numThreads)
 {
 	hasUVs = false;
 	hasNormals = false;
-    std::ifstream file;
-    file.open(fileName.c_str());
+    MappedFile file(fileName);
 
-    std::string line;
-    if(file.is_open())
+    if(file.IsOpen())
     {
-        while(file.good())
-        {
-            getline(file, line);
+        if(numThreads == 0)
+            numThreads = std::max(std::thread::hardware_concurrency(), 1u);
         
-            unsigned int lineLength = line.length();
-            
-            if(lineLength < 2)
-                continue;
-            
-            const char* lineCStr = line.c_str();
-            
-            switch(lineCStr[0])
+        size_t numChunks = std::min((size_t)numThreads, file.Size() / MIN_CHUNK_SIZE);
+        
+        if(numChunks > 1)
+            ParseOBJChunks(file.Begin(), file.End(), numChunks);
+        else
+            ParseOBJLines(file.Begin(), file.End());
+        
+        relativeIndices.clear();
+    }
+    else
+    {
+        std::cerr << "Unable to load mesh: " << fileName << std::endl;
+    }
+}
+
+void OBJModel::ParseOBJChunks(const char* begin, const char* end, unsigned int numChunks)
+{
+    std::vector<const char*> boundaries(numChunks + 1);
+    size_t chunkSize = (end - begin) / numChunks;
+    
+    //Chunks always start at the beginning of a line
+    boundaries[0] = begin;
+    for(unsigned int i = 1; i < numChunks; i++)
+    {
+        const char* boundary = std::max(begin + i * chunkSize, boundaries[i - 1]);
+        const char* lineEnd = (const char*)memchr(boundary, '\n', end - boundary);
+        boundaries[i] = lineEnd == NULL ? end : lineEnd + 1;
+    }
+    boundaries[numChunks] = end;
+    
+    std::vector<OBJModel> chunks(numChunks, OBJModel());
+    std::vector<std::thread> workers;
+    
+    for(unsigned int i = 1; i < numChunks; i++)
+        workers.push_back(std::thread(&OBJModel::ParseOBJLines, &chunks[i], boundaries[i], boundaries[i + 1]));
+    
+    chunks[0].ParseOBJLines(boundaries[0], boundaries[1]);
+    
+    for(unsigned int i = 0; i < workers.size(); i++)
+        workers[i].join();
+    
+    //Merge in file order so the result matches a serial parse
+    for(unsigned int i = 0; i < numChunks; i++)
+    {
+        AppendOBJChunk(chunks[i]);
+        chunks[i] = OBJModel();
+    }
+}
+
+void OBJModel::AppendOBJChunk(OBJModel& chunk)
+{
+    unsigned int vertexBase = vertices.size();
+    unsigned int uvBase = uvs.size();
+    unsigned int normalBase = normals.size();
+    
+    for(unsigned int i = 0; i < chunk.relativeIndices.size(); i++)
+    {
+        OBJIndex& index = chunk.OBJIndices[chunk.relativeIndices[i].first];
+        unsigned int mask = chunk.relativeIndices[i].second;
+        
+        if(mask & OBJ_VERTEX_INDEX)
+            index.vertexIndex += vertexBase;
+        if(mask & OBJ_UV_INDEX)
+            index.uvIndex += uvBase;
+        if(mask & OBJ_NORMAL_INDEX)
+            index.normalIndex += normalBase;
+    }
+    
+    vertices.insert(vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+    uvs.insert(uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+    normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+    OBJIndices.insert(OBJIndices.end(), chunk.OBJIndices.begin(), chunk.OBJIndices.end());
+    
+    hasUVs = hasUVs || chunk.hasUVs;
+    hasNormals = hasNormals || chunk.hasNormals;
+}
+
+void OBJModel::ParseOBJLines(const char* begin, const char* end)
+{
+    const char* line = begin;
+    
+    while(line < end)
+    {
+        const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+        const char* nextLine = lineEnd == NULL ? end : lineEnd + 1;
+        
+        if(lineEnd == NULL)
+            lineEnd = end;
+        if(lineEnd > line && lineEnd[-1] == '\r')
+            lineEnd--;
+        
+        if(lineEnd - line >= 2)
+        {
+            switch(line[0])
             {
                 case 'v':
-                    if(lineCStr[1] == 't')
-                        this->uvs.push_back(ParseOBJVec2(line));
-                    else if(lineCStr[1] == 'n')
-                        this->normals.push_back(ParseOBJVec3(line));
-                    else if(lineCStr[1] == ' ' || lineCStr[1] == '\t')
-                        this->vertices.push_back(ParseOBJVec3(line));
+                    if(line[1] == 't')
+                        this->uvs.push_back(ParseOBJVec2(line + 2, lineEnd));
+                    else if(line[1] == 'n')
+                        this->normals.push_back(ParseOBJVec3(line + 2, lineEnd));
+                    else if(line[1] == ' ' || line[1] == '\t')
+                        this->vertices.push_back(ParseOBJVec3(line + 1, lineEnd));
                 break;
                 case 'f':
-                    CreateOBJFace(line);
+                    CreateOBJFace(line + 1, lineEnd);
                 break;
                 default: break;
             };
         }
-    }
-    else
-    {
-        std::cerr << "Unable to load mesh: " << fileName << std::endl;
+        
+        line = nextLine;
     }
 }
 
@@ -83,68 +190,78 @@ IndexedModel OBJModel::ToIndexedModel()
     
     unsigned int numIndices = OBJIndices.size();
     
-    std::vector<OBJIndex*> indexLookup;
+    //Open-addressing table keyed on the (position, uv, normal) index triple, sized to a
+    //power of two at least twice the corner count
+    unsigned int tableSize = 1;
+    while(tableSize < numIndices * 2)
+        tableSize <<= 1;
+    unsigned int tableMask = tableSize - 1;
     
-    for(unsigned int i = 0; i < numIndices; i++)
-        indexLookup.push_back(&OBJIndices[i]);
+    std::vector<unsigned int> tableValues(tableSize, (unsigned int)-1);
+    std::vector<OBJIndex> vertexKeys;	//index triple of every vertex of result
     
-    std::sort(indexLookup.begin(), indexLookup.end(), CompareOBJIndexPtr);
+    //Normals are generated on a model welded by position only
+    std::vector<unsigned int> normalModelIndices(vertices.size(), (unsigned int)-1);
+    std::vector<unsigned int> indexMap;
     
-    std::map<OBJIndex, unsigned int> normalModelIndexMap;
-    std::map<unsigned int, unsigned int> indexMap;
+    result.indices.reserve(numIndices);
+    normalModel.indices.reserve(numIndices);
     
     for(unsigned int i = 0; i < numIndices; i++)
     {
-        OBJIndex* currentIndex = &OBJIndices[i];
+        OBJIndex currentIndex = OBJIndices[i];
         
-        glm::vec3 currentPosition = vertices[currentIndex->vertexIndex];
+        if(!hasUVs)
+            currentIndex.uvIndex = 0;
+        if(!hasNormals)
+            currentIndex.normalIndex = 0;
+        
+        glm::vec3 currentPosition = vertices[currentIndex.vertexIndex];
         glm::vec2 currentTexCoord;
         glm::vec3 currentNormal;
         
         if(hasUVs)
-            currentTexCoord = uvs[currentIndex->uvIndex];
+            currentTexCoord = uvs[currentIndex.uvIndex];
         else
             currentTexCoord = glm::vec2(0,0);
             
         if(hasNormals)
-            currentNormal = normals[currentIndex->normalIndex];
+            currentNormal = normals[currentIndex.normalIndex];
         else
             currentNormal = glm::vec3(0,0,0);
         
-        unsigned int normalModelIndex;
-        unsigned int resultModelIndex;
-        
         //Create model to properly generate normals on
-        std::map<OBJIndex, unsigned int>::iterator it = normalModelIndexMap.find(*currentIndex);
-        if(it == normalModelIndexMap.end())
+        unsigned int normalModelIndex = normalModelIndices[currentIndex.vertexIndex];
+        if(normalModelIndex == (unsigned int)-1)
         {
             normalModelIndex = normalModel.positions.size();
-        
-            normalModelIndexMap.insert(std::pair<OBJIndex, unsigned int>(*currentIndex, normalModelIndex));
+            normalModelIndices[currentIndex.vertexIndex] = normalModelIndex;
+            
             normalModel.positions.push_back(currentPosition);
             normalModel.texCoords.push_back(currentTexCoord);
             normalModel.normals.push_back(currentNormal);
         }
-        else
-            normalModelIndex = it->second;
         
         //Create model which properly separates texture coordinates
-        unsigned int previousVertexLocation = FindLastVertexIndex(indexLookup, currentIndex, result);
+        unsigned int slot = HashOBJIndex(currentIndex) & tableMask;
+        while(tableValues[slot] != (unsigned int)-1 && !(vertexKeys[tableValues[slot]] == currentIndex))
+            slot = (slot + 1) & tableMask;
         
-        if(previousVertexLocation == (unsigned int)-1)
+        unsigned int resultModelIndex = tableValues[slot];
+        if(resultModelIndex == (unsigned int)-1)
         {
             resultModelIndex = result.positions.size();
+            tableValues[slot] = resultModelIndex;
+            vertexKeys.push_back(currentIndex);
         
             result.positions.push_back(currentPosition);
             result.texCoords.push_back(currentTexCoord);
             result.normals.push_back(currentNormal);
+            indexMap.push_back(normalModelIndex);
         }
-        else
-            resultModelIndex = previousVertexLocation;
         
         normalModel.indices.push_back(normalModelIndex);
         result.indices.push_back(resultModelIndex);
-        indexMap.insert(std::pair<unsigned int, unsigned int>(resultModelIndex, normalModelIndex));
     }
     
     if(!hasNormals)
@@ -158,248 +275,631 @@ IndexedModel OBJModel::ToIndexedModel()
     return result;
 };
 
-unsigned int OBJModel::FindLastVertexIndex(const std::vector<OBJIndex*>& indexLookup, const OBJIndex* currentIndex, const IndexedModel& result)
+void OBJModel::CreateOBJFace(const char* begin, const char* end)
 {
-    unsigned int start = 0;
-    unsigned int end = indexLookup.size();
-    unsigned int current = (end - start) / 2 + start;
-    unsigned int previous = start;
-    
-    while(current != previous)
+    //Polygons are triangulated as a fan around their first corner
+    OBJIndex first;
+    OBJIndex previous;
+    unsigned int firstMask = 0;
+    unsigned int previousMask = 0;
+    unsigned int numCorners = 0;
+    
+    const char* token = SkipWhitespace(begin, end);
+    while(token < end)
     {
-        OBJIndex* testIndex = indexLookup[current];
+        const char* tokenEnd = FindTokenEnd(token, end);
+        unsigned int currentMask = 0;
+        OBJIndex current = ParseOBJIndex(token, tokenEnd, &this->hasUVs, &this->hasNormals, &currentMask);
         
-        if(testIndex->vertexIndex == currentIndex->vertexIndex)
+        if(numCorners == 0)
         {
-            unsigned int countStart = current;
-        
-            for(unsigned int i = 0; i < current; i++)
-            {
-                OBJIndex* possibleIndex = indexLookup[current - i];
-                
-                if(possibleIndex == currentIndex)
-                    continue;
-                    
-                if(possibleIndex->vertexIndex != currentIndex->vertexIndex)
-                    break;
-                    
-                countStart--;
-            }
-            
-            for(unsigned int i = countStart; i < indexLookup.size() - countStart; i++)
-            {
-                OBJIndex* possibleIndex = indexLookup[current + i];
-                
-                if(possibleIndex == currentIndex)
-                    continue;
-                    
-                if(possibleIndex->vertexIndex != currentIndex->vertexIndex)
-                    break;
-                else if((!hasUVs || possibleIndex->uvIndex == currentIndex->uvIndex) 
-                    && (!hasNormals || possibleIndex->normalIndex == currentIndex->normalIndex))
-                {
-                    glm::vec3 currentPosition = vertices[currentIndex->vertexIndex];
-                    glm::vec2 currentTexCoord;
-                    glm::vec3 currentNormal;
-                    
-                    if(hasUVs)
-                        currentTexCoord = uvs[currentIndex->uvIndex];
-                    else
-                        currentTexCoord = glm::vec2(0,0);
-                        
-                    if(hasNormals)
-                        currentNormal = normals[currentIndex->normalIndex];
-                    else
-                        currentNormal = glm::vec3(0,0,0);
-                    
-                    for(unsigned int j = 0; j < result.positions.size(); j++)
-                    {
-                        if(currentPosition == result.positions[j] 
-                            && ((!hasUVs || currentTexCoord == result.texCoords[j])
-                            && (!hasNormals || currentNormal == result.normals[j])))
-                        {
-                            return j;
-                        }
-                    }
-                }
-            }
-        
-            return -1;
+            first = current;
+            firstMask = currentMask;
         }
-        else
+        else if(numCorners >= 2)
         {
-            if(testIndex->vertexIndex < currentIndex->vertexIndex)
-                start = current;
-            else
-                end = current;
+            PushOBJCorner(first, firstMask);
+            PushOBJCorner(previous, previousMask);
+            PushOBJCorner(current, currentMask);
         }
-    
+        
         previous = current;
-        current = (end - start) / 2 + start;
+        previousMask = currentMask;
+        numCorners++;
+        token = SkipWhitespace(tokenEnd, end);
     }
-    
-    return -1;
 }
 
-void OBJModel::CreateOBJFace(const std::string& line)
+void OBJModel::PushOBJCorner(const OBJIndex& index, unsigned int relativeMask)
 {
-    std::vector<std::string> tokens = SplitString(line, ' ');
-
-    this->OBJIndices.push_back(ParseOBJIndex(tokens[1], &this->hasUVs, &this->hasNormals));
-    this->OBJIndices.push_back(ParseOBJIndex(tokens[2], &this->hasUVs, &this->hasNormals));
-    this->OBJIndices.push_back(ParseOBJIndex(tokens[3], &this->hasUVs, &this->hasNormals));
+    if(relativeMask != 0)
+        this->relativeIndices.push_back(std::make_pair((unsigned int)this->OBJIndices.size(), relativeMask));
+    
+    this->OBJIndices.push_back(index);
+}
 
-    if((int)tokens.size() > 4)
-    {
-        this->OBJIndices.push_back(ParseOBJIndex(tokens[1], &this->hasUVs, &this->hasNormals));
-        this->OBJIndices.push_back(ParseOBJIndex(tokens[3], &this->hasUVs, &this->hasNormals));
-        this->OBJIndices.push_back(ParseOBJIndex(tokens[4], &this->hasUVs, &this->hasNormals));
-    }
+OBJIndex OBJModel::ParseOBJIndex(const char* begin, const char* end, bool* hasUVs, bool* hasNormals, unsigned int* relativeMask)
+{
+    return ParseOBJIndexTriple(begin, end, this->vertices.size(), this->uvs.size(), this->normals.size(), hasUVs, hasNormals, relativeMask);
 }
 
-OBJIndex OBJModel::ParseOBJIndex(const std::string& token, bool* hasUVs, bool* hasNormals)
+glm::vec3 OBJModel::ParseOBJVec3(const char* begin, const char* end) 
 {
-    unsigned int tokenLength = token.length();
-    const char* tokenString = token.c_str();
+    const char* str = begin;
     
-    unsigned int vertIndexStart = 0;
-    unsigned int vertIndexEnd = FindNextChar(vertIndexStart, tokenString, tokenLength, '/');
+    float x = ParseOBJFloatValue(str, end);
+    float y = ParseOBJFloatValue(str, end);
+    float z = ParseOBJFloatValue(str, end);
     
-    OBJIndex result;
-    result.vertexIndex = ParseOBJIndexValue(token, vertIndexStart, vertIndexEnd);
-    result.uvIndex = 0;
-    result.normalIndex = 0;
+    return glm::vec3(x,y,z);
+}
+
+glm::vec2 OBJModel::ParseOBJVec2(const char* begin, const char* end)
+{
+    const char* str = begin;
     
-    if(vertIndexEnd >= tokenLength)
-        return result;
+    float x = ParseOBJFloatValue(str, end);
+    float y = ParseOBJFloatValue(str, end);
     
-    vertIndexStart = vertIndexEnd + 1;
-    vertIndexEnd = FindNextChar(vertIndexStart, tokenString, tokenLength, '/');
+    return glm::vec2(x,y);
+}
+
+static const size_t STREAM_READ_BUFFER_SIZE = 1 << 20;
+static const unsigned int STREAM_INDICES_PER_VERTEX = 6;
+static const unsigned int STREAM_MIN_BATCH_VERTICES = 1024;
+static const unsigned int STREAM_MAX_TABLE_SIZE = 1u << 30;
+
+//Working memory per batch vertex, with the weld table at half load
+static const size_t STREAM_BYTES_PER_VERTEX = 2 * sizeof(glm::vec3) + sizeof(glm::vec2)
+    + 2 * (sizeof(OBJIndex) + sizeof(unsigned int))
+    + STREAM_INDICES_PER_VERTEX * sizeof(unsigned int);
+
+OBJStreamImporter::OBJStreamImporter(size_t memoryBudget)
+{
+    this->memoryBudget = memoryBudget;
+    maxBatchVertices = 0;
+    maxBatchIndices = 0;
+    tableMask = 0;
+    droppedTriangles = 0;
     
-    result.uvIndex = ParseOBJIndexValue(token, vertIndexStart, vertIndexEnd);
-    *hasUVs = true;
+    if(memoryBudget < GetMinMemory())
+    {
+        std::cerr << "Memory budget of " << memoryBudget << " bytes is below the " << GetMinMemory() << " the importer needs" << std::endl;
+        return;
+    }
     
-    if(vertIndexEnd >= tokenLength)
-        return result;
+    size_t available = memoryBudget - STREAM_READ_BUFFER_SIZE;
+    unsigned int tableSize = 2 * STREAM_MIN_BATCH_VERTICES;
+    //Doubling the table doubles the batch, which costs another tableSize / 2 vertices
+    while(tableSize < STREAM_MAX_TABLE_SIZE && (size_t)tableSize * STREAM_BYTES_PER_VERTEX <= available)
+        tableSize <<= 1;
     
-    vertIndexStart = vertIndexEnd + 1;
-    vertIndexEnd = FindNextChar(vertIndexStart, tokenString, tokenLength, '/');
+    maxBatchVertices = tableSize / 2;
+    maxBatchIndices = maxBatchVertices * STREAM_INDICES_PER_VERTEX;
+    tableMask = tableSize - 1;
     
-    result.normalIndex = ParseOBJIndexValue(token, vertIndexStart, vertIndexEnd);
-    *hasNormals = true;
+    readBuffer.resize(STREAM_READ_BUFFER_SIZE);
+    batch.positions.reserve(maxBatchVertices);
+    batch.texCoords.reserve(maxBatchVertices);
+    batch.normals.reserve(maxBatchVertices);
+    batch.indices.reserve(maxBatchIndices);
     
-    return result;
+    weldKeys.resize(tableSize);
+    weldValues.resize(tableSize, (unsigned int)-1);
 }
 
-glm::vec3 OBJModel::ParseOBJVec3(const std::string& line) 
+size_t OBJStreamImporter::GetMinMemory()
 {
-    unsigned int tokenLength = line.length();
-    const char* tokenString = line.c_str();
-    
-    unsigned int vertIndexStart = 2;
+    return STREAM_READ_BUFFER_SIZE + STREAM_MIN_BATCH_VERTICES * STREAM_BYTES_PER_VERTEX;
+}
+
+size_t OBJStreamImporter::GetPeakMemory() const
+{
+    return readBuffer.capacity()
+        + batch.positions.capacity() * sizeof(glm::vec3)
+        + batch.texCoords.capacity() * sizeof(glm::vec2)
+        + batch.normals.capacity() * sizeof(glm::vec3)
+        + batch.indices.capacity() * sizeof(unsigned int)
+        + weldKeys.capacity() * sizeof(OBJIndex)
+        + weldValues.capacity() * sizeof(unsigned int);
+}
+
+bool OBJStreamImporter::Import(const std::string& fileName, const std::string& scratchPath, const BatchSink& sink)
+{
+    if(maxBatchVertices == 0)
+    {
+        std::cerr << "Unable to import " << fileName << " within " << memoryBudget << " bytes" << std::endl;
+        return false;
+    }
     
-    while(vertIndexStart < tokenLength)
+    std::FILE* file = std::fopen(fileName.c_str(), "rb");
+    if(file == NULL)
     {
-        if(tokenString[vertIndexStart] != ' ')
-            break;
-        vertIndexStart++;
+        std::cerr << "Unable to load mesh: " << fileName << std::endl;
+        return false;
     }
     
-    unsigned int vertIndexEnd = FindNextChar(vertIndexStart, tokenString, tokenLength, ' ');
+    std::string positionsPath = scratchPath + ".v";
+    std::string uvsPath = scratchPath + ".vt";
+    std::string normalsPath = scratchPath + ".vn";
+    bool written;
     
-    float x = ParseOBJFloatValue(line, vertIndexStart, vertIndexEnd);
+    hasUVs = false;
+    hasNormals = false;
+    droppedTriangles = 0;
     
-    vertIndexStart = vertIndexEnd + 1;
-    vertIndexEnd = FindNextChar(vertIndexStart, tokenString, tokenLength, ' ');
+    //Pass 1: spill the raw attributes and find out which ones the faces use
+    {
+        std::ofstream positionsOut(positionsPath.c_str(), std::ios::binary | std::ios::trunc);
+        std::ofstream uvsOut(uvsPath.c_str(), std::ios::binary | std::ios::trunc);
+        std::ofstream normalsOut(normalsPath.c_str(), std::ios::binary | std::ios::trunc);
+        
+        totals[0] = totals[1] = totals[2] = 0;
+        
+        ForEachOBJLine(file, readBuffer, [&](const char* line, const char* lineEnd)
+        {
+            if(line[0] == 'v')
+            {
+                const char* str = line + 2;
+                float values[3];
+                
+                if(line[1] == 't')
+                {
+                    values[0] = ParseOBJFloatValue(str, lineEnd);
+                    values[1] = ParseOBJFloatValue(str, lineEnd);
+                    uvsOut.write((const char*)values, 2 * sizeof(float));
+                    totals[1]++;
+                }
+                else if(line[1] == 'n' || line[1] == ' ' || line[1] == '\t')
+                {
+                    str = line[1] == 'n' ? line + 2 : line + 1;
+                    values[0] = ParseOBJFloatValue(str, lineEnd);
+                    values[1] = ParseOBJFloatValue(str, lineEnd);
+                    values[2] = ParseOBJFloatValue(str, lineEnd);
+                    
+                    if(line[1] == 'n')
+                    {
+                        normalsOut.write((const char*)values, 3 * sizeof(float));
+                        totals[2]++;
+                    }
+                    else
+                    {
+                        positionsOut.write((const char*)values, 3 * sizeof(float));
+                        totals[0]++;
+                    }
+                }
+            }
+            else if(line[0] == 'f')
+            {
+                unsigned int relativeMask = 0;
+                const char* token = SkipWhitespace(line + 1, lineEnd);
+                while(token < lineEnd)
+                {
+                    const char* tokenEnd = FindTokenEnd(token, lineEnd);
+                    ParseOBJIndexTriple(token, tokenEnd, 0, 0, 0, &hasUVs, &hasNormals, &relativeMask);
+                    token = SkipWhitespace(tokenEnd, lineEnd);
+                }
+            }
+        });
+        
+        written = positionsOut.good() && uvsOut.good() && normalsOut.good();
+    }
     
-    float y = ParseOBJFloatValue(line, vertIndexStart, vertIndexEnd);
+    //Without normals in the file the .vn scratch file is free to hold the summed ones
+    if(written && !hasNormals)
+        written = SumFaceNormals(file, positionsPath, normalsPath);
     
-    vertIndexStart = vertIndexEnd + 1;
-    vertIndexEnd = FindNextChar(vertIndexStart, tokenString, tokenLength, ' ');
+    //Pass 2: weld faces into batches against the mapped attributes
+    if(written)
+    {
+        MappedFile positionsIn(positionsPath);
+        MappedFile uvsIn(uvsPath);
+        MappedFile normalsIn(normalsPath);
+        
+        positions = (const glm::vec3*)positionsIn.Begin();
+        uvs = (const glm::vec2*)uvsIn.Begin();
+        normals = (const glm::vec3*)normalsIn.Begin();
+        
+        std::rewind(file);
+        ForEachOBJTriangle(file, readBuffer, [&](const OBJIndex* corners)
+        {
+            AddTriangle(corners, sink);
+        });
+        
+        Flush(sink);
+        
+        positions = NULL;
+        uvs = NULL;
+        normals = NULL;
+        
+        if(droppedTriangles > 0)
+            std::cerr << "Skipped " << droppedTriangles << " triangles with out-of-range indices in " << fileName << std::endl;
+    }
+    else
+    {
+        std::cerr << "Unable to write scratch files: " << scratchPath << std::endl;
+    }
     
-    float z = ParseOBJFloatValue(line, vertIndexStart, vertIndexEnd);
+    std::fclose(file);
+    std::remove(positionsPath.c_str());
+    std::remove(uvsPath.c_str());
+    std::remove(normalsPath.c_str());
     
-    return glm::vec3(x,y,z);
+    return written;
+}
+
+bool OBJStreamImporter::IsInRange(const OBJIndex& index) const
+{
+    return index.vertexIndex < totals[0] && (!hasUVs || index.uvIndex < totals[1]) && (!hasNormals || index.normalIndex < totals[2]);
+}
 
-    //glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()))
+//Sums the face normals of every position into a zero-filled file at sumsPath, mapped writable
+bool OBJStreamImporter::SumFaceNormals(std::FILE* file, const std::string& positionsPath, const std::string& sumsPath)
+{
+    if(totals[0] == 0)
+        return true;
+    
+    {
+        std::ofstream sumsOut(sumsPath.c_str(), std::ios::binary | std::ios::trunc);
+        sumsOut.seekp((std::streamoff)totals[0] * sizeof(glm::vec3) - 1);
+        sumsOut.put(0);
+        if(!sumsOut.good())
+            return false;
+    }
+    
+    MappedFile positionsIn(positionsPath);
+    MappedFile sumsIn(sumsPath, true);
+    glm::vec3* sums = (glm::vec3*)sumsIn.WritableBegin();
+    const glm::vec3* facePositions = (const glm::vec3*)positionsIn.Begin();
+    if(sums == NULL || facePositions == NULL)
+        return false;
+    
+    std::rewind(file);
+    ForEachOBJTriangle(file, readBuffer, [&](const OBJIndex* corners)
+    {
+        if(!IsInRange(corners[0]) || !IsInRange(corners[1]) || !IsInRange(corners[2]))
+            return;
+        
+        glm::vec3 v1 = facePositions[corners[1].vertexIndex] - facePositions[corners[0].vertexIndex];
+        glm::vec3 v2 = facePositions[corners[2].vertexIndex] - facePositions[corners[0].vertexIndex];
+        glm::vec3 faceNormal = glm::normalize(glm::cross(v1, v2));
+        for(unsigned int i = 0; i < 3; i++)
+            sums[corners[i].vertexIndex] += faceNormal;
+    });
+    return true;
 }
 
-glm::vec2 OBJModel::ParseOBJVec2(const std::string& line)
+void OBJStreamImporter::AddTriangle(const OBJIndex* corners, const BatchSink& sink)
 {
-    unsigned int tokenLength = line.length();
-    const char* tokenString = line.c_str();
+    OBJIndex keys[3];
     
-    unsigned int vertIndexStart = 3;
+    for(unsigned int i = 0; i < 3; i++)
+    {
+        if(!IsInRange(corners[i]))
+        {
+            droppedTriangles++;
+            return;
+        }
+        
+        keys[i] = corners[i];
+        if(!hasUVs)
+            keys[i].uvIndex = 0;
+        if(!hasNormals)
+            keys[i].normalIndex = 0;
+    }
     
-    while(vertIndexStart < tokenLength)
+    if(batch.positions.size() + 3 > maxBatchVertices || batch.indices.size() + 3 > maxBatchIndices)
+        Flush(sink);
+    
+    for(unsigned int i = 0; i < 3; i++)
+        batch.indices.push_back(AddVertex(keys[i]));
+}
+
+unsigned int OBJStreamImporter::AddVertex(const OBJIndex& index)
+{
+    unsigned int slot = HashOBJIndex(index) & tableMask;
+    while(weldValues[slot] != (unsigned int)-1 && !(weldKeys[slot] == index))
+        slot = (slot + 1) & tableMask;
+    
+    unsigned int vertex = weldValues[slot];
+    if(vertex == (unsigned int)-1)
     {
-        if(tokenString[vertIndexStart] != ' ')
-            break;
-        vertIndexStart++;
+        vertex = batch.positions.size();
+        weldKeys[slot] = index;
+        weldValues[slot] = vertex;
+        
+        batch.positions.push_back(positions[index.vertexIndex]);
+        batch.texCoords.push_back(hasUVs ? uvs[index.uvIndex] : glm::vec2(0,0));
+        batch.normals.push_back(hasNormals ? normals[index.normalIndex] : glm::normalize(normals[index.vertexIndex]));
     }
     
-    unsigned int vertIndexEnd = FindNextChar(vertIndexStart, tokenString, tokenLength, ' ');
+    return vertex;
+}
+
+void OBJStreamImporter::Flush(const BatchSink& sink)
+{
+    if(batch.indices.empty())
+        return;
     
-    float x = ParseOBJFloatValue(line, vertIndexStart, vertIndexEnd);
+    sink(batch);
     
-    vertIndexStart = vertIndexEnd + 1;
-    vertIndexEnd = FindNextChar(vertIndexStart, tokenString, tokenLength, ' ');
+    batch.positions.clear();
+    batch.texCoords.clear();
+    batch.normals.clear();
+    batch.indices.clear();
+    std::fill(weldValues.begin(), weldValues.end(), (unsigned int)-1);
+}
+
+//Calls handler(corners) for every triangle of the faces of the file, polygons split
+//as a fan around their first corner; relative indices are resolved against the
+//attributes read so far
+template<typename Handler>
+static void ForEachOBJTriangle(std::FILE* file, std::vector<char>& buffer, Handler handler)
+{
+    unsigned int counts[3] = { 0, 0, 0 };
     
-    float y = ParseOBJFloatValue(line, vertIndexStart, vertIndexEnd);
+    ForEachOBJLine(file, buffer, [&](const char* line, const char* lineEnd)
+    {
+        if(line[0] == 'v')
+        {
+            if(line[1] == 't')
+                counts[1]++;
+            else if(line[1] == 'n')
+                counts[2]++;
+            else if(line[1] == ' ' || line[1] == '\t')
+                counts[0]++;
+        }
+        else if(line[0] == 'f')
+        {
+            OBJIndex corners[3];
+            unsigned int numCorners = 0;
+            bool faceHasUVs = false, faceHasNormals = false;
+            unsigned int relativeMask = 0;
+            
+            const char* token = SkipWhitespace(line + 1, lineEnd);
+            while(token < lineEnd)
+            {
+                const char* tokenEnd = FindTokenEnd(token, lineEnd);
+                OBJIndex current = ParseOBJIndexTriple(token, tokenEnd, counts[0], counts[1], counts[2], &faceHasUVs, &faceHasNormals, &relativeMask);
+                
+                if(numCorners == 0)
+                    corners[0] = current;
+                else if(numCorners >= 2)
+                {
+                    corners[2] = current;
+                    handler(corners);
+                }
+                
+                corners[1] = current;
+                numCorners++;
+                token = SkipWhitespace(tokenEnd, lineEnd);
+            }
+        }
+    });
+}
+
+//Calls handler(line, lineEnd) for every line of at least two characters while
+//reading through the fixed-size buffer; lines longer than the buffer are split
+template<typename Handler>
+static void ForEachOBJLine(std::FILE* file, std::vector<char>& buffer, Handler handler)
+{
+    size_t filled = 0;
+    bool endOfFile = false;
     
-    return glm::vec2(x,y);
+    while(!endOfFile || filled > 0)
+    {
+        if(!endOfFile)
+        {
+            size_t requested = buffer.size() - filled;
+            size_t numRead = std::fread(&buffer[filled], 1, requested, file);
+            filled += numRead;
+            endOfFile = numRead < requested;
+        }
+        
+        const char* begin = &buffer[0];
+        const char* end = begin + filled;
+        const char* line = begin;
+        
+        while(line < end)
+        {
+            const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+            
+            //Keep an unfinished line for the next read unless it fills the buffer
+            if(lineEnd == NULL && !endOfFile && line != begin)
+                break;
+            
+            const char* nextLine = lineEnd == NULL ? end : lineEnd + 1;
+            if(lineEnd == NULL)
+                lineEnd = end;
+            if(lineEnd > line && lineEnd[-1] == '\r')
+                lineEnd--;
+            
+            if(lineEnd - line >= 2)
+                handler(line, lineEnd);
+            
+            line = nextLine;
+        }
+        
+        size_t consumed = line - begin;
+        memmove(&buffer[0], line, filled - consumed);
+        filled -= consumed;
+    }
 }
 
-static bool CompareOBJIndexPtr(const OBJIndex* a, const OBJIndex* b)
+static inline unsigned int HashOBJIndex(const OBJIndex& index)
 {
-    return a->vertexIndex < b->vertexIndex;
+    unsigned int hash = index.vertexIndex * 73856093u;
+    hash ^= index.uvIndex * 19349663u;
+    hash ^= index.normalIndex * 83492791u;
+    return hash ^ (hash >> 16);
 }
 
-static inline unsigned int FindNextChar(unsigned int start, const char* str, unsigned int length, char token)
+static OBJIndex ParseOBJIndexTriple(const char* begin, const char* end, unsigned int vertexCount, unsigned int uvCount, unsigned int normalCount,
+    bool* hasUVs, bool* hasNormals, unsigned int* relativeMask)
 {
-    unsigned int result = start;
-    while(result < length)
+    const char* str = begin;
+    bool relative = false;
+    
+    OBJIndex result;
+    result.vertexIndex = ParseOBJIndexValue(str, end, vertexCount, &relative);
+    if(relative)
+        *relativeMask |= OBJ_VERTEX_INDEX;
+    result.uvIndex = 0;
+    result.normalIndex = 0;
+    
+    if(str >= end || *str != '/')
+        return result;
+    
+    str++;
+    if(str < end && *str != '/')
     {
-        result++;
-        if(str[result] == token)
-            break;
+        relative = false;
+        result.uvIndex = ParseOBJIndexValue(str, end, uvCount, &relative);
+        if(relative)
+            *relativeMask |= OBJ_UV_INDEX;
+        *hasUVs = true;
+    }
+    
+    if(str >= end || *str != '/')
+        return result;
+    
+    str++;
+    if(str < end)
+    {
+        relative = false;
+        result.normalIndex = ParseOBJIndexValue(str, end, normalCount, &relative);
+        if(relative)
+            *relativeMask |= OBJ_NORMAL_INDEX;
+        *hasNormals = true;
     }
     
     return result;
 }
 
-static inline unsigned int ParseOBJIndexValue(const std::string& token, unsigned int start, unsigned int end)
+static inline const char* SkipWhitespace(const char* str, const char* end)
 {
-    return atoi(token.substr(start, end - start).c_str()) - 1;
+    while(str < end && (*str == ' ' || *str == '\t'))
+        str++;
+    
+    return str;
 }
 
-static inline float ParseOBJFloatValue(const std::string& token, unsigned int start, unsigned int end)
+static inline const char* FindTokenEnd(const char* str, const char* end)
 {
-    return atof(token.substr(start, end - start).c_str());
+    while(str < end && *str != ' ' && *str != '\t')
+        str++;
+    
+    return str;
 }
 
-static inline std::vector<std::string> SplitString(const std::string &s, char delim)
+//Negative indices count back from the last element parsed so far; they are
+//returned relative to the current chunk and flagged for rebasing
+static inline unsigned int ParseOBJIndexValue(const char*& str, const char* end, unsigned int count, bool* relative)
 {
-    std::vector<std::string> elems;
-        
-    const char* cstr = s.c_str();
-    unsigned int strLength = s.length();
-    unsigned int start = 0;
-    unsigned int end = 0;
-        
-    while(end <= strLength)
+    bool negative = str < end && *str == '-';
+    if(negative)
+        str++;
+    
+    unsigned int value = 0;
+    
+    while(str < end && *str >= '0' && *str <= '9')
+    {
+        value = value * 10 + (*str - '0');
+        str++;
+    }
+    
+    if(negative)
     {
-        while(end <= strLength)
+        *relative = true;
+        return count - value;
+    }
+    
+    return value - 1;
+}
+
+//Locale-independent decimal parser working in place on the mapped file.
+//Up to 19 significant digits are accumulated exactly and scaled once by an
+//exact power of ten, which matches atof for the values found in OBJ files.
+static inline float ParseOBJFloatValue(const char*& str, const char* end)
+{
+    static const double POWERS_OF_TEN[] =
+    {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const int MAX_EXACT_POWER = 22;
+    const int MAX_DIGITS = 19;
+    
+    str = SkipWhitespace(str, end);
+    
+    bool negative = false;
+    if(str < end && (*str == '-' || *str == '+'))
+    {
+        negative = *str == '-';
+        str++;
+    }
+    
+    unsigned long long mantissa = 0;
+    int numDigits = 0;
+    int exponent = 0;
+    
+    while(str < end && *str >= '0' && *str <= '9')
+    {
+        if(numDigits < MAX_DIGITS)
         {
-            if(cstr[end] == delim)
-                break;
-            end++;
+            mantissa = mantissa * 10 + (*str - '0');
+            if(mantissa != 0)
+                numDigits++;
+        }
+        else
+            exponent++;
+        str++;
+    }
+    
+    if(str < end && *str == '.')
+    {
+        str++;
+        while(str < end && *str >= '0' && *str <= '9')
+        {
+            if(numDigits < MAX_DIGITS)
+            {
+                mantissa = mantissa * 10 + (*str - '0');
+                if(mantissa != 0)
+                    numDigits++;
+                exponent--;
+            }
+            str++;
         }
-            
-        elems.push_back(s.substr(start, end - start));
-        start = end + 1;
-        end = start;
     }
+    
+    if(str < end && (*str == 'e' || *str == 'E'))
+    {
+        str++;
+        bool negativeExponent = false;
+        if(str < end && (*str == '-' || *str == '+'))
+        {
+            negativeExponent = *str == '-';
+            str++;
+        }
         
-    return elems;
+        int value = 0;
+        while(str < end && *str >= '0' && *str <= '9')
+        {
+            if(value < 10000)
+                value = value * 10 + (*str - '0');
+            str++;
+        }
+        exponent += negativeExponent ? -value : value;
+    }
+    
+    double result = (double)mantissa;
+    if(mantissa != 0)
+    {
+        if(exponent < 0)
+            result = -exponent <= MAX_EXACT_POWER ? result / POWERS_OF_TEN[-exponent] : result * std::pow(10.0, exponent);
+        else if(exponent > 0)
+            result = exponent <= MAX_EXACT_POWER ? result * POWERS_OF_TEN[exponent] : result * std::pow(10.0, exponent);
+    }
+    
+    return (float)(negative ? -result : result);
 }
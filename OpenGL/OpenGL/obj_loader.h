@@ -2,8 +2,11 @@
 #define OBJ_LOADER_H_INCLUDED
 
 #include <glm/glm.hpp>
+#include <cstdio>
 #include <vector>
 #include <string>
+#include <utility>
+#include <functional>
 
 struct OBJIndex
 {
@@ -12,6 +15,7 @@ struct OBJIndex
     unsigned int normalIndex;
     
     bool operator<(const OBJIndex& r) const { return vertexIndex < r.vertexIndex; }
+    bool operator==(const OBJIndex& r) const { return vertexIndex == r.vertexIndex && uvIndex == r.uvIndex && normalIndex == r.normalIndex; }
 };
 
 class IndexedModel
@@ -35,16 +39,77 @@ public:
     bool hasUVs;
     bool hasNormals;
     
-    OBJModel(const std::string& fileName);
+    //numThreads == 0 uses one worker per hardware thread
+    OBJModel(const std::string& fileName, unsigned int numThreads = 0);
     
+    //Every repeated (position, uv, normal) triple shares one vertex
     IndexedModel ToIndexedModel();
 private:
-    unsigned int FindLastVertexIndex(const std::vector<OBJIndex*>& indexLookup, const OBJIndex* currentIndex, const IndexedModel& result);
-    void CreateOBJFace(const std::string& line);
+    //Corners holding negative (relative) OBJ indices, paired with a mask of
+    //the affected components; they are rebased when chunks are merged
+    std::vector<std::pair<unsigned int, unsigned int> > relativeIndices;
     
-    glm::vec2 ParseOBJVec2(const std::string& line);
-    glm::vec3 ParseOBJVec3(const std::string& line);
-    OBJIndex ParseOBJIndex(const std::string& token, bool* hasUVs, bool* hasNormals);
+    OBJModel();
+    
+    void ParseOBJLines(const char* begin, const char* end);
+    void ParseOBJChunks(const char* begin, const char* end, unsigned int numChunks);
+    void AppendOBJChunk(OBJModel& chunk);
+    void PushOBJCorner(const OBJIndex& index, unsigned int relativeMask);
+    void CreateOBJFace(const char* begin, const char* end);
+    
+    glm::vec2 ParseOBJVec2(const char* begin, const char* end);
+    glm::vec3 ParseOBJVec3(const char* begin, const char* end);
+    OBJIndex ParseOBJIndex(const char* begin, const char* end, bool* hasUVs, bool* hasNormals, unsigned int* relativeMask);
+};
+
+//Imports OBJ files larger than memory. The raw attributes are spilled to
+//scratch files that are mapped back on demand, and faces are welded into
+//self-contained indexed batches that are handed to the sink one at a time.
+//All working buffers are reserved up front from the memory budget and reused.
+//Files without normals get smooth ones, summed per position over the whole file
+//in a mapped scratch file, so batches sharing a position agree on its normal.
+class OBJStreamImporter
+{
+public:
+    typedef std::function<void(const IndexedModel& batch)> BatchSink;
+    
+    //Budgets below GetMinMemory() are rejected: Import fails without reading the file
+    OBJStreamImporter(size_t memoryBudget);
+    
+    //Scratch files are created as scratchPath + ".v/.vt/.vn" and removed afterwards
+    bool Import(const std::string& fileName, const std::string& scratchPath, const BatchSink& sink);
+    
+    static size_t GetMinMemory();
+    unsigned int GetMaxBatchVertices() const { return maxBatchVertices; }
+    size_t GetPeakMemory() const;
+    //Triangles of the last import skipped for indices past the attributes of the file
+    unsigned int GetDroppedTriangles() const { return droppedTriangles; }
+private:
+    size_t memoryBudget;
+    unsigned int maxBatchVertices;
+    unsigned int maxBatchIndices;
+    unsigned int tableMask;
+    
+    std::vector<char> readBuffer;
+    IndexedModel batch;
+    
+    //Welds (position, uv, normal) triples within the current batch
+    std::vector<OBJIndex> weldKeys;
+    std::vector<unsigned int> weldValues;
+    
+    const glm::vec3* positions;
+    const glm::vec2* uvs;
+    const glm::vec3* normals; //by normal index, or the summed face normals by position index
+    unsigned int totals[3];
+    bool hasUVs;
+    bool hasNormals;
+    unsigned int droppedTriangles;
+    
+    bool IsInRange(const OBJIndex& index) const;
+    bool SumFaceNormals(std::FILE* file, const std::string& positionsPath, const std::string& sumsPath);
+    void AddTriangle(const OBJIndex* corners, const BatchSink& sink);
+    unsigned int AddVertex(const OBJIndex& index);
+    void Flush(const BatchSink& sink);
 };
 
 #endif // OBJ_LOADER_H_INCLUDED
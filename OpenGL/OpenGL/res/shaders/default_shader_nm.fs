@@ -1,6 +1,9 @@
 #version 420 core
 #extension GL_ARB_explicit_uniform_location : enable
 
+// Must match SHADOW_MAX_CASCADES of ShadowCascades.h
+#define SHADOW_CASCADES 4
+
 struct Light
 {
 	vec3 ambient;
@@ -13,7 +16,11 @@ struct DirectionalLight
 {
 	Light light;
 };
-uniform DirectionalLight directionalLight;
+
+layout(std140) uniform Lights
+{
+	DirectionalLight directionalLight;
+};
 
 struct Material
 {
@@ -29,20 +36,29 @@ struct Maps
 	sampler2D diffuse;
 	sampler2D normal;
 	sampler2D specular;	
-	sampler2D shadow;
+	sampler2DArrayShadow shadow;	// a layer per cascade
 };
 uniform Maps maps;
 
 in VS_OUT
 {
 	vec4 position;	
-	vec4 positionLightSpace;
 	vec2 texCoords;
 	mat3 TBN;
 }fs_in;
 
-// Fragment shader uniforms base: 20
-layout(location = 20) uniform vec3 eyePosition;
+layout(std140) uniform ViewProjectionLighSpace
+{
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpace[SHADOW_CASCADES];	// as last drawn
+	vec4 cascadeSplits;		// far view depth of each cascade
+	vec4 cascadeBias;
+	int cascadeCount;
+	int shadowFilterRadius;	// PCF over (2 * radius + 1)^2 hardware 2x2 taps
+	vec4 eyePosition;
+	vec4 lightGrid;
+};
 
 uniform bool reflection;
 
@@ -62,7 +78,7 @@ void Phong(in Light light, inout vec4 ambient, inout vec4 diffuse, inout vec4 sp
 	lightVector = normalize(vec4(light.position, 1.0f) - fs_in.position);
 	diff = max(dot(normal, lightVector), 0.0f);
 
-	viewVector    = normalize(vec4(eyePosition, 1.0f) - fs_in.position);
+	viewVector    = normalize(eyePosition - fs_in.position);
 	reflectVector = normalize(reflect(-lightVector, normal));	
 	float specularStrength 	= 2;
 	spec = specularStrength * pow(max(dot(viewVector, reflectVector), 0.0f), material.shininess);
@@ -86,7 +102,7 @@ void Blinn_Phong(in Light light, inout vec4 ambient, inout vec4 diffuse, inout v
 	lightVector = normalize(vec4(light.position, 1.0f) - fs_in.position);
 	diff = max(dot(normal, lightVector), 0.0f);
 
-	viewVector    = normalize(vec4(eyePosition, 1.0f) - fs_in.position);
+	viewVector    = normalize(eyePosition - fs_in.position);
 	halfwayVector = normalize(lightVector + viewVector);
 	spec = pow(max(dot(normal, halfwayVector), 0.0f), material.shininess);
 
@@ -95,7 +111,7 @@ void Blinn_Phong(in Light light, inout vec4 ambient, inout vec4 diffuse, inout v
 	specular += spec * vec4(light.specular, 1.0f);	
 }
 
-float ShadowCalculation(vec4 fragPosLightSpace);
+float ShadowCalculation(vec4 position);
 
 void main()
 {	
@@ -108,7 +124,7 @@ void main()
 		fragColor = (ambient + diffuse + specular);
 	else
 	{
-		float shadow = ShadowCalculation(fs_in.positionLightSpace);
+		float shadow = ShadowCalculation(fs_in.position);
 		fragColor = (ambient + (1.0f - shadow) * (diffuse + specular));
 	}
     fragColor *= texture(maps.diffuse, fs_in.texCoords);   
@@ -118,19 +134,31 @@ void main()
 
 
 
-float ShadowCalculation(vec4 fragPosLightSpace)
+// Picks the cascade by the fragment's view depth; a cascade that has not been redrawn
+// since the camera moved may no longer cover the fragment, which then tries the next
+float ShadowCalculation(vec4 position)
 {
-	// perform perspective divide
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    // Transform to [0,1] range
-    projCoords = projCoords * 0.5 + 0.5;
-    // Get closest depth value from light's perspective (using [0,1] range fragPosLight as coords)
-    float closestDepth = texture(maps.shadow, projCoords.xy).r; 
-    // Get depth of current fragment from light's perspective
-    float currentDepth = projCoords.z;
-    // Check whether current frag pos is in shadow
-    float bias = 0.005;
-    float shadow = currentDepth - bias > closestDepth  ? 1.0 : 0.0;
-
-    return shadow;	
-}
\ No newline at end of file
+	float depth = -(view * position).z;
+	int cascade = 0;
+	while (cascade < cascadeCount - 1 && depth > cascadeSplits[cascade])
+		cascade++;
+	if (depth > cascadeSplits[cascadeCount - 1])
+		return 0.0;
+
+	for (; cascade < cascadeCount; ++cascade)
+	{
+		vec4 fragPosLightSpace = lightSpace[cascade] * position;
+		vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+		if (all(greaterThanEqual(projCoords, vec3(0.0))) && all(lessThanEqual(projCoords, vec3(1.0))))
+		{
+			vec2 texel = 1.0 / vec2(textureSize(maps.shadow, 0).xy);
+			float lit = 0.0;
+			for (int y = -shadowFilterRadius; y <= shadowFilterRadius; ++y)
+				for (int x = -shadowFilterRadius; x <= shadowFilterRadius; ++x)
+					lit += texture(maps.shadow, vec4(projCoords.xy + vec2(x, y) * texel, cascade, projCoords.z - cascadeBias[cascade]));
+			float taps = 2 * shadowFilterRadius + 1;
+			return 1.0 - lit / (taps * taps);
+		}
+	}
+	return 0.0;
+}
@@ -1,6 +1,9 @@
 #version 420 core
 #extension GL_ARB_explicit_uniform_location : enable
 
+// Must match SHADOW_MAX_CASCADES of ShadowCascades.h
+#define SHADOW_CASCADES 4
+
 // Input attributes base: 0
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
@@ -11,33 +14,64 @@ layout(std140) uniform ViewProjectionLighSpace
 {
 	mat4 view;
 	mat4 projection;
-	mat4 lightSpace;
+	mat4 lightSpace[SHADOW_CASCADES];	// as last drawn
+	vec4 cascadeSplits;		// far view depth of each cascade
+	vec4 cascadeBias;
+	int cascadeCount;
+	int shadowFilterRadius;	// PCF over (2 * radius + 1)^2 hardware 2x2 taps
+	vec4 eyePosition;
+	vec4 lightGrid;
+};
+
+// Per-instance attributes base: 4, identity for draws that are not instanced
+layout (location = 4) in mat4 instanceModel;
+layout (location = 8) in mat3 instanceNormal;
+
+// Transformation matrices, streamed per draw
+layout(std140) uniform PerDraw
+{
+	mat4 model;
+	mat4 inverseTranspose;
 };
 
-// Transformation matrices base: 10
-layout(location = 10) uniform mat4 model;
-layout(location = 11) uniform mat4 inverseTranspose;
+// Vertex decoding base: 15, identity for float vertices
+layout(location = 15) uniform vec3 positionScale  = vec3(1.0f);
+layout(location = 16) uniform vec3 positionOffset = vec3(0.0f);
+layout(location = 17) uniform bool octEncoded	  = false;
 
 uniform sampler2D bump;
 
 out VS_OUT
 {
 	vec4 position;	
-	vec4 positionLightSpace;
 	vec2 texCoords;
 	mat3 TBN;
 } vs_out;
 
+vec3 DecodeDirection(vec3 direction)
+{
+	if (!octEncoded)
+		return direction;
+
+	vec3 v = vec3(direction.xy, 1.0f - abs(direction.x) - abs(direction.y));
+	if (v.z < 0.0f)
+		v.xy = (1.0f - abs(v.yx)) * vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+	return normalize(v);
+}
+
 void main()
 {
-	vs_out.position  = model * vec4(position, 1.0f);
-	vs_out.positionLightSpace = lightSpace * vs_out.position;
+	vec3 vPosition = positionOffset + position * positionScale;
+	vec3 vNormal   = DecodeDirection(normal);
+	vec3 vTangent  = DecodeDirection(tangent);
+	mat4 world	   = model * instanceModel;
+	vs_out.position  = world * vec4(vPosition, 1.0f);
 	vs_out.texCoords = texCoords;	
-	vec3 T = normalize((model * vec4(tangent, 0.0f)).xyz);
-	vec3 N = normalize((model * vec4(normal, 0.0f)).xyz);
+	vec3 T = normalize((world * vec4(vTangent, 0.0f)).xyz);
+	vec3 N = normalize((world * vec4(vNormal, 0.0f)).xyz);
 	vec3 B = normalize(cross(T, N));
 	vs_out.TBN = mat3(T, B, N);
 
 
-    gl_Position = projection * view * model * vec4(position, 1.0f);        
+    gl_Position = projection * view * vs_out.position;        
 }
\ No newline at end of file
@@ -0,0 +1,52 @@
+#version 420 core
+
+// Must match POINT_SHADOW_FACES of PointShadows.h
+#define POINT_SHADOW_FACES 6
+
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;
+
+// The cube of one point light, written before each draw of its pass
+layout(std140) uniform PointShadowFaces
+{
+	mat4 faceViewProjection[POINT_SHADOW_FACES];
+	int firstLayer;	// of the light's cube in the array
+	int faceMask;	// faces the draw is copied to
+};
+
+// Whether the triangle lies wholly outside one of the planes of a face's frustum
+bool Outside(vec4 a, vec4 b, vec4 c)
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (a[axis] > a.w && b[axis] > b.w && c[axis] > c.w)
+			return true;
+		if (a[axis] < -a.w && b[axis] < -b.w && c[axis] < -c.w)
+			return true;
+	}
+	return false;
+}
+
+// Copies the triangle to the layer of every face of the mask it reaches
+void main()
+{
+	for (int face = 0; face < POINT_SHADOW_FACES; ++face)
+	{
+		if ((faceMask & (1 << face)) == 0)
+			continue;
+
+		vec4 clip[3];
+		for (int i = 0; i < 3; ++i)
+			clip[i] = faceViewProjection[face] * gl_in[i].gl_Position;
+		if (Outside(clip[0], clip[1], clip[2]))
+			continue;
+
+		for (int i = 0; i < 3; ++i)
+		{
+			gl_Layer = firstLayer + face;
+			gl_Position = clip[i];
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
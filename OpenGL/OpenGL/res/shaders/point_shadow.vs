@@ -0,0 +1,28 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// Input attributes base: 0, positions only
+layout (location = 0) in vec3 position;
+
+// Per-instance attributes base: 4, identity for draws that are not instanced
+layout (location = 4) in mat4 instanceModel;
+
+// Transformation matrices, streamed per draw
+layout(std140) uniform PerDraw
+{
+	mat4 model;
+	mat4 inverseTranspose;
+};
+
+// Vertex decoding base: 15, identity for float vertices; octEncoded is set
+// with the others but has no normals to decode here
+layout(location = 15) uniform vec3 positionScale  = vec3(1.0f);
+layout(location = 16) uniform vec3 positionOffset = vec3(0.0f);
+layout(location = 17) uniform bool octEncoded	  = false;
+
+// World space; the geometry shader projects it onto each cube face
+void main()
+{
+	vec3 vPosition = positionOffset + position * positionScale;
+	gl_Position = model * instanceModel * vec4(vPosition, 1.0f);
+}
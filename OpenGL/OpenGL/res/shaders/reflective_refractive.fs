@@ -1,7 +1,14 @@
 #version 420 core
 #extension GL_ARB_explicit_uniform_location : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
 
-#define NUM_POINT_LIGHTS 3
+// Must match SHADOW_MAX_CASCADES of ShadowCascades.h
+#define SHADOW_CASCADES 4
+
+// Must match LIGHT_GRID_X, LIGHT_GRID_Y and LIGHT_GRID_Z of LightGrid.h
+#define LIGHT_GRID_X 16
+#define LIGHT_GRID_Y 9
+#define LIGHT_GRID_Z 24
 #define SPECULAR_STRENGTH 4
 
 struct Material
@@ -25,7 +32,11 @@ struct DirectionalLight
 {
 	Light light;
 };
-uniform DirectionalLight directionalLight;
+
+layout(std140) uniform Lights
+{
+	DirectionalLight directionalLight;
+};
 
 struct PointLight
 {
@@ -34,8 +45,18 @@ struct PointLight
 	float constant;
 	float linear;
 	float quadratic;
+
+	int shadowIndex;	// cube of the point shadow array, -1 for none
+	float shadowNear;
+	float shadowFar;
+	float shadowBias;	// a fraction of the distance to the light
 };
-uniform PointLight pointLight[NUM_POINT_LIGHTS];
+#ifdef GL_ARB_shader_storage_buffer_object
+layout(std430) readonly buffer PointLights
+{
+	PointLight pointLights[];
+};
+#endif
 
 struct SpotLight
 {
@@ -44,30 +65,73 @@ struct SpotLight
 	vec3 direction;
 	float cutOff;
 	float outerCutOff;
+
+	float constant;
+	float linear;
+	float quadratic;
+
+	mat4 shadowMatrix;	// world to shadow atlas coordinates and depth
+	int shadowed;
+	float shadowBias;
+};
+#ifdef GL_ARB_shader_storage_buffer_object
+layout(std430) readonly buffer SpotLights
+{
+	SpotLight spotLights[];
+};
+#endif
+
+// Lights binned into the clusters of the view on the CPU: the point light
+// indices of a cluster start at offset, its spot light indices follow
+struct LightCluster
+{
+	uint offset;
+	uint pointCount;
+	uint spotCount;
+};
+#ifdef GL_ARB_shader_storage_buffer_object
+layout(std430) readonly buffer LightClusters
+{
+	LightCluster lightClusters[];
+};
+layout(std430) readonly buffer LightIndices
+{
+	uint lightIndices[];
 };
-uniform SpotLight spotLight;
+#endif
 
 struct Maps
 {
 	sampler2D diffuse;	
 	sampler2D normal;
 	sampler2D specular;
-	sampler2D shadow;
+	sampler2DArrayShadow shadow;	// a layer per cascade
+	sampler2DShadow shadowAtlas;	// a tile per shadowed spot light
+	samplerCubeArrayShadow pointShadows;	// a cube per shadowed point light
 };
 uniform Maps maps;
 
 in VS_OUT
 {
 	vec4 position;
-	vec4 positionLightSpace;
 	vec4 normal;
 } fs_in;
 
-// Fragment shader uniforms base: 20
-layout(location = 20) uniform vec3 			eyePosition;
+layout(std140) uniform ViewProjectionLighSpace
+{
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpace[SHADOW_CASCADES];	// as last drawn
+	vec4 cascadeSplits;		// far view depth of each cascade
+	vec4 cascadeBias;
+	int cascadeCount;
+	int shadowFilterRadius;	// PCF over (2 * radius + 1)^2 hardware 2x2 taps
+	vec4 eyePosition;
+	vec4 lightGrid;
+};
 
-// Texture samplers base: 30
-layout(location = 30) uniform samplerCube 	skyboxTex;
+// Bound to the skybox texture unit at startup
+uniform samplerCube skyboxTex;
 
 uniform bool reflection;
 
@@ -83,7 +147,7 @@ void Blinn_Phong(in Light light, inout vec4 ambient, inout vec4 diffuse, inout v
 	lightVector = normalize(vec4(light.position, 1.0f) - fs_in.position);
 	diff = max(dot(normal, lightVector), 0.0f);
 
-	viewVector    = normalize(vec4(eyePosition, 1.0f) - fs_in.position);
+	viewVector    = normalize(eyePosition - fs_in.position);
 	halfwayVector = normalize(lightVector + viewVector);
 	spec = pow(max(dot(normal, halfwayVector), 0.0f), material.shininess);
 
@@ -92,7 +156,20 @@ void Blinn_Phong(in Light light, inout vec4 ambient, inout vec4 diffuse, inout v
 	specular += SPECULAR_STRENGTH * spec * vec4(light.specular, 1.0f);	
 }
 
-float ShadowCalculation(vec4 fragPosLightSpace);
+float ShadowCalculation(vec4 position);
+
+// Cluster of the fragment: its screen tile and its depth slice, logarithmic for
+// perspective views (lightGrid.z == 1)
+uint LightClusterIndex()
+{
+	vec4 viewPosition = view * fs_in.position;
+	vec4 clipPosition = projection * viewPosition;
+	vec2 tile = clamp((clipPosition.xy / clipPosition.w * 0.5f + 0.5f) * vec2(LIGHT_GRID_X, LIGHT_GRID_Y),
+		vec2(0.0f), vec2(LIGHT_GRID_X - 1, LIGHT_GRID_Y - 1));
+	float depth = max(-viewPosition.z, 1e-6f);
+	float slice = clamp((lightGrid.z != 0.0f ? log(depth) : depth) * lightGrid.x + lightGrid.y, 0.0f, LIGHT_GRID_Z - 1);
+	return uint(tile.x) + LIGHT_GRID_X * (uint(tile.y) + LIGHT_GRID_Y * uint(slice));
+}
 
 void CalcPointLight(in PointLight pointLight, inout vec4 ambient, inout vec4 diffuse, inout vec4 specular);
 void CalcSpotLight(in SpotLight spotLight, inout vec4 ambient, inout vec4 diffuse, inout vec4 specular);
@@ -110,16 +187,28 @@ void main()
 	diffuse += tmpDiffuse;
 	specular += tmpSpecular;		
 		
-	for(int i = 0; i < NUM_POINT_LIGHTS; ++i)
+#ifdef GL_ARB_shader_storage_buffer_object
+	// Point and spot lights need the storage buffers; without them the directional light is all
+	LightCluster cluster = lightClusters[LightClusterIndex()];
+	for(uint i = 0; i < cluster.pointCount; ++i)
+	{	
+		tmpAmbient = tmpDiffuse = tmpSpecular = vec4(0.0f);
+		CalcPointLight(pointLights[lightIndices[cluster.offset + i]], tmpAmbient, tmpDiffuse, tmpSpecular);
+		ambient += tmpAmbient;
+		diffuse += tmpDiffuse;
+		specular += tmpSpecular;
+	}
+	for(uint i = 0; i < cluster.spotCount; ++i)
 	{	
 		tmpAmbient = tmpDiffuse = tmpSpecular = vec4(0.0f);
-		CalcPointLight(pointLight[i], tmpAmbient, tmpDiffuse, tmpSpecular);
+		CalcSpotLight(spotLights[lightIndices[cluster.offset + cluster.pointCount + i]], tmpAmbient, tmpDiffuse, tmpSpecular);
 		ambient += tmpAmbient;
 		diffuse += tmpDiffuse;
 		specular += tmpSpecular;
 	}
+#endif
 
-	vec4 incident = normalize(fs_in.position - vec4(eyePosition, 1.0f));
+	vec4 incident = normalize(fs_in.position - eyePosition);
 	vec4 refl = reflect(incident, normalize(fs_in.normal));
 	float ratio = 1.00f / 1.52f;    
     vec4 refr = refract(incident, normalize(fs_in.normal), ratio);
@@ -129,7 +218,7 @@ void main()
 		fragColor = (ambient + diffuse + specular);
 	else
 	{
-		float shadow = ShadowCalculation(fs_in.positionLightSpace);
+		float shadow = ShadowCalculation(fs_in.position);
 		fragColor = (ambient + (1.0f - shadow) * (diffuse + specular));
 	}
     fragColor *= (a * texture(skyboxTex, refl.xyz) + ia * texture(skyboxTex, refr.xyz));
@@ -139,21 +228,59 @@ void main()
 
 
 
-float ShadowCalculation(vec4 fragPosLightSpace)
+// Picks the cascade by the fragment's view depth; a cascade that has not been redrawn
+// since the camera moved may no longer cover the fragment, which then tries the next
+float ShadowCalculation(vec4 position)
 {
-	// perform perspective divide
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    // Transform to [0,1] range
-    projCoords = projCoords * 0.5 + 0.5;
-    // Get closest depth value from light's perspective (using [0,1] range fragPosLight as coords)
-    float closestDepth = texture(maps.shadow, projCoords.xy).r; 
-    // Get depth of current fragment from light's perspective
-    float currentDepth = projCoords.z;
-    // Check whether current frag pos is in shadow
-    float bias = 0.005;
-    float shadow = currentDepth - bias > closestDepth  ? 1.0 : 0.0;
+	float depth = -(view * position).z;
+	int cascade = 0;
+	while (cascade < cascadeCount - 1 && depth > cascadeSplits[cascade])
+		cascade++;
+	if (depth > cascadeSplits[cascadeCount - 1])
+		return 0.0;
+
+	for (; cascade < cascadeCount; ++cascade)
+	{
+		vec4 fragPosLightSpace = lightSpace[cascade] * position;
+		vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+		if (all(greaterThanEqual(projCoords, vec3(0.0))) && all(lessThanEqual(projCoords, vec3(1.0))))
+		{
+			vec2 texel = 1.0 / vec2(textureSize(maps.shadow, 0).xy);
+			float lit = 0.0;
+			for (int y = -shadowFilterRadius; y <= shadowFilterRadius; ++y)
+				for (int x = -shadowFilterRadius; x <= shadowFilterRadius; ++x)
+					lit += texture(maps.shadow, vec4(projCoords.xy + vec2(x, y) * texel, cascade, projCoords.z - cascadeBias[cascade]));
+			float taps = 2 * shadowFilterRadius + 1;
+			return 1.0 - lit / (taps * taps);
+		}
+	}
+	return 0.0;
+}
 
-    return shadow;	
+// Part of the point light kept from the fragment by its cube. The face is picked by the
+// major axis of the direction from the light, whose length is the view depth the face
+// stored; the kernel steps a texel at a time across that axis.
+float PointShadowCalculation(in PointLight pointLight)
+{
+	if (pointLight.shadowIndex < 0)
+		return 0.0;
+	vec3 direction = fs_in.position.xyz - pointLight.light.position;
+	vec3 absDirection = abs(direction);
+	float major = max(absDirection.x, max(absDirection.y, absDirection.z));
+	float near = pointLight.shadowNear;
+	float far  = pointLight.shadowFar;
+	float depth = (far + near) / (far - near) - 2.0 * far * near / ((far - near) * major * (1.0 - pointLight.shadowBias));
+	depth = depth * 0.5 + 0.5;
+
+	vec3 u = absDirection.x == major ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+	vec3 v = absDirection.z == major ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+	float texel = 2.0 * major / textureSize(maps.pointShadows, 0).x;
+	float lit = 0.0;
+	for (int y = -shadowFilterRadius; y <= shadowFilterRadius; ++y)
+		for (int x = -shadowFilterRadius; x <= shadowFilterRadius; ++x)
+			lit += texture(maps.pointShadows, vec4(direction + (float(x) * u + float(y) * v) * texel, pointLight.shadowIndex), depth);
+	float taps = 2 * shadowFilterRadius + 1;
+	return 1.0 - lit / (taps * taps);
 }
 
 void CalcPointLight(in PointLight pointLight, inout vec4 ambient, inout vec4 diffuse, inout vec4 specular)
@@ -161,27 +288,45 @@ void CalcPointLight(in PointLight pointLight, inout vec4 ambient, inout vec4 dif
 	Blinn_Phong(pointLight.light, ambient, diffuse, specular);
 	float dist = length(vec4(pointLight.light.position, 1.0f) - fs_in.position);
 	float atenuation = 1.0f / (pointLight.constant + pointLight.linear * dist + pointLight.quadratic * pow(dist, 2));
+	float lit = 1.0f - PointShadowCalculation(pointLight);
 	ambient  *= atenuation;
-	diffuse  *= atenuation;
-	specular *= atenuation;
+	diffuse  *= atenuation * lit;
+	specular *= atenuation * lit;
+}
+
+// Part of the spot light kept from the fragment by its tile of the shadow atlas,
+// filtered like the cascades
+float SpotShadowCalculation(in SpotLight spotLight)
+{
+	if (spotLight.shadowed == 0)
+		return 0.0;
+	vec4 coords = spotLight.shadowMatrix * fs_in.position;
+	coords.xyz /= coords.w;
+	vec2 texel = 1.0 / vec2(textureSize(maps.shadowAtlas, 0));
+	float lit = 0.0;
+	for (int y = -shadowFilterRadius; y <= shadowFilterRadius; ++y)
+		for (int x = -shadowFilterRadius; x <= shadowFilterRadius; ++x)
+			lit += texture(maps.shadowAtlas, vec3(coords.xy + vec2(x, y) * texel, coords.z - spotLight.shadowBias));
+	float taps = 2 * shadowFilterRadius + 1;
+	return 1.0 - lit / (taps * taps);
 }
 
+// Full intensity inside cutOff, fading out towards outerCutOff; attenuated like point lights
+// and shadowed through the atlas
 void CalcSpotLight(in SpotLight spotLight, inout vec4 ambient, inout vec4 diffuse, inout vec4 specular)
 {
 	vec4 lightVector = normalize(vec4(spotLight.light.position, 1.0f) - fs_in.position);
 	float theta = dot(lightVector, normalize(-vec4(spotLight.direction, 0.0f)));		
-	if(theta > spotLight.cutOff)
+	if(theta > spotLight.outerCutOff)
 	{
 		Blinn_Phong(spotLight.light, ambient, diffuse, specular);
 		float epsilon = spotLight.cutOff - spotLight.outerCutOff;
-		float intensity = clamp((spotLight.cutOff - theta) / epsilon, 0.0f, 1.0f);
-		diffuse  *= intensity;
-		specular *= intensity;
-	}
-	else
-	{
-		ambient  = vec4(spotLight.light.ambient, 1.0f);
-		diffuse  = vec4(0.0f);
-		specular = vec4(0.0f);
+		float intensity = clamp((theta - spotLight.outerCutOff) / epsilon, 0.0f, 1.0f);
+		float dist = length(vec4(spotLight.light.position, 1.0f) - fs_in.position);
+		float atenuation = 1.0f / (spotLight.constant + spotLight.linear * dist + spotLight.quadratic * pow(dist, 2));
+		float lit = 1.0f - SpotShadowCalculation(spotLight);
+		ambient  *= atenuation;
+		diffuse  *= intensity * atenuation * lit;
+		specular *= intensity * atenuation * lit;
 	}
 }
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 420 core
+
+// Depth only; the shadow map framebuffer has no color attachment
+void main()
+{
+}
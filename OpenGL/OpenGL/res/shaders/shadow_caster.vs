@@ -0,0 +1,43 @@
+#version 420 core
+#extension GL_ARB_explicit_uniform_location : enable
+
+// Must match SHADOW_MAX_CASCADES of ShadowCascades.h
+#define SHADOW_CASCADES 4
+
+// Input attributes base: 0, positions only
+layout (location = 0) in vec3 position;
+
+layout(std140) uniform ViewProjectionLighSpace
+{
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpace[SHADOW_CASCADES];	// as last drawn
+	vec4 cascadeSplits;		// far view depth of each cascade
+	vec4 cascadeBias;
+	int cascadeCount;
+	int shadowFilterRadius;	// PCF over (2 * radius + 1)^2 hardware 2x2 taps
+	vec4 eyePosition;
+	vec4 lightGrid;
+};
+
+// Per-instance attributes base: 4, identity for draws that are not instanced
+layout (location = 4) in mat4 instanceModel;
+
+// Transformation matrices, streamed per draw
+layout(std140) uniform PerDraw
+{
+	mat4 model;
+	mat4 inverseTranspose;
+};
+
+// Vertex decoding base: 15, identity for float vertices; octEncoded is set
+// with the others but has no normals to decode here
+layout(location = 15) uniform vec3 positionScale  = vec3(1.0f);
+layout(location = 16) uniform vec3 positionOffset = vec3(0.0f);
+layout(location = 17) uniform bool octEncoded	  = false;
+
+void main()
+{
+	vec3 vPosition = positionOffset + position * positionScale;
+	gl_Position = projection * view * model * instanceModel * vec4(vPosition, 1.0f);
+}
@@ -1,6 +1,9 @@
 #version 420 core
 #extension GL_ARB_explicit_uniform_location : enable
 
+// Must match SHADOW_MAX_CASCADES of ShadowCascades.h
+#define SHADOW_CASCADES 4
+
 // Input attributes base: 0
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
@@ -10,11 +13,21 @@ layout(std140) uniform ViewProjectionLighSpace
 {
 	mat4 view;
 	mat4 projection;
-	mat4 lightSpace;
+	mat4 lightSpace[SHADOW_CASCADES];	// as last drawn
+	vec4 cascadeSplits;		// far view depth of each cascade
+	vec4 cascadeBias;
+	int cascadeCount;
+	int shadowFilterRadius;	// PCF over (2 * radius + 1)^2 hardware 2x2 taps
+	vec4 eyePosition;
+	vec4 lightGrid;
 };
 
-// Transformation matrices base: 10
-layout(location = 10) uniform mat4 model;
+// Transformation matrices, streamed per draw
+layout(std140) uniform PerDraw
+{
+	mat4 model;
+	mat4 inverseTranspose;
+};
 
 out vec3 f_texCoords;
 